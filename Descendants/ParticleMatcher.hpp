@@ -11,6 +11,7 @@
 #include <iomanip>  // setfill, setw, setprecision
 #include <cmath>    // pow
 #include <cassert>
+#include <memory>  // shared_ptr
 
 #include <algorithm>  // find, stable_sort
 #ifdef USE_OPENMP
@@ -78,6 +79,207 @@ private:
   std::pair<index_type, real_type> value_;
 };
 
+/** Particles in subhalos and some subhalo info from a single snapshot,
+ * which can be shared by the two ParticleMatcher objects that use it. */
+struct SnapshotParticles {
+  /** Snapshot number. */
+  snapnum_type snapnum;
+  /** Number of particles in each subhalo. */
+  std::vector<uint32_t> sub_len;
+  /** Mass of each subhalo. */
+  std::vector<real_type> sub_mass;
+  /** Index of parent FoF group. */
+  std::vector<uint32_t> sub_grnr;
+  /** Particles in subhalos, sorted by ID. */
+  std::vector<ParticleInfo> particles;
+
+  /** Return the (approximate) memory used, in bytes. */
+  uint64_t memory_size() const {
+    return sizeof(uint32_t)*(sub_len.size() + sub_grnr.size()) +
+        sizeof(real_type)*sub_mass.size() +
+        sizeof(ParticleInfo)*particles.capacity();
+  }
+};
+
+/** @brief Read particle IDs and other information from a snapshot.
+ *
+ * @param[in] basedir Directory containing the snapshot files.
+ * @param[in] snapnum Snapshot number.
+ * @param[in] tracking_scheme Either "Subhalos" or "Galaxies".
+ * @param[in] alpha_weight Exponent of the particle weights (RG15).
+ * @param[in] verbose Whether to print progress and timing information.
+ * @param[in] catalog_cache_dir If not empty, directory with the cached
+ *            Subfind catalogs (see subfind::CatalogReader).
+ * @return The particles in subhalos, sorted by ID, and some subhalo info.
+ */
+SnapshotParticles read_snapshot_particles(const std::string& basedir,
+    const snapnum_type snapnum, const std::string& tracking_scheme,
+    const real_type alpha_weight, const bool verbose = true,
+    const std::string& catalog_cache_dir = "") {
+  SnapshotParticles retval;
+  retval.snapnum = snapnum;
+
+  // For performance checks (not printed if verbose is false)
+  std::ostream out(verbose ? std::cout.rdbuf() : nullptr);
+  WallClock wall_clock_all;
+  WallClock wall_clock;
+
+  // Define particle types
+  std::vector<int> parttypes;
+  if (tracking_scheme == "Subhalos")
+    parttypes = {1};  // DM
+  else if (tracking_scheme == "Galaxies")
+    parttypes = {0, 4};  // gas and stars
+  else
+    assert(false);
+  unsigned num_parttypes = parttypes.size();
+
+  // Load some subhalo info and initialize member variables
+  out << "Loading subhalo info...\n";
+  wall_clock.start();
+  subfind::CatalogReader catalog(basedir, snapnum, catalog_cache_dir);
+  uint32_t nsubs = catalog.num_subhalos();
+
+  if (!nsubs)
+    return retval; // no subhalos in this snapshot
+
+  std::vector<std::vector<uint32_t>> sub_len_parttype(num_parttypes);
+  std::vector<std::vector<uint64_t>> sub_offset_parttype;
+  for (unsigned l = 0; l < num_parttypes; ++l) {
+    catalog.add("Subhalo", "SubhaloLenType", &sub_len_parttype[l],
+        parttypes[l]);
+  }
+  // Initialize subhalo info
+  if (tracking_scheme == "Subhalos")
+    catalog.add("Subhalo", "SubhaloMassType", &retval.sub_mass, parttypes[0]);
+  catalog.add("Subhalo", "SubhaloGrNr", &retval.sub_grnr, -1);
+  catalog.read();
+  for (unsigned l = 0; l < num_parttypes; ++l) {
+    sub_offset_parttype.push_back(calculate_subhalo_offsets(
+        catalog, parttypes[l]));
+  }
+  if (tracking_scheme == "Subhalos") {
+    retval.sub_len = sub_len_parttype[0];  // DM
+  }
+  else {  // Galaxies
+    retval.sub_len = std::vector<uint32_t>(nsubs, 0);
+    retval.sub_mass = std::vector<real_type>(nsubs, 0);
+  }
+  out << "Time: " << wall_clock.seconds() << " s.\n";
+
+  // Reserve space in memory when dealing with DM
+  if (tracking_scheme == "Subhalos") {
+    part_id_type npart_in_subhalos = 0;
+    for (uint32_t i = 0; i < nsubs; ++i)
+      npart_in_subhalos += sub_len_parttype[0][i];
+    retval.particles.reserve(npart_in_subhalos);
+  }
+
+  arepo::SnapshotReader snapshot(basedir, snapnum);
+  for (unsigned l = 0; l < num_parttypes; ++l) {
+    // Load particle IDs, as well as masses for baryons. Gas cells are
+    // only considered if they are star-forming, and rows keeps their
+    // positions in the snapshot. All blocks are read in a single pass.
+    out << "Loading particle data...\n";
+    wall_clock.start();
+    uint64_t nread = sub_offset_parttype[l][nsubs-1] + sub_len_parttype[l][nsubs-1];
+
+    std::vector<part_id_type> part_id;
+    std::vector<real_type> part_mass;
+    std::vector<real_type> part_sfr;
+    std::vector<part_id_type> rows;
+    snapshot.add("ParticleIDs", &part_id);
+    if (parttypes[l] != 1)
+      snapshot.add("Masses", &part_mass);
+    if (parttypes[l] == 0) {
+      snapshot.add("StarFormationRate", &part_sfr);
+      snapshot.read_if(parttypes[l], [&part_sfr](const uint64_t i) {
+          return part_sfr[i] > 0; }, &rows, nread);
+    }
+    else {
+      snapshot.read(parttypes[l], nread);
+    }
+    out << "Time: " << wall_clock.seconds() << " s.\n";
+
+    // Associate particles with subhalos
+    out << "Associating particles with subhalos...\n";
+    wall_clock.start();
+    if (parttypes[l] == 1) {  // DM
+      for (uint32_t sub_uindex = 0; sub_uindex < nsubs; ++sub_uindex) {
+        part_id_type snap_count = sub_offset_parttype[l][sub_uindex];
+        for (uint32_t i = 0; i < sub_len_parttype[l][sub_uindex]; ++i) {
+          retval.particles.emplace_back(
+              part_id[snap_count],
+              sub_uindex,
+              std::pow(static_cast<real_type>(i+1), -alpha_weight));
+          ++snap_count;
+        }
+      }
+    }
+    else if (parttypes[l] == 0) {  // gas
+      // Star-forming cells are sorted by snapshot position, like
+      // subhalos, so both can be traversed together.
+      const auto& sub_offset = sub_offset_parttype[l];
+      const auto& sub_len = sub_len_parttype[l];
+      uint32_t sub_uindex = 0;
+      for (uint64_t j = 0; j < rows.size(); ++j) {
+        while (rows[j] >= sub_offset[sub_uindex] + sub_len[sub_uindex])
+          ++sub_uindex;
+        // Skip cells that belong to a FoF group but not to a subhalo
+        if (rows[j] < sub_offset[sub_uindex])
+          continue;
+        uint32_t i = rows[j] - sub_offset[sub_uindex];
+        retval.particles.emplace_back(
+            part_id[j],
+            sub_uindex,
+            part_mass[j] * std::pow(
+                static_cast<real_type>(i+1), -alpha_weight));
+        retval.sub_len[sub_uindex] += 1;
+        retval.sub_mass[sub_uindex] += part_mass[j];
+      }
+    }
+    else if (parttypes[l] == 4) {  // stars
+      for (uint32_t sub_uindex = 0; sub_uindex < nsubs; ++sub_uindex) {
+        part_id_type snap_count = sub_offset_parttype[l][sub_uindex];
+        for (uint32_t i = 0; i < sub_len_parttype[l][sub_uindex]; ++i) {
+          retval.particles.emplace_back(
+              part_id[snap_count],
+              sub_uindex,
+              part_mass[snap_count] * std::pow(
+                  static_cast<real_type>(i+1), -alpha_weight));
+          retval.sub_len[sub_uindex] += 1;
+          retval.sub_mass[sub_uindex] += part_mass[snap_count];
+          ++snap_count;
+        }
+      }
+    }
+    else {
+      assert(false);
+    }
+    out << "Time: " << wall_clock.seconds() << " s.\n";
+    out << "Finished for parttype " << parttypes[l] << ".\n";
+  }
+
+  // Sort by particle ID. The sort is stable, so particles with the same
+  // ID stay in the order they were read.
+  out << "Sorting particles...\n";
+  wall_clock.start();
+  CPUClock cpu_clock;
+#ifdef USE_OPENMP
+  //hybrid_sort(retval.particles.begin(), retval.particles.end(), compareByID);
+  __gnu_parallel::stable_sort(retval.particles.begin(), retval.particles.end(),
+      compareByID);
+#else
+  std::stable_sort(retval.particles.begin(), retval.particles.end(),
+      compareByID);
+#endif
+  out << "Time: " << wall_clock.seconds() << " s.\n";
+  out << "Speedup: " << cpu_clock.seconds()/wall_clock.seconds() << ".\n";
+  out << "Finished reading snapshot " << snapnum << ".\n";
+  out << "Total time: " << wall_clock_all.seconds() << " s.\n\n";
+  return retval;
+}
+
 ////////////////////////////
 // PARTICLE MATCHER CLASS //
 ////////////////////////////
@@ -103,18 +305,30 @@ public:
   // CONSTRUCTOR AND DESTRUCTOR //
   ////////////////////////////////
 
-  /** Constructor. */
+  /** Constructor. Reads both snapshots. */
   ParticleMatcher(const std::string& basedir1, const std::string& basedir2,
       const snapnum_type snapnum1, const snapnum_type snapnum2,
       const std::string& tracking_scheme, const real_type alpha_weight)
-      : snap1_(nullptr), snap2_(nullptr), data_() {
-
-    // Create Snapshot objects.
-    snap1_ = new Snapshot(this, basedir1, snapnum1, tracking_scheme, alpha_weight);
+      : snap1_(nullptr), snap2_(nullptr) {
+    auto data1 = std::make_shared<const SnapshotParticles>(
+        read_snapshot_particles(basedir1, snapnum1, tracking_scheme,
+        alpha_weight));
+    std::shared_ptr<const SnapshotParticles> data2;
     if (snapnum2 != -1) {
-      snap2_ = new Snapshot(this, basedir2, snapnum2, tracking_scheme, alpha_weight);
-      match_particles();
+      data2 = std::make_shared<const SnapshotParticles>(
+          read_snapshot_particles(basedir2, snapnum2, tracking_scheme,
+          alpha_weight));
     }
+    init(data1, data2);
+  }
+
+  /** Constructor from snapshots that have already been read (see
+   * read_snapshot_particles), possibly shared with other ParticleMatcher
+   * objects. If @a data2 is null, no descendants are found. */
+  ParticleMatcher(std::shared_ptr<const SnapshotParticles> data1,
+      std::shared_ptr<const SnapshotParticles> data2)
+      : snap1_(nullptr), snap2_(nullptr) {
+    init(data1, data2);
   }
 
   /** Destructor. */
@@ -143,8 +357,7 @@ public:
   class Snapshot {
   public:
     /** Default constructor. Creates invalid Snapshot. */
-    Snapshot() : pm_(nullptr), basedir_(), snapnum_(-1), sub_len_(),
-        sub_mass_(), sub_grnr_(), descendants_(), first_scores_(),
+    Snapshot() : pm_(nullptr), data_(), descendants_(), first_scores_(),
         second_scores_() {
     }
     /** Default destructor. */
@@ -152,23 +365,15 @@ public:
 
     /** Return the number of subhalos in this Snapshot. */
     uint32_t nsubs() const {
-      return sub_len_.size();
+      return data_->sub_len.size();
     }
 
   private:
     friend class ParticleMatcher;
     // Pointer back to the ParticleMatcher container.
     ParticleMatcher* pm_;
-    // Directory containing the snapshot files.
-    std::string basedir_;
-    // Snapshot number.
-    snapnum_type snapnum_;
-    // Number of particles in each subhalo.
-    std::vector<uint32_t> sub_len_;
-    // Mass of each subhalo.
-    std::vector<real_type> sub_mass_;
-    // Index of parent FoF group
-    std::vector<uint32_t> sub_grnr_;
+    // Particles and subhalo info.
+    std::shared_ptr<const SnapshotParticles> data_;
     // Index of descendant subhalo.
     std::vector<index_type> descendants_;
     // Score of unique descendant.
@@ -177,147 +382,12 @@ public:
     std::vector<real_type> second_scores_;
 
     /** Private constructor. */
-    Snapshot(const ParticleMatcher* pm, const std::string& basedir,
-        const snapnum_type snapnum, const std::string& tracking_scheme,
-        const real_type alpha_weight)
-        : pm_(const_cast<ParticleMatcher*>(pm)), basedir_(basedir),
-          snapnum_(snapnum), sub_len_(), sub_mass_(), sub_grnr_(),
-          descendants_(), first_scores_(), second_scores_() {
-      // Read data
-      read_ids(tracking_scheme, alpha_weight);
-    }
-
-    /** @brief Read particle IDs and other information. */
-    void read_ids(const std::string& tracking_scheme,
-                  const real_type alpha_weight) {
-      // For performance checks
-      WallClock wall_clock_all;
-      WallClock wall_clock;
-
-      // Define particle types
-      std::vector<int> parttypes;
-      if (tracking_scheme == "Subhalos")
-        parttypes = {1};  // DM
-      else if (tracking_scheme == "Galaxies")
-        parttypes = {0, 4};  // gas and stars
-      else
-        assert(false);
-      unsigned num_parttypes = parttypes.size();
-
-      // Load some subhalo info and initialize member variables
-      std::cout << "Loading subhalo info...\n";
-      wall_clock.start();
-      auto nsubs = subfind::get_scalar_attribute<uint32_t>(
-          basedir_, snapnum_, "Nsubgroups_Total");
-
-      if (!nsubs)
-        return; // no subhalos in this snapshot
-
-      std::vector<std::vector<uint32_t>> sub_len_parttype;
-      std::vector<std::vector<uint64_t>> sub_offset_parttype;
-      for (unsigned l = 0; l < num_parttypes; ++l) {
-        sub_len_parttype.push_back(subfind::read_block<uint32_t>(
-            basedir_, snapnum_, "Subhalo", "SubhaloLenType", parttypes[l]));
-        sub_offset_parttype.push_back(calculate_subhalo_offsets(
-            basedir_, snapnum_, parttypes[l]));
-      }
-      // Initialize member variables
-      if (tracking_scheme == "Subhalos") {
-        sub_len_ = sub_len_parttype[0];  // DM
-        sub_mass_ = subfind::read_block<real_type>(
-            basedir_, snapnum_, "Subhalo", "SubhaloMassType", parttypes[0]);
-      }
-      else {  // Galaxies
-        sub_len_ = std::vector<uint32_t>(nsubs, 0);
-        sub_mass_ = std::vector<real_type>(nsubs, 0);
-      }
-      sub_grnr_ = subfind::read_block<uint32_t>(
-          basedir_, snapnum_, "Subhalo", "SubhaloGrNr", -1);
-      descendants_ = std::vector<index_type>(nsubs, -1);
-      first_scores_  = std::vector<real_type>(nsubs, 0);
-      second_scores_ = std::vector<real_type>(nsubs, 0);
-      std::cout << "Time: " << wall_clock.seconds() << " s.\n";
-
-      // Reserve space in memory when dealing with DM
-      if (tracking_scheme == "Subhalos") {
-        part_id_type npart_in_subhalos = 0;
-        for (uint32_t i = 0; i < nsubs; ++i)
-          npart_in_subhalos += sub_len_parttype[0][i];
-        pm_->data_.reserve(pm_->data_.size() + npart_in_subhalos);
-      }
-
-      for (unsigned l = 0; l < num_parttypes; ++l) {
-        // Load particle IDs
-        std::cout << "Loading particle IDs...\n";
-        wall_clock.start();
-        uint64_t nread = sub_offset_parttype[l][nsubs-1] + sub_len_parttype[l][nsubs-1];
-
-        auto part_id = arepo::read_block<part_id_type>(
-                  basedir_, snapnum_, "ParticleIDs", parttypes[l], nread);
-        std::cout << "Time: " << wall_clock.seconds() << " s.\n";
-
-        // Associate particles with subhalos
-        std::cout << "Associating particles with subhalos...\n";
-        wall_clock.start();
-        if (parttypes[l] == 1) {  // DM
-          for (uint32_t sub_uindex = 0; sub_uindex < nsubs; ++sub_uindex) {
-            part_id_type snap_count = sub_offset_parttype[l][sub_uindex];
-            for (uint32_t i = 0; i < sub_len_parttype[l][sub_uindex]; ++i) {
-              pm_->data_.emplace_back(
-                  part_id[snap_count],
-                  sub_uindex,
-                  std::pow(static_cast<real_type>(i+1), -alpha_weight));
-              ++snap_count;
-            }
-          }
-        }
-        else if (parttypes[l] == 0) {  // gas
-          auto part_mass = arepo::read_block<real_type>(
-                      basedir_, snapnum_, "Masses", parttypes[l], nread);
-          auto part_sfr = arepo::read_block<real_type>(
-                      basedir_, snapnum_, "StarFormationRate", parttypes[l], nread);
-          for (uint32_t sub_uindex = 0; sub_uindex < nsubs; ++sub_uindex) {
-            part_id_type snap_count = sub_offset_parttype[l][sub_uindex];
-            for (uint32_t i = 0; i < sub_len_parttype[l][sub_uindex]; ++i) {
-              // Only consider star-forming elements
-              if (part_sfr[snap_count] > 0) {
-                pm_->data_.emplace_back(
-                    part_id[snap_count],
-                    sub_uindex,
-                    part_mass[snap_count] * std::pow(
-                        static_cast<real_type>(i+1), -alpha_weight));
-                sub_len_[sub_uindex] += 1;
-                sub_mass_[sub_uindex] += part_mass[snap_count];
-              }
-              ++snap_count;
-            }
-          }
-        }
-        else if (parttypes[l] == 4) {  // stars
-          auto part_mass = arepo::read_block<real_type>(
-                      basedir_, snapnum_, "Masses", parttypes[l], nread);
-          for (uint32_t sub_uindex = 0; sub_uindex < nsubs; ++sub_uindex) {
-            part_id_type snap_count = sub_offset_parttype[l][sub_uindex];
-            for (uint32_t i = 0; i < sub_len_parttype[l][sub_uindex]; ++i) {
-              pm_->data_.emplace_back(
-                  part_id[snap_count],
-                  sub_uindex,
-                  part_mass[snap_count] * std::pow(
-                      static_cast<real_type>(i+1), -alpha_weight));
-              sub_len_[sub_uindex] += 1;
-              sub_mass_[sub_uindex] += part_mass[snap_count];
-              ++snap_count;
-            }
-          }
-        }
-        else {
-          assert(false);
-        }
-        std::cout << "Time: " << wall_clock.seconds() << " s.\n";
-        std::cout << "Finished for parttype " << parttypes[l] << ".\n";
-      }
-      std::cout << "Finished reading snapshot " << snapnum_ << ".\n";
-      std::cout << "Total time: " << wall_clock_all.seconds() << " s.\n\n";
+    Snapshot(const ParticleMatcher* pm,
+        std::shared_ptr<const SnapshotParticles> data)
+        : pm_(const_cast<ParticleMatcher*>(pm)), data_(data),
+          descendants_(data->sub_len.size(), -1),
+          first_scores_(data->sub_len.size(), 0),
+          second_scores_(data->sub_len.size(), 0) {
     }
 
     /** @brief Write to an HDF5 file. */
@@ -325,7 +395,7 @@ public:
       // Create filename
       std::stringstream tmp_stream;
       tmp_stream << writepath << "_" <<
-          std::setfill('0') << std::setw(3) << snapnum_ << ".hdf5";
+          std::setfill('0') << std::setw(3) << data_->snapnum << ".hdf5";
       std::string writefilename = tmp_stream.str();
 
       // Write to file
@@ -333,9 +403,9 @@ public:
       WallClock wall_clock;
       H5::H5File file(writefilename, H5F_ACC_TRUNC);
       if (writemisc) {
-        add_array(file, sub_len_, "SubhaloLen", H5::PredType::NATIVE_UINT32);
-        add_array(file, sub_mass_, "SubhaloMass", H5::PredType::NATIVE_FLOAT);
-        add_array(file, sub_grnr_, "SubhaloGrNr", H5::PredType::NATIVE_UINT32);
+        add_array(file, data_->sub_len, "SubhaloLen", H5::PredType::NATIVE_UINT32);
+        add_array(file, data_->sub_mass, "SubhaloMass", H5::PredType::NATIVE_FLOAT);
+        add_array(file, data_->sub_grnr, "SubhaloGrNr", H5::PredType::NATIVE_UINT32);
       }
       add_array(file, descendants_, "DescendantIndex", H5::PredType::NATIVE_INT32);
       add_array(file, first_scores_, "FirstScore", H5::PredType::NATIVE_FLOAT);
@@ -353,72 +423,85 @@ private:
 
   Snapshot* snap1_;
   Snapshot* snap2_;
-  std::vector<ParticleInfo> data_;
 
   //////////////////////////////
   // PRIVATE MEMBER FUNCTIONS //
   //////////////////////////////
 
+  /** @brief Create Snapshot objects and match particles. */
+  void init(std::shared_ptr<const SnapshotParticles> data1,
+      std::shared_ptr<const SnapshotParticles> data2) {
+    snap1_ = new Snapshot(this, data1);
+    if (data2 != nullptr) {
+      snap2_ = new Snapshot(this, data2);
+      match_particles();
+    }
+  }
+
   /** @brief Match particles between the two snapshots. */
   void match_particles() {
-    // Sort array
-    std::cout << "Sorting array...\n";
-    WallClock wall_clock;
-    CPUClock cpu_clock;
-#ifdef USE_OPENMP
-    //hybrid_sort(data_.begin(), data_.end(), compareByID);
-    __gnu_parallel::stable_sort(data_.begin(), data_.end(), compareByID);
-#else
-    std::stable_sort(data_.begin(), data_.end(), compareByID);
-#endif
-    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
-    std::cout << "Speedup: " << cpu_clock.seconds()/wall_clock.seconds() << ".\n";
-
-    // Iterate over particle coincidences to calculate scores
+    // Both particle arrays are sorted by ID. Go through them as if they
+    // had been merged into a single (stably) sorted array, one run of
+    // equal IDs at a time, with the particles from the first snapshot
+    // before those from the second one.
     std::cout << "Calculating scores...\n";
-    wall_clock.start();
+    WallClock wall_clock;
+    const auto& parts1 = snap1_->data_->particles;
+    const auto& parts2 = snap2_->data_->particles;
     std::vector<std::vector<Candidate>> scores(snap1_->nsubs());
-    for (auto data_it = data_.begin(); data_it+1 < data_.end(); ++data_it) {
+    std::vector<const ParticleInfo*> run;
+    auto it1 = parts1.begin();
+    auto it2 = parts2.begin();
+    while ((it1 != parts1.end()) || (it2 != parts2.end())) {
+      part_id_type cur_id = ((it2 == parts2.end()) ||
+          ((it1 != parts1.end()) && (it1->id <= it2->id))) ? it1->id : it2->id;
+      run.clear();
+      for ( ; (it1 != parts1.end()) && (it1->id == cur_id); ++it1)
+        run.push_back(&*it1);
+      for ( ; (it2 != parts2.end()) && (it2->id == cur_id); ++it2)
+        run.push_back(&*it2);
 
       // Check for bad part_id_type (see 2016/04/25 commit)
-      assert(data_it->id != 0);
+      assert(cur_id != 0);
 
       // Only care about repeated IDs
-      if (data_it->id != (data_it+1)->id)
-        continue;
-
-      // Add to score of current descendant candidate
-      index_type sub_index1 = data_it->sub_index;  // progenitor
-      index_type sub_index2 = (data_it+1)->sub_index;  // candidate
-
-      if (sub_index1 >= (int)snap1_->nsubs()) {
-        std::cerr << "WARNING: sub_index1=" << sub_index1 << " is out of bounds"
-                  << " (nsubs1=" << snap1_->nsubs() << ")\n";
-        continue;
-      }
-      auto& cur_cands = scores[sub_index1];
-      auto it = std::find(cur_cands.begin(), cur_cands.end(), sub_index2);
+      for (std::size_t k = 0; k+1 < run.size(); ++k) {
+        auto data_it = run[k];
+        auto next_it = run[k+1];
+
+        // Add to score of current descendant candidate
+        index_type sub_index1 = data_it->sub_index;  // progenitor
+        index_type sub_index2 = next_it->sub_index;  // candidate
+
+        if (sub_index1 >= (int)snap1_->nsubs()) {
+          std::cerr << "WARNING: sub_index1=" << sub_index1 << " is out of bounds"
+                    << " (nsubs1=" << snap1_->nsubs() << ")\n";
+          continue;
+        }
+        auto& cur_cands = scores[sub_index1];
+        auto it = std::find(cur_cands.begin(), cur_cands.end(), sub_index2);
 #ifdef SYMMETRIC
-      if (it == cur_cands.end())
-        cur_cands.emplace_back(sub_index2, data_it->weight + (data_it+1)->weight);
-      else
-        it->add_to_score(data_it->weight + (data_it+1)->weight);
+        if (it == cur_cands.end())
+          cur_cands.emplace_back(sub_index2, data_it->weight + next_it->weight);
+        else
+          it->add_to_score(data_it->weight + next_it->weight);
 #else
-      if (it == cur_cands.end())
-        cur_cands.emplace_back(sub_index2, data_it->weight);
-      else
-        it->add_to_score(data_it->weight);
+        if (it == cur_cands.end())
+          cur_cands.emplace_back(sub_index2, data_it->weight);
+        else
+          it->add_to_score(data_it->weight);
 #endif
-      if ( (data_it+1)->id == (data_it+2)->id )
-        std::cerr << "WARNING DUPLICATE ID: it+1 id=" << (data_it+1)->id << " sub=" << (data_it+1)->sub_index
-                  << " it+2 id=" << (data_it+2)->id << " sub=" << (data_it+2)->sub_index << std::endl;
-
-      // The following assertions might fail in L75n1820TNG (aka TNG100-1)
-      // due to duplicate PartType4 IDs. We comment them out hoping that
-      // this happens for a very small fraction of the particles.
-      //assert( (data_it+1)->id != (data_it+2)->id );
-      //assert(sub_index1 < (int)snap1_->nsubs());
-      //assert(sub_index2 < (int)snap2_->nsubs());
+        if (k+2 < run.size())
+          std::cerr << "WARNING DUPLICATE ID: it+1 id=" << next_it->id << " sub=" << next_it->sub_index
+                    << " it+2 id=" << run[k+2]->id << " sub=" << run[k+2]->sub_index << std::endl;
+
+        // The following assertions might fail in L75n1820TNG (aka TNG100-1)
+        // due to duplicate PartType4 IDs. We comment them out hoping that
+        // this happens for a very small fraction of the particles.
+        //assert(k+2 >= run.size());
+        //assert(sub_index1 < (int)snap1_->nsubs());
+        //assert(sub_index2 < (int)snap2_->nsubs());
+      }
     }
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
@@ -5,8 +5,12 @@
  */
 
 #include <fstream>
+#include <vector>
+#include <utility>  // pair
+#include <memory>
 
 #include "ParticleMatcher.hpp"
+#include "../Util/Prefetcher.hpp"
 
 // Determines how important is the contribution from the innermost
 // particles in a subhalo when finding a descendant. Usually set
@@ -16,10 +20,11 @@ static constexpr real_type alpha_weight = 1;
 int main(int argc, char** argv)
 {
   // Check input arguments
-  if (argc != 10) {
+  if ((argc < 10) || (argc > 12)) {
     std::cerr << "Usage: " << argv[0] << " basedir writepath " <<
         "snapnum_first snapnum_last snapnum_start snapnum_end " <<
-        "tracking_scheme pass skipsnaps_filename\n";
+        "tracking_scheme pass skipsnaps_filename [prefetch_memory_GB " <<
+        "[catalog_cache_dir]]\n";
     exit(1);
   }
 
@@ -33,12 +38,25 @@ int main(int argc, char** argv)
   std::string tracking_scheme(argv[7]);  /* Subhalos or Galaxies */
   std::string pass(argv[8]);  /* first or second  */
   std::string skipsnaps_filename(argv[9]);
+  /* Memory limit for reading the next snapshot while the current one is
+   * being processed (zero to disable). */
+  double prefetch_memory_GB = (argc > 10) ? atof(argv[10]) : 16;
+  /* Directory where the Subfind catalogs are cached, so that the other
+   * passes read them faster (see subfind::CatalogReader). */
+  std::string catalog_cache_dir = (argc > 11) ? argv[11] : "";
+#ifndef H5_HAVE_THREADSAFE
+  // HDF5 calls cannot be made from the background thread.
+  prefetch_memory_GB = 0;
+#endif
 
   // Create list of valid snapshots
   auto valid_snapnums = get_valid_snapnums(skipsnaps_filename,
       snapnum_first, snapnum_last);
 
-  // Iterate over snapshot range
+  // Pairs of snapshots to be matched, and the order in which the
+  // snapshots are needed.
+  std::vector<std::pair<snapnum_type, snapnum_type>> snapnum_pairs;
+  std::vector<snapnum_type> snapnums_needed;
   for (auto snapnum1 = snapnum_start; snapnum1 <= snapnum_end; ++snapnum1) {
     // Check that first snapshot is valid
     auto it = std::find(valid_snapnums.begin(), valid_snapnums.end(), snapnum1);
@@ -58,13 +76,47 @@ int main(int argc, char** argv)
     else
       assert(false);
 
+    snapnum_pairs.emplace_back(snapnum1, snapnum2);
+    snapnums_needed.push_back(snapnum1);
+    if (snapnum2 != -1)
+      snapnums_needed.push_back(snapnum2);
+  }
+
+  // Each snapshot is read (on a background thread) while the previous
+  // pair is being matched, and kept until its last use.
+  Prefetcher<snapnum_type, SnapshotParticles> prefetcher(snapnums_needed,
+      [&](const snapnum_type snapnum) {
+        return read_snapshot_particles(basedir, snapnum, tracking_scheme,
+            alpha_weight, false, catalog_cache_dir);
+      },
+      [](const SnapshotParticles& data) { return data.memory_size(); },
+      static_cast<uint64_t>(prefetch_memory_GB * 1024*1024*1024));
+
+  // Iterate over snapshot range
+  for (auto& snapnum_pair : snapnum_pairs) {
     // Measure CPU and wall clock (real) time
     CPUClock cpu_clock;
     WallClock wall_clock;
 
+    // Get particle data, and show how much of the reading time
+    // overlapped with processing the previous pair.
+    auto next_snapshot = [&prefetcher]() {
+      auto data = prefetcher.next();
+      std::cout << "Snapshot " << data->snapnum << ": ";
+      if (prefetcher.load_seconds() == 0)
+        std::cout << "already in memory.\n";
+      else
+        std::cout << "read in " << prefetcher.load_seconds() << " s, " <<
+            "waited " << prefetcher.wait_seconds() << " s.\n";
+      return data;
+    };
+    auto data1 = next_snapshot();
+    std::shared_ptr<const SnapshotParticles> data2;
+    if (snapnum_pair.second != -1)
+      data2 = next_snapshot();
+
     // Find descendants and write to files
-    auto pm = ParticleMatcher(basedir, basedir, snapnum1, snapnum2,
-                              tracking_scheme, alpha_weight);
+    auto pm = ParticleMatcher(data1, data2);
     pm.write_to_file(writepath);
 
     // Print CPU and wall clock time
@@ -4,9 +4,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -102,7 +99,9 @@ static H5::CompType H5MergerInfo() {
  * @param[in] writefile An open file to write the results.
  */
 void count_mergers_sub(Subhalo sub, std::vector<MergerInfo>& merger_info,
-    const std::vector<std::vector<real_type>>& overdensities) {
+    const std::vector<std::vector<real_type>>& overdensities,
+    const Tree::BranchMax& stmax, const Tree::Column<FloatArray<6>>& mass_type,
+    const Tree::Column<real_type>& m200) {
   // Only proceed if @a sub has at least one progenitor.
   auto first_prog = sub.first_progenitor();
   if (!first_prog.is_valid())
@@ -113,23 +112,23 @@ void count_mergers_sub(Subhalo sub, std::vector<MergerInfo>& merger_info,
       next_prog.is_valid(); next_prog = next_prog.next_progenitor()) {
 
     // Descendant properties.
-    real_type mstar_0 = sub.data().SubhaloMassType[4];
-    real_type m200_0 = sub.data().Group_M_Crit200;
+    real_type mstar_0 = mass_type[sub][4];
+    real_type m200_0 = m200[sub];
     real_type delta_0 = overdensities[sub.data().SnapNum][sub.data().SubfindID];
     auto is_central_0 = static_cast<int8_t>(sub.data().FirstSubhaloInFOFGroupID == sub.data().SubhaloID);
 
     // Progenitor properties right before merger.
-    real_type mstar_instant_1 = first_prog.data().SubhaloMassType[4];
-    real_type mstar_instant_2 = next_prog.data().SubhaloMassType[4];
+    real_type mstar_instant_1 = mass_type[first_prog][4];
+    real_type mstar_instant_2 = mass_type[next_prog][4];
 
     // Progenitor properties at stellar tmax.
     real_type mstar_stmax_1 = -1;
     real_type mstar_stmax_2 = -1;
     snapnum_type snapnum_stmax = -1;
-    auto stmax_pair = get_stmax_pair(first_prog, next_prog);
+    auto stmax_pair = get_stmax_pair(first_prog, next_prog, stmax);
     if (stmax_pair.first.is_valid()) {
-      mstar_stmax_1 = stmax_pair.first.data().SubhaloMassType[4];
-      mstar_stmax_2 = stmax_pair.second.data().SubhaloMassType[4];
+      mstar_stmax_1 = mass_type[stmax_pair.first][4];
+      mstar_stmax_2 = mass_type[stmax_pair.second][4];
       snapnum_stmax = stmax_pair.second.data().SnapNum;
     }
 
@@ -139,8 +138,8 @@ void count_mergers_sub(Subhalo sub, std::vector<MergerInfo>& merger_info,
     snapnum_type snapnum_infall = -1;
     auto infall_pair = get_infall_pair(first_prog, next_prog);
     if (infall_pair.first.is_valid()) {
-      mstar_infall_1 = infall_pair.first.data().SubhaloMassType[4];
-      mstar_infall_2 = infall_pair.second.data().SubhaloMassType[4];
+      mstar_infall_1 = mass_type[infall_pair.first][4];
+      mstar_infall_2 = mass_type[infall_pair.second][4];
       snapnum_infall = infall_pair.second.data().SnapNum;
     }
 
@@ -157,7 +156,7 @@ void count_mergers_sub(Subhalo sub, std::vector<MergerInfo>& merger_info,
 void count_mergers_all(const std::string& simdir,
     const std::string& envdir, const std::string& treedir,
     const std::string& writepath, const snapnum_type snapnum_first,
-    const snapnum_type snapnum_last) {
+    const snapnum_type snapnum_last, const std::string& tree_shm_name) {
 
   // Read all overdensities and store them in a vector of vectors.
   std::cout << "Reading overdensities...\n";
@@ -206,7 +205,16 @@ void count_mergers_all(const std::string& simdir,
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType", "Group_M_Crit200"};
+  // Attach to a tree published with publish_tree.cpp, if given.
+  Tree tree = tree_shm_name.empty() ?
+      Tree(treedir, name, filenum, fields) : Tree::attach(tree_shm_name);
+  // Maximum stellar mass along the main branch of every subhalo.
+  auto stmax = compute_stmax(tree);
+  // Handles to the extra fields, used for every merger.
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
+  auto m200 = tree.column<real_type>("Group_M_Crit200");
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -221,7 +229,8 @@ void count_mergers_all(const std::string& simdir,
 
     // Iterate over subhalos and count mergers.
     for (auto sub_it = snap.begin(); sub_it != snap.end(); ++sub_it) {
-      count_mergers_sub(*sub_it, merger_info, overdensities);
+      count_mergers_sub(*sub_it, merger_info, overdensities, stmax,
+          mass_type, m200);
     }
 
     // Filename for this snapshot.
@@ -243,9 +252,9 @@ void count_mergers_all(const std::string& simdir,
 int main(int argc, char** argv)
 {
   // Check input arguments
-  if (argc != 7) {
+  if ((argc != 7) && (argc != 8)) {
     std::cerr << "Usage: " << argv[0] << " simdir envdir treedir writepath" <<
-        " snapnum_first snapnum_last\n";
+        " snapnum_first snapnum_last [tree_shm_name]\n";
     exit(1);
   }
 
@@ -256,13 +265,16 @@ int main(int argc, char** argv)
   std::string writepath(argv[4]);
   snapnum_type snapnum_first = atoi(argv[5]);
   snapnum_type snapnum_last = atoi(argv[6]);
+  // Optional: name of a tree published with publish_tree.cpp.
+  std::string tree_shm_name = (argc == 8) ? argv[7] : "";
 
   // Measure CPU and wall clock (real) time
   WallClock wall_clock;
   CPUClock cpu_clock;
 
   // Do stuff
-  count_mergers_all(simdir, envdir, treedir, writepath, snapnum_first, snapnum_last);
+  count_mergers_all(simdir, envdir, treedir, writepath, snapnum_first, snapnum_last,
+      tree_shm_name);
 
   // Print wall clock time and speedup
   std::cout << "Time: " << wall_clock.seconds() << " s.\n";
@@ -4,10 +4,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-#define EXTRA_POINTERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -288,12 +284,13 @@ void count_pairs_sub(const SpaceSearcherType& s,
     const real_type velocity_threshold, const real_type mstar_min,
     const real_type cur_H_kpc_h, const real_type cur_z,
     const std::vector<std::vector<real_type>>& overdensities,
-    PairData& pd) {
+    const Tree::BranchMax& stmax, const Tree::Column<FloatArray<6>>& mass_type,
+    const Tree::Column<real_type>& sfr, PairData& pd) {
 
   assert(center_sub.is_valid());
 
   // Only proceed if current galaxy is above minimum mass
-  if (center_sub.data().SubhaloMassType[parttype_stars] < mstar_min)
+  if (mass_type[center_sub][parttype_stars] < mstar_min)
     return;
 
   // Iterate over neighbors (of any mass)
@@ -325,8 +322,8 @@ void count_pairs_sub(const SpaceSearcherType& s,
 
     // Avoid double counting by making sure that mstar_1 > mstar_2
     // (check merger mass ratio later, e.g. when plotting).
-    real_type mstar_instant_1 = center_sub.data().SubhaloMassType[parttype_stars];
-    real_type mstar_instant_2 = other_sub.data().SubhaloMassType[parttype_stars];
+    real_type mstar_instant_1 = mass_type[center_sub][parttype_stars];
+    real_type mstar_instant_2 = mass_type[other_sub][parttype_stars];
     if (mstar_instant_1 <= mstar_instant_2)
       continue;
 
@@ -345,8 +342,8 @@ void count_pairs_sub(const SpaceSearcherType& s,
     snapnum_type snapnum_merger = -1;
     auto desc = get_merger_remnant(center_sub, other_sub);
     if (desc.is_valid()) {
-      mstar_0 = desc.data().SubhaloMassType[parttype_stars];
-      sfr_0 = desc.data().SubhaloSFR;
+      mstar_0 = mass_type[desc][parttype_stars];
+      sfr_0 = sfr[desc];
       delta_0 = overdensities[desc.snapnum()][desc.index()];
       index_0 = desc.index();
       snapnum_merger = desc.snapnum();
@@ -354,11 +351,11 @@ void count_pairs_sub(const SpaceSearcherType& s,
 
     // Pair properties at current time
     // already have mstar_instant_1
-    real_type sfr_instant_1 = center_sub.data().SubhaloSFR;
+    real_type sfr_instant_1 = sfr[center_sub];
     real_type delta_instant_1 = overdensities[center_sub.snapnum()][center_sub.index()];
     index_type index_instant_1 = center_sub.index();
     // already have mstar_instant_2
-    real_type sfr_instant_2 = other_sub.data().SubhaloSFR;
+    real_type sfr_instant_2 = sfr[other_sub];
     real_type delta_instant_2 = overdensities[other_sub.snapnum()][other_sub.index()];
     index_type index_instant_2 = other_sub.index();
 
@@ -372,14 +369,14 @@ void count_pairs_sub(const SpaceSearcherType& s,
     real_type delta_stmax_2 = -1;
     index_type index_stmax_2 = -1;
     snapnum_type snapnum_stmax = -1;
-    auto stmax_pair = get_stmax_pair(center_sub, other_sub);
+    auto stmax_pair = get_stmax_pair(center_sub, other_sub, stmax);
     if (stmax_pair.first.is_valid()) {
-      mstar_stmax_1 = stmax_pair.first.data().SubhaloMassType[parttype_stars];
-      sfr_stmax_1 = stmax_pair.first.data().SubhaloSFR;
+      mstar_stmax_1 = mass_type[stmax_pair.first][parttype_stars];
+      sfr_stmax_1 = sfr[stmax_pair.first];
       delta_stmax_1 = overdensities[stmax_pair.first.data().SnapNum][stmax_pair.first.index()];
       index_stmax_1 = stmax_pair.first.index();
-      mstar_stmax_2 = stmax_pair.second.data().SubhaloMassType[parttype_stars];
-      sfr_stmax_2 = stmax_pair.second.data().SubhaloSFR;
+      mstar_stmax_2 = mass_type[stmax_pair.second][parttype_stars];
+      sfr_stmax_2 = sfr[stmax_pair.second];
       delta_stmax_2 = overdensities[stmax_pair.second.data().SnapNum][stmax_pair.second.index()];
       index_stmax_2 = stmax_pair.second.index();
       snapnum_stmax = stmax_pair.second.data().SnapNum;
@@ -397,12 +394,12 @@ void count_pairs_sub(const SpaceSearcherType& s,
     snapnum_type snapnum_infall = -1;
     auto infall_pair = get_infall_pair(center_sub, other_sub);
     if (infall_pair.first.is_valid()) {
-      mstar_infall_1 = infall_pair.first.data().SubhaloMassType[parttype_stars];
-      sfr_infall_1 = infall_pair.first.data().SubhaloSFR;
+      mstar_infall_1 = mass_type[infall_pair.first][parttype_stars];
+      sfr_infall_1 = sfr[infall_pair.first];
       delta_infall_1 = overdensities[infall_pair.first.data().SnapNum][infall_pair.first.index()];
       index_infall_1 = infall_pair.first.index();
-      mstar_infall_2 = infall_pair.second.data().SubhaloMassType[parttype_stars];
-      sfr_infall_2 = infall_pair.second.data().SubhaloSFR;
+      mstar_infall_2 = mass_type[infall_pair.second][parttype_stars];
+      sfr_infall_2 = sfr[infall_pair.second];
       delta_infall_2 = overdensities[infall_pair.second.data().SnapNum][infall_pair.second.data().SubfindID];
       index_infall_2 = infall_pair.second.index();
       snapnum_infall = infall_pair.second.data().SnapNum;
@@ -425,7 +422,8 @@ void count_pairs_all(
     const std::string& envdir, const std::string& writepath,
     const snapnum_type snapnum_first, const snapnum_type snapnum_last,
     const real_type rmin, const real_type rmax,
-    const real_type velocity_threshold, const real_type log_mstar_min) {
+    const real_type velocity_threshold, const real_type log_mstar_min,
+    const std::string& catalog_cache_dir) {
 
   // Convert minimum mass to 10^10 Msun/h:
   auto params = cosmo::CosmologicalParameters(suite);
@@ -455,7 +453,14 @@ void count_pairs_all(
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType", "SubhaloSFR"};
+  Tree tree(treedir, name, filenum, fields);
+  // Maximum stellar mass along the main branch of every subhalo.
+  auto stmax = compute_stmax(tree);
+  // Handles to the extra fields, used for every pair.
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
+  auto sfr = tree.column<real_type>("SubhaloSFR");
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -484,10 +489,9 @@ void count_pairs_all(
     std::cout << "Loading galaxy data...\n";
     WallClock wall_clock;
     std::string basedir = simdir + "/output";
-    auto sub_pos = subfind::read_block<Point>(
-        basedir, snapnum, "Subhalo", "SubhaloPos", -1);
-    auto sub_vel = subfind::read_block<Point>(
-        basedir, snapnum, "Subhalo", "SubhaloVel", -1);
+    subfind::CatalogReader catalog(basedir, snapnum, catalog_cache_dir);
+    auto sub_pos = catalog.read_block<Point>("Subhalo", "SubhaloPos", -1);
+    auto sub_vel = catalog.read_block<Point>("Subhalo", "SubhaloVel", -1);
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
     // Only proceed if nsubs > 0
@@ -551,7 +555,7 @@ void count_pairs_all(
       auto center_vel = sub_vel[center_sub.index()];
       count_pairs_sub(s, tree, snapnum, center_sub, center_pos, center_vel,
           rmin_comoving, rmax_comoving, velocity_threshold, mstar_min,
-          cur_H_kpc_h, cur_z, overdensities, pd);
+          cur_H_kpc_h, cur_z, overdensities, stmax, mass_type, sfr, pd);
     }
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
@@ -606,9 +610,10 @@ void count_pairs_all(
 int main(int argc, char** argv)
 {
   // Check input arguments
-  if (argc != 12) {
+  if ((argc != 12) && (argc != 13)) {
     std::cerr << "Usage: " << argv[0] << " suite simdir treedir envdir writepath" <<
-        " snapnum_first snapnum_last rmin rmax velocity_threshold log_mstar_min\n";
+        " snapnum_first snapnum_last rmin rmax velocity_threshold log_mstar_min" <<
+        " [catalog_cache_dir]\n";
     exit(1);
   }
 
@@ -624,6 +629,8 @@ int main(int argc, char** argv)
   real_type rmax = atof(argv[9]);  // ckpc/h
   real_type velocity_threshold = atof(argv[10]);  // km/s
   real_type log_mstar_min = atof(argv[11]);  // base 10, Msun
+  // Optional: directory with cached Subfind catalogs.
+  std::string catalog_cache_dir = (argc == 13) ? argv[12] : "";
 
   // Measure CPU and wall clock (real) time
   WallClock wall_clock;
@@ -631,7 +638,8 @@ int main(int argc, char** argv)
 
   // Do stuff
   count_pairs_all(suite, simdir, treedir, envdir, writepath, snapnum_first,
-      snapnum_last, rmin, rmax, velocity_threshold, log_mstar_min);
+      snapnum_last, rmin, rmax, velocity_threshold, log_mstar_min,
+      catalog_cache_dir);
 
   // Print wall clock time and speedup
   std::cout << "Time: " << wall_clock.seconds() << " s.\n";
@@ -6,9 +6,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -55,22 +52,22 @@ void merger_history_sub(Subhalo sub) {
         continue;
 
       // Only proceed if both stellar masses at stmax are > 0
-      if (!((stmax_pair.first.data().SubhaloMassType[4] > 0) &&
-          (stmax_pair.second.data().SubhaloMassType[4] > 0))) {
+      if (!((stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4] > 0) &&
+          (stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4] > 0))) {
         continue;
       }
 
       real_type mass_ratio = std::min(
-          stmax_pair.second.data().SubhaloMassType[4] / stmax_pair.first.data().SubhaloMassType[4],
-          stmax_pair.first.data().SubhaloMassType[4] / stmax_pair.second.data().SubhaloMassType[4]);
+          stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4] / stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4],
+          stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4] / stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4]);
 
       // Check if minor merger
       if (mass_ratio >= minor_merger_ratio) {
         // Print snapnum, mass_ratio, and fgas, g-r of secondary
         std::cout << sub.snapnum() << ",";
         std::cout << mass_ratio << ",";
-        std::cout << (stmax_pair.second.data().Mass - stmax_pair.second.data().SubhaloMassType[4]) / stmax_pair.second.data().Mass << ",";
-        std::cout << stmax_pair.second.data().SubhaloStellarPhotometrics[4] - stmax_pair.second.data().SubhaloStellarPhotometrics[5] << "\n";
+        std::cout << (stmax_pair.second.data().Mass - stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4]) / stmax_pair.second.data().Mass << ",";
+        std::cout << stmax_pair.second.get<FloatArray<8>>("SubhaloStellarPhotometrics")[4] - stmax_pair.second.get<FloatArray<8>>("SubhaloStellarPhotometrics")[5] << "\n";
       }
     }
 
@@ -97,7 +94,9 @@ void shy_custom(const std::string& treedir) {
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType", "SubhaloStellarPhotometrics"};
+  Tree tree(treedir, name, filenum, fields);
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
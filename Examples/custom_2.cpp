@@ -5,9 +5,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -54,13 +51,13 @@ void merger_history_sub(Subhalo sub, std::ofstream& outfile) {
         continue;
 
       // Only proceed if both stellar masses at stmax are > 0
-      if (!((stmax_pair.first.data().SubhaloMassType[4] > 0) &&
-          (stmax_pair.second.data().SubhaloMassType[4] > 0))) {
+      if (!((stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4] > 0) &&
+          (stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4] > 0))) {
         continue;
       }
 
       // Check if minor merger
-      float merger_ratio = stmax_pair.second.data().SubhaloMassType[4] / stmax_pair.first.data().SubhaloMassType[4];
+      float merger_ratio = stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4] / stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4];
       if ((merger_ratio >= major_merger_ratio) &&
           (merger_ratio <= 1.0/major_merger_ratio)) {
         // Print info.
@@ -112,7 +109,9 @@ int main()
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType"};
+  Tree tree(treedir, name, filenum, fields);
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
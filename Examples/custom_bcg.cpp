@@ -4,9 +4,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -38,8 +35,8 @@ void merger_history_sub(Subhalo sub) {
     // mstar_from_all_mergers
 
     std::cout << sub.snapnum() << ",";
-    std::cout << sub.data().SubhaloMassType[4] << ",";
-    std::cout << sub.data().SubhaloSFR << ",";
+    std::cout << sub.get<FloatArray<6>>("SubhaloMassType")[4] << ",";
+    std::cout << sub.get<real_type>("SubhaloSFR") << ",";
 
     // Mass accretion from current snapshot
     real_type mstar_from_major_mergers = 0.0;
@@ -67,15 +64,15 @@ void merger_history_sub(Subhalo sub) {
         continue;
 
       // Only proceed if both stellar masses at stmax are > 0
-      if (!((stmax_pair.first.data().SubhaloMassType[4] > 0) &&
-          (stmax_pair.second.data().SubhaloMassType[4] > 0))) {
+      if (!((stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4] > 0) &&
+          (stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4] > 0))) {
         continue;
       }
 
       real_type mass_primary = std::max(
-          stmax_pair.first.data().SubhaloMassType[4], stmax_pair.second.data().SubhaloMassType[4]);
+          stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4], stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4]);
       real_type mass_secondary = std::min(
-          stmax_pair.first.data().SubhaloMassType[4], stmax_pair.second.data().SubhaloMassType[4]);
+          stmax_pair.first.get<FloatArray<6>>("SubhaloMassType")[4], stmax_pair.second.get<FloatArray<6>>("SubhaloMassType")[4]);
 
       // Check if major merger
       if (mass_secondary/mass_primary >= major_merger_ratio) {
@@ -117,7 +114,9 @@ void custom_bcg(const std::string& treedir) {
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType", "SubhaloSFR"};
+  Tree tree(treedir, name, filenum, fields);
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -5,14 +5,12 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define INFALL_CATALOG
-
 #include <vector>
 #include <string>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
+#include <utility>  // pair
 
 #include "../InputOutput/ReadArepoHDF5.hpp"
 #include "../InputOutput/ReadSubfindHDF5.hpp"
@@ -25,7 +23,8 @@
  * into FoF groups at snapshot of interest (snapnum_last).
  */
 void infall_catalog(const std::string& basedir, const std::string& treedir,
-    const std::string& writedir, const snapnum_type snapnum_last) {
+    const std::string& writedir, const snapnum_type snapnum_last,
+    const std::string& tree_shm_name) {
 
   // Get box size in ckpc/h; note type conversion
   std::stringstream tmp_stream;
@@ -41,7 +40,12 @@ void infall_catalog(const std::string& basedir, const std::string& treedir,
   WallClock wall_clock;
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType", "SubhaloMass",
+      "SubhaloVmax", "SubhaloPos", "GroupPos", "Group_R_Crit200"};
+  // Attach to a tree published with publish_tree.cpp, if given.
+  Tree tree = tree_shm_name.empty() ?
+      Tree(treedir, name, filenum, fields) : Tree::attach(tree_shm_name);
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -89,18 +93,14 @@ void infall_catalog(const std::string& basedir, const std::string& treedir,
   // For cases where infall is well defined but R200Crit is not:
   FloatArray<6> invalid_masstype = {-1, -1, -1, -1, -1, -1};
 
-  // Iterate over FoF groups at snapshot of interest (snapnum_last).
+  // Iterate over FoF groups at snapshot of interest (snapnum_last),
+  // collecting (primary, secondary) pairs of possible "infall objects".
   std::cout << "Iterating over FoF groups...\n";
   wall_clock.start();
+  std::vector<std::pair<Subhalo, Subhalo>> pairs;
+  std::vector<uint32_t> pair_group_index;
   for (uint32_t group_index = 0; group_index < ngroups; ++group_index) {
 
-    // Offset of this FoF group
-    if (group_index > 0)
-      GroupFirstSub[group_index] = GroupFirstSub[group_index-1] + GroupNsubs[group_index-1];
-
-    // Count subhalos that "infalled" onto this FoF group.
-    uint32_t subhalo_count = 0;
-
     // If this FoF group has no subhalos, skip.
     auto first_sub_index = group_first_sub[group_index];
     if (first_sub_index == static_cast<uint32_t>(-1))
@@ -127,80 +127,95 @@ void infall_catalog(const std::string& basedir, const std::string& treedir,
             cur_sub.snapnum() < snapnum_last)
           continue;
 
-        // Get properties at infall, taking orig_sub as the primary
-        auto infall_pair = get_infall_pair(orig_sub, cur_sub);
-
-        // Only proceed if infall is well defined
-        auto snapnum_infall = infall_pair.second.snapnum();
-        if (snapnum_infall == -1)
-          continue;
-
-        // If got here, we have found a new, valid "infall object".
-        GroupIndex.push_back(group_index);
-
-        SnapNumInfall.push_back(snapnum_infall);
-        SubfindIDInfall.push_back(infall_pair.second.index());
-        SubhaloMassInfall.push_back(infall_pair.second.data().SubhaloMass);
-        SubhaloMassTypeInfall.push_back(infall_pair.second.data().SubhaloMassType);
-        SubhaloVmaxInfall.push_back(infall_pair.second.data().SubhaloVmax);
-
-        SnapNumLastIdentified.push_back(cur_sub.snapnum());
-        SubfindIDLastIdentified.push_back(cur_sub.index());
-        SubhaloMassLastIdentified.push_back(cur_sub.data().SubhaloMass);
-        SubhaloMassTypeLastIdentified.push_back(cur_sub.data().SubhaloMassType);
-        SubhaloVmaxLastIdentified.push_back(cur_sub.data().SubhaloVmax);
-
-        // Add info about moment of last (latest) virial crossing
-        auto pair_last_crossing = get_pair_virial_crossing(orig_sub, cur_sub,
-            box_size, true);
-        auto snapnum_last_crossing = pair_last_crossing.second.snapnum();
-        if (snapnum_last_crossing == -1) {
-          SnapNumLastCrossing.push_back(-1);
-          SubfindIDLastCrossing.push_back(-1);
-          SubhaloMassLastCrossing.push_back(-1);
-          SubhaloMassTypeLastCrossing.push_back(invalid_masstype);
-          SubhaloVmaxLastCrossing.push_back(-1);
-        }
-        else {
-          SnapNumLastCrossing.push_back(snapnum_last_crossing);
-          SubfindIDLastCrossing.push_back(pair_last_crossing.second.index());
-          SubhaloMassLastCrossing.push_back(pair_last_crossing.second.data().SubhaloMass);
-          SubhaloMassTypeLastCrossing.push_back(pair_last_crossing.second.data().SubhaloMassType);
-          SubhaloVmaxLastCrossing.push_back(pair_last_crossing.second.data().SubhaloVmax);
-        }
-
-        // Add info about moment of first (earliest) virial crossing
-        auto pair_first_crossing = get_pair_virial_crossing(orig_sub, cur_sub,
-            box_size, false);
-        auto snapnum_first_crossing = pair_first_crossing.second.snapnum();
-        if (snapnum_first_crossing == -1) {
-          SnapNumFirstCrossing.push_back(-1);
-          SubfindIDFirstCrossing.push_back(-1);
-          SubhaloMassFirstCrossing.push_back(-1);
-          SubhaloMassTypeFirstCrossing.push_back(invalid_masstype);
-          SubhaloVmaxFirstCrossing.push_back(-1);
-        }
-        else {
-          SnapNumFirstCrossing.push_back(snapnum_first_crossing);
-          SubfindIDFirstCrossing.push_back(pair_first_crossing.second.index());
-          SubhaloMassFirstCrossing.push_back(pair_first_crossing.second.data().SubhaloMass);
-          SubhaloMassTypeFirstCrossing.push_back(pair_first_crossing.second.data().SubhaloMassType);
-          SubhaloVmaxFirstCrossing.push_back(pair_first_crossing.second.data().SubhaloVmax);
-        }
-
-        // Add to counter
-        ++subhalo_count;
+        // Take orig_sub as the primary.
+        pairs.push_back(std::make_pair(orig_sub, cur_sub));
+        pair_group_index.push_back(group_index);
       }
     }
+  }
+  std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
-    // Number of subhalos that "infalled" onto this FoF group
-    GroupNsubs[group_index] = subhalo_count;
+  // Get properties at infall and at the last (latest) and first (earliest)
+  // virial crossings, for all pairs at once.
+  std::cout << "Synchronizing " << pairs.size() << " pairs...\n";
+  wall_clock.start();
+  auto infall_pairs = get_infall_pair(pairs);
+  auto pairs_last_crossing = get_pair_virial_crossing(pairs, box_size, true);
+  auto pairs_first_crossing = get_pair_virial_crossing(pairs, box_size, false);
+  std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
-    // Print some output occasionally
-    if (group_index+1 % 1000 == 0) {
-      std::cout << "Already processed " << group_index+1 << "FoF groups.\n";
+  std::cout << "Storing info...\n";
+  wall_clock.start();
+  auto mass = tree.column<real_type>("SubhaloMass");
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
+  auto vmax = tree.column<real_type>("SubhaloVmax");
+  for (std::size_t k = 0; k < pairs.size(); ++k) {
+    const auto& cur_sub = pairs[k].second;
+    const auto& infall_pair = infall_pairs[k];
+
+    // Only proceed if infall is well defined
+    auto snapnum_infall = infall_pair.second.snapnum();
+    if (snapnum_infall == -1)
+      continue;
+
+    // If got here, we have found a new, valid "infall object".
+    GroupIndex.push_back(pair_group_index[k]);
+
+    SnapNumInfall.push_back(snapnum_infall);
+    SubfindIDInfall.push_back(infall_pair.second.index());
+    SubhaloMassInfall.push_back(mass[infall_pair.second]);
+    SubhaloMassTypeInfall.push_back(mass_type[infall_pair.second]);
+    SubhaloVmaxInfall.push_back(vmax[infall_pair.second]);
+
+    SnapNumLastIdentified.push_back(cur_sub.snapnum());
+    SubfindIDLastIdentified.push_back(cur_sub.index());
+    SubhaloMassLastIdentified.push_back(mass[cur_sub]);
+    SubhaloMassTypeLastIdentified.push_back(mass_type[cur_sub]);
+    SubhaloVmaxLastIdentified.push_back(vmax[cur_sub]);
+
+    // Add info about moment of last (latest) virial crossing
+    const auto& pair_last_crossing = pairs_last_crossing[k];
+    auto snapnum_last_crossing = pair_last_crossing.second.snapnum();
+    if (snapnum_last_crossing == -1) {
+      SnapNumLastCrossing.push_back(-1);
+      SubfindIDLastCrossing.push_back(-1);
+      SubhaloMassLastCrossing.push_back(-1);
+      SubhaloMassTypeLastCrossing.push_back(invalid_masstype);
+      SubhaloVmaxLastCrossing.push_back(-1);
+    }
+    else {
+      SnapNumLastCrossing.push_back(snapnum_last_crossing);
+      SubfindIDLastCrossing.push_back(pair_last_crossing.second.index());
+      SubhaloMassLastCrossing.push_back(mass[pair_last_crossing.second]);
+      SubhaloMassTypeLastCrossing.push_back(mass_type[pair_last_crossing.second]);
+      SubhaloVmaxLastCrossing.push_back(vmax[pair_last_crossing.second]);
+    }
+
+    // Add info about moment of first (earliest) virial crossing
+    const auto& pair_first_crossing = pairs_first_crossing[k];
+    auto snapnum_first_crossing = pair_first_crossing.second.snapnum();
+    if (snapnum_first_crossing == -1) {
+      SnapNumFirstCrossing.push_back(-1);
+      SubfindIDFirstCrossing.push_back(-1);
+      SubhaloMassFirstCrossing.push_back(-1);
+      SubhaloMassTypeFirstCrossing.push_back(invalid_masstype);
+      SubhaloVmaxFirstCrossing.push_back(-1);
+    }
+    else {
+      SnapNumFirstCrossing.push_back(snapnum_first_crossing);
+      SubfindIDFirstCrossing.push_back(pair_first_crossing.second.index());
+      SubhaloMassFirstCrossing.push_back(mass[pair_first_crossing.second]);
+      SubhaloMassTypeFirstCrossing.push_back(mass_type[pair_first_crossing.second]);
+      SubhaloVmaxFirstCrossing.push_back(vmax[pair_first_crossing.second]);
     }
+
+    // Number of subhalos that "infalled" onto this FoF group
+    ++GroupNsubs[pair_group_index[k]];
   }
+
+  // Offset of each FoF group
+  for (uint32_t group_index = 1; group_index < ngroups; ++group_index)
+    GroupFirstSub[group_index] = GroupFirstSub[group_index-1] + GroupNsubs[group_index-1];
   std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
   // Output filename
@@ -261,9 +276,9 @@ void infall_catalog(const std::string& basedir, const std::string& treedir,
 int main(int argc, char** argv)
 {
   // Check input arguments
-  if (argc != 5) {
+  if ((argc != 5) && (argc != 6)) {
     std::cerr << "Usage: " << argv[0] << " basedir treedir writedir" <<
-        " snapnum_last\n";
+        " snapnum_last [tree_shm_name]\n";
     exit(1);
   }
 
@@ -272,13 +287,15 @@ int main(int argc, char** argv)
   std::string treedir(argv[2]);
   std::string writedir(argv[3]);
   snapnum_type snapnum_last = atoi(argv[4]);
+  // Optional: name of a tree published with publish_tree.cpp.
+  std::string tree_shm_name = (argc == 6) ? argv[5] : "";
 
   // Measure CPU and wall clock (real) time
   WallClock wall_clock;
   CPUClock cpu_clock;
 
   // Do stuff
-  infall_catalog(basedir, treedir, writedir, snapnum_last);
+  infall_catalog(basedir, treedir, writedir, snapnum_last, tree_shm_name);
 
   // Print wall clock time and speedup
   std::cout << "Total time: " << wall_clock.seconds() << " s.\n";
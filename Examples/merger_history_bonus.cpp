@@ -7,9 +7,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -49,6 +46,8 @@ struct MergerData {
 void merger_history_sub(Subhalo sub,
     const std::vector<real_type>& redshifts_all,
     const std::vector<real_type>& times_all,
+    const Tree::BranchMax& stmax,
+    const Tree::Column<FloatArray<6>>& mass_type,
     MergerData& md) {
 
   auto sub_orig = sub;
@@ -71,7 +70,7 @@ void merger_history_sub(Subhalo sub,
         next_prog = next_prog.next_progenitor()) {
 
       // Progenitor properties at stellar tmax
-      auto stmax_pair = get_stmax_pair(first_prog, next_prog);
+      auto stmax_pair = get_stmax_pair(first_prog, next_prog, stmax);
 
       // Progenitor properties at infall
       auto infall_pair = get_infall_pair(first_prog, next_prog);
@@ -87,8 +86,8 @@ void merger_history_sub(Subhalo sub,
         continue;
 
       // Only proceed if both stellar masses at stmax are > 0
-      real_type mstar_stmax_1 = stmax_pair.first.data().SubhaloMassType[4];
-      real_type mstar_stmax_2 = stmax_pair.second.data().SubhaloMassType[4];
+      real_type mstar_stmax_1 = mass_type[stmax_pair.first][4];
+      real_type mstar_stmax_2 = mass_type[stmax_pair.second][4];
       if (!((mstar_stmax_1 > 0) && (mstar_stmax_2 > 0))) {
         continue;
       }
@@ -137,7 +136,8 @@ void merger_history_sub(Subhalo sub,
 void merger_history_all(
     const std::string& suite, const std::string& basedir,
     const std::string& treedir, const std::string& writepath,
-    const snapnum_type snapnum_first, const snapnum_type snapnum_last) {
+    const snapnum_type snapnum_first, const snapnum_type snapnum_last,
+    const std::string& tree_shm_name) {
 
   // Get time (in Gyr) and redshift for each snapshot.
   auto redshifts_all = cosmo::get_redshifts(suite);
@@ -148,7 +148,15 @@ void merger_history_all(
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType"};
+  // Attach to a tree published with publish_tree.cpp, if given.
+  Tree tree = tree_shm_name.empty() ?
+      Tree(treedir, name, filenum, fields) : Tree::attach(tree_shm_name);
+  // Maximum stellar mass along the main branch of every subhalo.
+  auto stmax = compute_stmax(tree);
+  // Handle to the stellar masses, used for every merger.
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -188,7 +196,8 @@ void merger_history_all(
     // Iterate over subhalos and calculate some merger statistics.
     auto snap = tree.snapshot(snapnum);
     for (auto sub_it = snap.begin(); sub_it != snap.end(); ++sub_it) {
-      merger_history_sub(*sub_it, redshifts_all, times_all, md);
+      merger_history_sub(*sub_it, redshifts_all, times_all, stmax, mass_type,
+          md);
     }
 
     // Write to file.
@@ -207,9 +216,9 @@ void merger_history_all(
 int main(int argc, char** argv)
 {
   // Check input arguments
-  if (argc != 7) {
+  if ((argc != 7) && (argc != 8)) {
     std::cerr << "Usage: " << argv[0] << " suite basedir treedir writepath" <<
-        " snapnum_first snapnum_last\n";
+        " snapnum_first snapnum_last [tree_shm_name]\n";
     exit(1);
   }
 
@@ -220,13 +229,16 @@ int main(int argc, char** argv)
   std::string writepath(argv[4]);
   snapnum_type snapnum_first = atoi(argv[5]);
   snapnum_type snapnum_last = atoi(argv[6]);
+  // Optional: name of a tree published with publish_tree.cpp.
+  std::string tree_shm_name = (argc == 8) ? argv[7] : "";
 
   // Measure CPU and wall clock (real) time
   WallClock wall_clock;
   CPUClock cpu_clock;
 
   // Do stuff
-  merger_history_all(suite, basedir, treedir, writepath, snapnum_first, snapnum_last);
+  merger_history_all(suite, basedir, treedir, writepath, snapnum_first, snapnum_last,
+      tree_shm_name);
 
   // Print wall clock time and speedup
   std::cout << "Time: " << wall_clock.seconds() << " s.\n";
@@ -4,9 +4,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -62,7 +59,8 @@ struct MergerData {
 };
 
 /** @brief Find the last major/minor mergers for a given subhalo. */
-void merger_history_sub(Subhalo sub, MergerData& md) {
+void merger_history_sub(Subhalo sub, const Tree::BranchMax& stmax,
+    const Tree::Column<FloatArray<6>>& mass_type, MergerData& md) {
 
   uint32_t index_orig = sub.index();
 
@@ -79,7 +77,7 @@ void merger_history_sub(Subhalo sub, MergerData& md) {
         next_prog = next_prog.next_progenitor()) {
 
       // Progenitor properties at stellar tmax
-      auto stmax_pair = get_stmax_pair(first_prog, next_prog);
+      auto stmax_pair = get_stmax_pair(first_prog, next_prog, stmax);
 
       // Progenitor properties at infall
       auto infall_pair = get_infall_pair(first_prog, next_prog);
@@ -95,13 +93,13 @@ void merger_history_sub(Subhalo sub, MergerData& md) {
         continue;
 
       // Only proceed if both stellar masses at stmax are > 0
-      if (!((stmax_pair.first.data().SubhaloMassType[4] > 0) &&
-          (stmax_pair.second.data().SubhaloMassType[4] > 0))) {
+      if (!((mass_type[stmax_pair.first][4] > 0) &&
+          (mass_type[stmax_pair.second][4] > 0))) {
         continue;
       }
 
       // Calculate stellar mass ratio (can be > 1)
-      real_type mass_ratio = stmax_pair.second.data().SubhaloMassType[4] / stmax_pair.first.data().SubhaloMassType[4];
+      real_type mass_ratio = mass_type[stmax_pair.second][4] / mass_type[stmax_pair.first][4];
 
       // Check if major merger
       if ((mass_ratio >= major_merger_ratio) &&
@@ -160,7 +158,13 @@ void merger_history_all(
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType"};
+  Tree tree(treedir, name, filenum, fields);
+  // Maximum stellar mass along the main branch of every subhalo.
+  auto stmax = compute_stmax(tree);
+  // Handle to the stellar masses, used for every merger.
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -200,7 +204,7 @@ void merger_history_all(
     // Iterate over subhalos and find the last major (minor) merger.
     auto snap = tree.snapshot(snapnum);
     for (auto sub_it = snap.begin(); sub_it != snap.end(); ++sub_it) {
-      merger_history_sub(*sub_it, md);
+      merger_history_sub(*sub_it, stmax, mass_type, md);
     }
 
     // Write to file.
@@ -4,9 +4,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -106,6 +103,8 @@ struct MergerData {
 void merger_history_sub(Subhalo sub,
     const std::vector<real_type>& redshifts_all,
     const std::vector<real_type>& times_all,
+    const Tree::BranchMax& stmax,
+    const Tree::Column<FloatArray<6>>& mass_type,
     MergerData& md) {
 
   uint32_t index_orig = sub.index();
@@ -120,7 +119,7 @@ void merger_history_sub(Subhalo sub,
         next_prog = next_prog.next_progenitor()) {
 
       // Progenitor properties at stellar tmax
-      auto stmax_pair = get_stmax_pair(first_prog, next_prog);
+      auto stmax_pair = get_stmax_pair(first_prog, next_prog, stmax);
 
       // Progenitor properties at infall
       auto infall_pair = get_infall_pair(first_prog, next_prog);
@@ -136,8 +135,8 @@ void merger_history_sub(Subhalo sub,
         continue;
 
       // Only proceed if both stellar masses at stmax are > 0
-      real_type mstar_stmax_1 = stmax_pair.first.data().SubhaloMassType[4];
-      real_type mstar_stmax_2 = stmax_pair.second.data().SubhaloMassType[4];
+      real_type mstar_stmax_1 = mass_type[stmax_pair.first][4];
+      real_type mstar_stmax_2 = mass_type[stmax_pair.second][4];
       if (!((mstar_stmax_1 > 0) && (mstar_stmax_2 > 0))) {
         continue;
       }
@@ -293,7 +292,13 @@ void merger_history_all(
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType"};
+  Tree tree(treedir, name, filenum, fields);
+  // Maximum stellar mass along the main branch of every subhalo.
+  auto stmax = compute_stmax(tree);
+  // Handle to the stellar masses, used for every merger.
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -333,7 +338,8 @@ void merger_history_all(
     // Iterate over subhalos and do merger history calculations.
     auto snap = tree.snapshot(snapnum);
     for (auto sub_it = snap.begin(); sub_it != snap.end(); ++sub_it) {
-      merger_history_sub(*sub_it, redshifts_all, times_all, md);
+      merger_history_sub(*sub_it, redshifts_all, times_all, stmax, mass_type,
+          md);
     }
 
     // Write to file.
@@ -5,12 +5,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
-// Include main_leaf_progenitor
-#define EXTRA_POINTERS
-
 #include <iostream>
 #include <vector>
 #include <map>
@@ -74,45 +68,14 @@ bool compareByID(const ParticleInfo& a, const ParticleInfo& b) {
  * the stellar half-mass radius.
  */
 std::vector<real_type> get_galactocentric_distances(
-    const std::string& basedir, const snapnum_type snapnum,
+    const std::vector<Point>& all_pos, const real_type box_size,
+    const std::vector<real_type>& sub_halfmassrad,
     const std::vector<index_type>& SubfindID,
     const std::vector<uint64_t>& sub_offset) {
 
   uint64_t nparts = SubfindID.size();
-
-  // Get box size from snapshot header
-  std::stringstream tmp_stream;
-  tmp_stream << basedir << "/snapdir_" <<
-      std::setfill('0') << std::setw(3) << snapnum << "/snap_" <<
-      std::setfill('0') << std::setw(3) << snapnum << ".0.hdf5";
-  std::string file_name = tmp_stream.str();
-  auto box_size = static_cast<real_type>(
-      arepo::get_scalar_attribute<double>(file_name, "BoxSize"));
-
-  // Read particle positions.
-  std::vector<Point> all_pos;
-  // Sometimes the coordinates are stored as double type. In that case:
-  std::string block_name = "Coordinates";
-  auto dt_size = arepo::get_datatype_size(basedir, snapnum,
-      block_name, parttype);
-  if (dt_size == 8) {
-    auto all_pos_double = arepo::read_block<DoubleArray<3>>(
-        basedir, snapnum, "Coordinates", parttype);
-    std::cout << "NOTE: converting coordinates from double to float...\n";
-    all_pos = std::vector<Point>(all_pos_double.begin(),
-        all_pos_double.end());
-  }
-  else {
-    assert(dt_size == 4);
-    all_pos = arepo::read_block<Point>(
-        basedir, snapnum, "Coordinates", parttype);
-  }
   assert(all_pos.size() == nparts);
 
-  // Read stellar half-mass radius
-  auto sub_halfmassrad = subfind::read_block<real_type>(
-      basedir, snapnum, "Subhalo", "SubhaloHalfmassRadType", parttype);
-
   // Store results here
   std::vector<real_type> ParticleDistance(nparts, -1);
 
@@ -266,14 +229,17 @@ void update_stars(std::vector<ParticleInfo>& cur_stars,
 /** @brief Carry out stellar assembly calculations. */
 void stellar_assembly(const std::string& basedir, const std::string& treedir,
     const std::string& writepath, const snapnum_type snapnum_first,
-    const snapnum_type snapnum_last, const snapnum_type snapnum_restart) {
+    const snapnum_type snapnum_last, const snapnum_type snapnum_restart,
+    const std::string& catalog_cache_dir) {
 
   // Load merger tree
   WallClock wall_clock;
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType"};
+  Tree tree(treedir, name, filenum, fields);
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -318,19 +284,27 @@ void stellar_assembly(const std::string& basedir, const std::string& treedir,
     H5::H5File writefile(writefilename, H5F_ACC_TRUNC);
 
     // Only proceed if there is at least one subhalo
-    auto nsubs = subfind::get_scalar_attribute<uint32_t>(
-        basedir, snapnum, "Nsubgroups_Total");
+    subfind::CatalogReader catalog(basedir, snapnum, catalog_cache_dir);
+    uint32_t nsubs = catalog.num_subhalos();
     if (nsubs == 0) {
       std::cout << "No subhalos in snapshot " << snapnum << ". Skipping...\n";
       writefile.close();
       continue;
     }
 
-    // Read particle IDs
-    std::cout << "Reading particle IDs...\n";
+    // Read particle IDs and positions in a single pass over the
+    // snapshot files.
+    std::cout << "Reading particle IDs and positions...\n";
     wall_clock.start();
-    auto ParticleID = arepo::read_block<part_id_type>(
-        basedir, snapnum, "ParticleIDs", parttype);
+    arepo::SnapshotReader snapshot(basedir, snapnum);
+    auto box_size = static_cast<real_type>(
+        snapshot.get_scalar_attribute<double>("BoxSize"));
+    std::vector<part_id_type> ParticleID;
+    std::vector<Point> all_pos;
+    snapshot.add("ParticleIDs", &ParticleID);
+    // Coordinates stored as double are converted to float while reading.
+    snapshot.add("Coordinates", &all_pos);
+    snapshot.read(parttype);
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
     // Only proceed if there is at least one stellar particle
@@ -345,9 +319,13 @@ void stellar_assembly(const std::string& basedir, const std::string& treedir,
     std::cout << "Getting Subfind IDs of particles...\n";
     wall_clock.start();
     std::vector<index_type> SubfindID(nparts, -1);
-    auto sub_len = subfind::read_block<uint32_t>(
-        basedir, snapnum, "Subhalo", "SubhaloLenType", parttype);
-    auto sub_offset = calculate_subhalo_offsets(basedir, snapnum, parttype);
+    std::vector<uint32_t> sub_len;
+    std::vector<real_type> sub_halfmassrad;
+    catalog.add("Subhalo", "SubhaloLenType", &sub_len, parttype);
+    catalog.add("Subhalo", "SubhaloHalfmassRadType", &sub_halfmassrad,
+        parttype);
+    catalog.read();
+    auto sub_offset = calculate_subhalo_offsets(catalog, parttype);
     for (uint32_t sub_uindex = 0; sub_uindex < nsubs; ++sub_uindex) {
       part_id_type snap_count = sub_offset[sub_uindex];
       auto cur_sub_len = sub_len[sub_uindex];
@@ -361,8 +339,9 @@ void stellar_assembly(const std::string& basedir, const std::string& treedir,
     // Calculate galactocentric distances
     std::cout << "Calculating galactocentric distances...\n";
     wall_clock.start();
-    auto ParticleDistance = get_galactocentric_distances(basedir,
-        snapnum, SubfindID, sub_offset);
+    auto ParticleDistance = get_galactocentric_distances(all_pos, box_size,
+        sub_halfmassrad, SubfindID, sub_offset);
+    std::vector<Point>().swap(all_pos);  // no longer needed
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
     // Update cur_stars with info from current snapshot.
@@ -479,9 +458,9 @@ void stellar_assembly(const std::string& basedir, const std::string& treedir,
 int main(int argc, char** argv)
 {
   // Check input arguments
-  if (argc != 7) {
+  if ((argc != 7) && (argc != 8)) {
     std::cerr << "Usage: " << argv[0] << " basedir treedir writepath" <<
-        " snapnum_first snapnum_last snapnum_restart\n";
+        " snapnum_first snapnum_last snapnum_restart [catalog_cache_dir]\n";
     exit(1);
   }
 
@@ -492,13 +471,16 @@ int main(int argc, char** argv)
   int16_t snapnum_first = atoi(argv[4]);
   int16_t snapnum_last = atoi(argv[5]);
   int16_t snapnum_restart = atoi(argv[6]);
+  // Optional: directory with cached Subfind catalogs.
+  std::string catalog_cache_dir = (argc == 8) ? argv[7] : "";
 
   // Measure CPU and wall clock (real) time
   WallClock wall_clock;
   CPUClock cpu_clock;
 
   // Do stuff
-  stellar_assembly(basedir, treedir, writepath, snapnum_first, snapnum_last, snapnum_restart);
+  stellar_assembly(basedir, treedir, writepath, snapnum_first, snapnum_last,
+      snapnum_restart, catalog_cache_dir);
 
   // Print wall clock time and speedup
   std::cout << "Time: " << wall_clock.seconds() << " s.\n";
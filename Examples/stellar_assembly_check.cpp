@@ -5,9 +5,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include some extra quantities from the merger trees:
-#define COUNT_MERGERS
-
 #include <vector>
 #include <string>
 #include <iomanip>
@@ -39,7 +36,7 @@ struct AccretedData {
  * Based on get_infall_pair function from TreeUtil.hpp.
  */
 real_type get_infall_mass_recursive(Subhalo primary,
-    Subhalo secondary) {
+    Subhalo secondary, const Tree::Column<FloatArray<6>>& mass_type) {
   assert(primary.is_valid() && secondary.is_valid());
 
   real_type running_total = 0;
@@ -71,14 +68,15 @@ real_type get_infall_mass_recursive(Subhalo primary,
     // Iterate over next progenitor
     for (auto next_prog = secondary.next_progenitor(); next_prog.is_valid();
         next_prog = next_prog.next_progenitor()) {
-      running_total += get_infall_mass_recursive(primary, next_prog);
+      running_total += get_infall_mass_recursive(primary, next_prog,
+          mass_type);
     }
 
     // If primary and secondary do not belong to the same FoF group,
     // we have reached infall.
     if (  primary.first_subhalo_in_fof_group() !=
         secondary.first_subhalo_in_fof_group()) {
-      running_total += secondary.data().SubhaloMassType[4];
+      running_total += mass_type[secondary][4];
       return running_total;
     }
 
@@ -89,7 +87,8 @@ real_type get_infall_mass_recursive(Subhalo primary,
 }
 
 /** @brief Calculate ex situ fraction for a given subhalo. */
-void check_sub(Subhalo sub, AccretedData& ad) {
+void check_sub(Subhalo sub, const Tree::Column<FloatArray<6>>& mass_type,
+    AccretedData& ad) {
 
   uint32_t index_orig = sub.index();
 
@@ -101,11 +100,6 @@ void check_sub(Subhalo sub, AccretedData& ad) {
     for (auto next_prog = first_prog.next_progenitor(); next_prog.is_valid();
         next_prog = next_prog.next_progenitor()) {
 
-      // ------------------- INSTANTANEOUS -------------------------
-
-      // Add "instantaneous" mass
-      ad.StellarMassInstant[index_orig] += next_prog.data().SubhaloMassType[4];
-
       // ---------------------- STMAX ---------------------------
 
       // Progenitor properties at stellar tmax
@@ -119,14 +113,14 @@ void check_sub(Subhalo sub, AccretedData& ad) {
         continue;
 
       // Only proceed if both stellar masses at stmax are > 0
-      if (!((stmax_pair.first.data().SubhaloMassType[4] > 0) &&
-          (stmax_pair.second.data().SubhaloMassType[4] > 0))) {
+      if (!((mass_type[stmax_pair.first][4] > 0) &&
+          (mass_type[stmax_pair.second][4] > 0))) {
         continue;
       }
 
       // Add mass at stellar tmax
       real_type mass_secondary = std::min(
-          stmax_pair.first.data().SubhaloMassType[4], stmax_pair.second.data().SubhaloMassType[4]);
+          mass_type[stmax_pair.first][4], mass_type[stmax_pair.second][4]);
       ad.StellarMassMax[index_orig] += mass_secondary;
 
       // ---------------------- INFALL --------------------------
@@ -140,10 +134,11 @@ void check_sub(Subhalo sub, AccretedData& ad) {
 //        continue;
 //
 //      // Add mass at infall
-//      ad.StellarMassInfall[index_orig] += infall_pair.second.data().SubhaloMassType[4];
+//      ad.StellarMassInfall[index_orig] += mass_type[infall_pair.second][4];
 
       // Add masses at infall recursively.
-      ad.StellarMassInfall[index_orig] += get_infall_mass_recursive(first_prog, next_prog);
+      ad.StellarMassInfall[index_orig] += get_infall_mass_recursive(first_prog, next_prog,
+          mass_type);
     }
 
     // Next iteration
@@ -161,7 +156,9 @@ void stellar_assembly_check(const std::string& basedir, const std::string& treed
   std::cout << "Loading merger tree...\n";
   int filenum = -1;  // read from all merger tree files
   std::string name = "tree_extended";  // Full format
-  Tree tree(treedir, name, filenum);
+  // Include some extra quantities from the merger trees:
+  std::vector<std::string> fields = {"SubhaloMassType"};
+  Tree tree(treedir, name, filenum, fields);
   std::cout << "Loaded merger tree. Total time: " <<
       wall_clock.seconds() << " s.\n";
   std::cout << "\n";
@@ -185,10 +182,29 @@ void stellar_assembly_check(const std::string& basedir, const std::string& treed
   // Store data here:
   AccretedData ad(nsubs);
 
+  // "Instantaneous" mass: stellar mass of the secondary progenitors of
+  // each subhalo, summed along the main branch.
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
+  auto merged_mass = tree.aggregate([&mass_type](const Subhalo& sub) {
+    real_type retval = 0;
+    auto first_prog = sub.first_progenitor();
+    if (!first_prog.is_valid())
+      return retval;
+    for (auto next_prog = first_prog.next_progenitor(); next_prog.is_valid();
+        next_prog = next_prog.next_progenitor()) {
+      retval += mass_type[next_prog][4];
+    }
+    return retval;
+  });
+  ad.StellarMassInstant = tree.compute_catalog<real_type>(snapnum, nsubs,
+      [&merged_mass](const Subhalo& sub) {
+        return merged_mass.main_branch_sum(sub);
+      });
+
   // Iterate over subhalos to calculate ex situ fraction.
   auto snap = tree.snapshot(snapnum);
   for (auto sub_it = snap.begin(); sub_it != snap.end(); ++sub_it) {
-    check_sub(*sub_it, ad);
+    check_sub(*sub_it, mass_type, ad);
   }
 
   // Write to file.
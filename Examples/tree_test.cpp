@@ -8,9 +8,6 @@
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
-// Include last_progenitor, main_leaf_progenitor, and root_descendant
-#define EXTRA_POINTERS
-
 #include "../InputOutput/ReadTreeHDF5.hpp"
 
 int main()
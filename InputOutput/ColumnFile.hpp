@@ -0,0 +1,413 @@
+#pragma once
+
+/** @file ColumnFile.hpp
+ * @brief Binary files made of named columns, which can be memory-mapped
+ *        (read-only) so that "loading" them takes almost no time, and the
+ *        page cache is shared between processes reading the same file.
+ *
+ * Layout of a column file (native byte order):
+ *   - A Header with a magic string, a byte order mark, the format
+ *     version, the kind of data (e.g., "SubLinkTree") and the number
+ *     of columns.
+ *   - One Entry per column with its name, row size, number of rows and
+ *     the offset of its values from the beginning of the file.
+ *   - The values of each column, aligned to 64 bytes.
+ *
+ * Column files can also be published in POSIX shared memory, so that
+ * several processes on the same node attach to a single copy of the data
+ * without going through the file system.
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>  // memset, strncpy, strncmp
+#include <cstdio>  // rename
+#include <cstdlib>  // exit
+#include <cstdint>
+#include <cassert>
+#include <utility>  // swap
+
+#include <fcntl.h>  // open
+#include <unistd.h>  // close, ftruncate, getpid
+#include <sys/mman.h>  // mmap, munmap, shm_open, shm_unlink
+#include <sys/stat.h>  // fstat
+
+/** @brief Alignment (in bytes) of the values of each column. */
+static constexpr uint64_t column_file_alignment = 64;
+
+/** @brief Current version of the column file format. */
+static constexpr uint32_t column_file_version = 1;
+
+/** @brief Fixed-size header at the beginning of a column file. */
+struct ColumnFileHeader {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t version;
+  char kind[32];
+  uint64_t ncolumns;
+  uint64_t reserved;
+};
+
+/** @brief Description of one column in a column file. */
+struct ColumnFileEntry {
+  char name[64];
+  uint64_t row_size;
+  uint64_t nrows;
+  uint64_t offset;
+  uint64_t reserved;
+};
+
+/** @class ColumnFileWriter
+ * @brief Collect columns and write them to a column file.
+ *
+ * The values are not copied, so they must remain valid until write()
+ * is called. The file is first written under a temporary name and then
+ * renamed, so that readers never see an incomplete file.
+ */
+class ColumnFileWriter {
+public:
+  /** @brief Constructor.
+   * @param[in] kind Kind of data, checked when the file is opened.
+   */
+  explicit ColumnFileWriter(const std::string& kind)
+      : kind_(kind), entries_(), values_() {
+  }
+
+  /** @brief Add a column with @a nrows rows of @a row_size bytes each. */
+  void add(const std::string& name, const void* values, const uint64_t nrows,
+      const uint64_t row_size) {
+    if (name.size() >= sizeof(ColumnFileEntry().name)) {
+      std::cerr << "ERROR: column name " << name << " is too long.\n";
+      assert(false);
+    }
+    ColumnFileEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    std::strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+    entry.row_size = row_size;
+    entry.nrows = nrows;
+    entries_.push_back(entry);
+    values_.push_back(static_cast<const char*>(values));
+  }
+
+  /** @brief Convenience function to add a column from a vector. */
+  template <typename T>
+  void add(const std::string& name, const std::vector<T>& values) {
+    add(name, values.data(), values.size(), sizeof(T));
+  }
+
+  /** @brief Write all columns to @a file_name. */
+  void write(const std::string& file_name) {
+    ColumnFileHeader header = layout();
+    // Temporary name unique to this process, so that several processes
+    // can write the same file at once.
+    std::string tmp_file_name = file_name + ".tmp." +
+        std::to_string(::getpid());
+    std::ofstream file(tmp_file_name, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      std::cerr << "Error: cannot open file " << tmp_file_name << std::endl;
+      exit(1);
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries_.data()),
+        entries_.size()*sizeof(ColumnFileEntry));
+    const std::vector<char> padding(column_file_alignment, 0);
+    for (std::size_t k = 0; k < entries_.size(); ++k) {
+      uint64_t pos = file.tellp();
+      file.write(padding.data(), entries_[k].offset - pos);
+      file.write(values_[k], entries_[k].nrows * entries_[k].row_size);
+    }
+    file.close();
+    if (!file || (std::rename(tmp_file_name.c_str(), file_name.c_str()) != 0)) {
+      std::cerr << "Error: could not write file " << file_name << std::endl;
+      exit(1);
+    }
+  }
+
+  /** @brief Write all columns to the POSIX shared memory object
+   *         @a shm_name (e.g., "/tree_L75n1820"), replacing any previous
+   *         object with the same name. The object persists after this
+   *         process exits, until it is removed with remove_shared_memory().
+   *
+   * Processes that are attached to a previous object keep their copy.
+   * The header is written last, so that attaching to an incomplete
+   * object fails instead of returning partial data.
+   */
+  void publish(const std::string& shm_name) {
+    ColumnFileHeader header = layout();
+    const uint64_t size = entries_.empty() ? sizeof(header) :
+        entries_.back().offset + entries_.back().nrows*entries_.back().row_size;
+
+    ::shm_unlink(shm_name.c_str());
+    int fd = ::shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if ((fd < 0) || (::ftruncate(fd, size) != 0)) {
+      std::cerr << "Error: cannot create shared memory object " << shm_name <<
+          std::endl;
+      exit(1);
+    }
+    void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Error: cannot map shared memory object " << shm_name <<
+          std::endl;
+      exit(1);
+    }
+    char* data = static_cast<char*>(addr);
+    std::memcpy(data + sizeof(header), entries_.data(),
+        entries_.size()*sizeof(ColumnFileEntry));
+    for (std::size_t k = 0; k < entries_.size(); ++k) {
+      std::memcpy(data + entries_[k].offset, values_[k],
+          entries_[k].nrows * entries_[k].row_size);
+    }
+    std::memcpy(data, &header, sizeof(header));
+    ::munmap(addr, size);
+  }
+
+private:
+  /** @brief Return the header, and place columns after the header and
+   *         the entries (i.e., set the offset of each entry).
+   */
+  ColumnFileHeader layout() {
+    ColumnFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::strncpy(header.magic, "SLCOLS", sizeof(header.magic));
+    header.byte_order = 0x01020304;
+    header.version = column_file_version;
+    std::strncpy(header.kind, kind_.c_str(), sizeof(header.kind) - 1);
+    header.ncolumns = entries_.size();
+
+    uint64_t offset = sizeof(header) + entries_.size()*sizeof(ColumnFileEntry);
+    for (auto& entry : entries_) {
+      offset = aligned(offset);
+      entry.offset = offset;
+      offset += entry.nrows * entry.row_size;
+    }
+    return header;
+  }
+
+  /** Round @a offset up to a multiple of column_file_alignment. */
+  static uint64_t aligned(const uint64_t offset) {
+    return ((offset + column_file_alignment - 1) / column_file_alignment) *
+        column_file_alignment;
+  }
+
+  /** Kind of data. */
+  std::string kind_;
+  /** Description of each column. */
+  std::vector<ColumnFileEntry> entries_;
+  /** Pointers to the values of each column. */
+  std::vector<const char*> values_;
+};
+
+/** @class MappedColumnFile
+ * @brief Read-only view of a column file, mapped into memory.
+ *
+ * The file stays mapped for the lifetime of this object, which can be
+ * moved but not copied.
+ */
+class MappedColumnFile {
+public:
+  /** @brief Construct an empty object (no file mapped). */
+  MappedColumnFile() : data_(nullptr), size_(0), entries_(nullptr),
+      ncolumns_(0) {
+  }
+
+  /** @brief Map @a file_name, checking that it contains data of the
+   *         given @a kind.
+   */
+  MappedColumnFile(const std::string& file_name, const std::string& kind)
+      : MappedColumnFile() {
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Error: cannot open file " << file_name << std::endl;
+      exit(1);
+    }
+    map(fd, file_name, kind);
+  }
+
+  /** @brief Map the POSIX shared memory object @a shm_name (see
+   *         ColumnFileWriter::publish), checking that it contains data of
+   *         the given @a kind.
+   */
+  static MappedColumnFile open_shared_memory(const std::string& shm_name,
+      const std::string& kind) {
+    int fd = ::shm_open(shm_name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      std::cerr << "Error: shared memory object " << shm_name <<
+          " not found." << std::endl;
+      exit(1);
+    }
+    MappedColumnFile retval;
+    retval.map(fd, shm_name, kind);
+    return retval;
+  }
+
+  /** @brief Remove the POSIX shared memory object @a shm_name. Processes
+   *         that are attached to it keep their mapping.
+   */
+  static void remove_shared_memory(const std::string& shm_name) {
+    if (::shm_unlink(shm_name.c_str()) != 0) {
+      std::cerr << "Error: cannot remove shared memory object " << shm_name <<
+          std::endl;
+      exit(1);
+    }
+  }
+
+  /** Destructor. Unmap the file. */
+  ~MappedColumnFile() {
+    unmap();
+  }
+
+  /** Move constructor. */
+  MappedColumnFile(MappedColumnFile&& x) : MappedColumnFile() {
+    swap(x);
+  }
+
+  /** Move assignment. */
+  MappedColumnFile& operator=(MappedColumnFile&& x) {
+    unmap();
+    swap(x);
+    return *this;
+  }
+
+  MappedColumnFile(const MappedColumnFile&) = delete;
+  MappedColumnFile& operator=(const MappedColumnFile&) = delete;
+
+  /** Return the number of columns. */
+  uint64_t num_columns() const {
+    return ncolumns_;
+  }
+
+  /** Return the description of column number @a k. */
+  const ColumnFileEntry& entry(const uint64_t k) const {
+    assert(k < ncolumns_);
+    return entries_[k];
+  }
+
+  /** Return the values of column number @a k. */
+  const char* values(const uint64_t k) const {
+    return data_ + entry(k).offset;
+  }
+
+  /** Return the index of the column called @a name, or -1 if missing. */
+  int64_t find(const std::string& name) const {
+    for (uint64_t k = 0; k < ncolumns_; ++k) {
+      if (std::strncmp(entries_[k].name, name.c_str(),
+          sizeof(entries_[k].name)) == 0)
+        return k;
+    }
+    return -1;
+  }
+
+private:
+  /** @brief Map the open file descriptor @a fd (which is closed) and
+   *         check its contents.
+   */
+  void map(const int fd, const std::string& file_name, const std::string& kind) {
+    struct stat file_stat;
+    if ((::fstat(fd, &file_stat) != 0) ||
+        (static_cast<uint64_t>(file_stat.st_size) < sizeof(ColumnFileHeader))) {
+      std::cerr << "Error: " << file_name << " is not a column file." << std::endl;
+      exit(1);
+    }
+    size_ = file_stat.st_size;
+    void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      std::cerr << "Error: cannot map file " << file_name << std::endl;
+      exit(1);
+    }
+    data_ = static_cast<const char*>(addr);
+
+    // Check header and entries.
+    const auto* header = reinterpret_cast<const ColumnFileHeader*>(data_);
+    if ((std::strncmp(header->magic, "SLCOLS", sizeof(header->magic)) != 0) ||
+        (header->byte_order != 0x01020304)) {
+      std::cerr << "Error: " << file_name << " is not a column file " <<
+          "(or has different endianness)." << std::endl;
+      exit(1);
+    }
+    if (header->version != column_file_version) {
+      std::cerr << "Error: " << file_name << " has format version " <<
+          header->version << " (expected " << column_file_version << ")." <<
+          std::endl;
+      exit(1);
+    }
+    if (std::strncmp(header->kind, kind.c_str(), sizeof(header->kind)) != 0) {
+      std::cerr << "Error: " << file_name << " does not contain " << kind <<
+          " data." << std::endl;
+      exit(1);
+    }
+    ncolumns_ = header->ncolumns;
+    entries_ = reinterpret_cast<const ColumnFileEntry*>(data_ + sizeof(*header));
+    bool good = (sizeof(*header) + ncolumns_*sizeof(ColumnFileEntry) <= size_);
+    for (uint64_t k = 0; good && (k < ncolumns_); ++k) {
+      good = (entries_[k].offset + entries_[k].nrows*entries_[k].row_size <= size_);
+    }
+    if (!good) {
+      std::cerr << "Error: " << file_name << " is truncated." << std::endl;
+      exit(1);
+    }
+  }
+
+  /** Helper function for move operations. */
+  void swap(MappedColumnFile& x) {
+    std::swap(data_, x.data_);
+    std::swap(size_, x.size_);
+    std::swap(entries_, x.entries_);
+    std::swap(ncolumns_, x.ncolumns_);
+  }
+
+  /** Helper function to unmap the file, if any. */
+  void unmap() {
+    if (data_ != nullptr)
+      ::munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+    entries_ = nullptr;
+    ncolumns_ = 0;
+  }
+
+  /** Beginning of the mapped file. */
+  const char* data_;
+  /** Size of the mapped file in bytes. */
+  uint64_t size_;
+  /** Description of each column. */
+  const ColumnFileEntry* entries_;
+  /** Number of columns. */
+  uint64_t ncolumns_;
+};
+
+/** @class ColumnView
+ * @brief Typed, read-only view of the values of a column, which are
+ *        stored elsewhere (e.g., in a std::vector or a MappedColumnFile).
+ */
+template <typename T>
+class ColumnView {
+public:
+  /** Construct an empty view. */
+  ColumnView() : data_(nullptr), size_(0) {
+  }
+  /** Construct a view of @a size values starting at @a data. */
+  ColumnView(const T* data, const uint64_t size) : data_(data), size_(size) {
+  }
+  /** Return the value at position @a i. */
+  const T& operator[](const uint64_t i) const {
+    return data_[i];
+  }
+  /** Return the number of values. */
+  uint64_t size() const {
+    return size_;
+  }
+  /** Return a pointer to the first value. */
+  const T* data() const {
+    return data_;
+  }
+
+private:
+  const T* data_;
+  uint64_t size_;
+};
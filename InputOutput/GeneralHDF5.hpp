@@ -9,9 +9,140 @@
 #include <vector>
 #include <string>
 #include <cassert>
+#include <algorithm>  // min
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <type_traits>  // enable_if, is_arithmetic
+#include <cstdint>
+#include <unistd.h>  // pread
 
 #include "H5Cpp_wrapper.hpp"
 
+/** @class H5Lock
+ * @brief Scoped lock that serializes HDF5 calls made from different threads.
+ *
+ * Does nothing if the HDF5 library is thread-safe. Note that HDF5 objects
+ * (files, datasets, datatypes...) also make HDF5 calls when they are
+ * destroyed, so they should go out of scope while the lock is held.
+ */
+class H5Lock {
+public:
+#ifdef H5_HAVE_THREADSAFE
+  /** Constructor. */
+  H5Lock() {
+  }
+#else
+  /** Constructor. Blocks until no other thread holds an H5Lock. */
+  H5Lock() : guard_(mutex()) {
+  }
+private:
+  static std::mutex& mutex() {
+    static std::mutex m;
+    return m;
+  }
+  std::lock_guard<std::mutex> guard_;
+#endif
+};
+
+/** @brief Dataset creation properties for a chunked (and possibly
+ * compressed) layout.
+ *
+ * @param[in] rank Rank of the dataset.
+ * @param[in] dims Dimensions of the dataset.
+ * @param[in] chunk_rows Number of rows (first dimension) per chunk. Other
+ *            dimensions are not split. If zero, the layout is contiguous.
+ * @param[in] deflate_level Compression level from 1 to 9 for the
+ *            shuffle+deflate filters, or zero for no compression.
+ */
+H5::DSetCreatPropList chunked_layout(const int rank, const hsize_t* dims,
+    const hsize_t chunk_rows, const int deflate_level) {
+  H5::DSetCreatPropList plist;
+  // Chunks cannot be larger than a fixed-size dataset.
+  if ((chunk_rows == 0) || (dims[0] == 0))
+    return plist;
+  hsize_t chunk_dims[rank];
+  chunk_dims[0] = std::min(chunk_rows, dims[0]);
+  for (int k = 1; k < rank; ++k)
+    chunk_dims[k] = dims[k];
+  plist.setChunk(rank, chunk_dims);
+  if (deflate_level > 0) {
+    if (H5Zfilter_avail(H5Z_FILTER_DEFLATE) <= 0) {
+      std::cerr << "WARNING: deflate filter not available. " <<
+          "Writing uncompressed data.\n";
+      return plist;
+    }
+    plist.setShuffle();
+    plist.setDeflate(deflate_level);
+  }
+  return plist;
+}
+
+/** @brief The native HDF5 datatype of the elements of @a T in memory.
+ *
+ * Defined for integer and floating-point types, and for arrays of them
+ * with a @a value_type member (e.g., std::array, or Point), which are
+ * read from datasets with one such array per row. Other types (e.g.,
+ * structs) are unknown, and can only be read in their file datatype.
+ */
+template <typename T, typename Enable = void>
+struct NativeType {
+  /** Number of elements of the native type in @a T. */
+  static const std::size_t count = 1;
+  /** Return the native datatype, or nullptr if unknown. */
+  static const H5::PredType* type() { return nullptr; }
+};
+
+#define NATIVE_TYPE(T, PREDTYPE) \
+template <> \
+struct NativeType<T> { \
+  static const std::size_t count = 1; \
+  static const H5::PredType* type() { return &H5::PredType::PREDTYPE; } \
+};
+NATIVE_TYPE(int8_t, NATIVE_INT8)
+NATIVE_TYPE(uint8_t, NATIVE_UINT8)
+NATIVE_TYPE(int16_t, NATIVE_INT16)
+NATIVE_TYPE(uint16_t, NATIVE_UINT16)
+NATIVE_TYPE(int32_t, NATIVE_INT32)
+NATIVE_TYPE(uint32_t, NATIVE_UINT32)
+NATIVE_TYPE(int64_t, NATIVE_INT64)
+NATIVE_TYPE(uint64_t, NATIVE_UINT64)
+NATIVE_TYPE(float, NATIVE_FLOAT)
+NATIVE_TYPE(double, NATIVE_DOUBLE)
+#undef NATIVE_TYPE
+
+template <typename T>
+struct NativeType<T, typename std::enable_if<
+    std::is_arithmetic<typename T::value_type>::value &&
+    (sizeof(T) % sizeof(typename T::value_type) == 0)>::type> {
+  static const std::size_t count = sizeof(T) / sizeof(typename T::value_type);
+  static const H5::PredType* type() {
+    return NativeType<typename T::value_type>::type();
+  }
+};
+
+/** @brief Check that a dataset with datatype @a file_type and
+ *         @a file_count elements per row can be read into rows of
+ *         @a count elements of the native datatype @a mem_type, letting
+ *         HDF5 convert them: both must be integers or both floating
+ *         point, and integers cannot be narrowed.
+ *
+ * @return True if the dataset can be read; false otherwise.
+ */
+bool native_type_matches(const H5::DataType& file_type,
+    const std::size_t file_count, const H5::PredType& mem_type,
+    const std::size_t count) {
+  if (file_count != count)
+    return false;
+  const H5T_class_t type_class = file_type.getClass();
+  if (type_class != mem_type.getClass())
+    return false;
+  if (type_class == H5T_INTEGER)
+    return file_type.getSize() <= mem_type.getSize();
+  return type_class == H5T_FLOAT;
+}
+
 /** @brief Check whether an HDF5 file exists or not.
  * @param[in] file_name Path to the input file.
  * @return True if HDF5 file exists; false otherwise.
@@ -29,6 +160,51 @@ bool h5_file_exists(const std::string& file_name) {
     return false;  // Return statement just to remove IDE warning.
 }
 
+/** @brief Return the POSIX file descriptor of @a file, or -1 if it was
+ *         not opened with the default (sec2) file driver.
+ */
+int h5_file_descriptor(const H5::H5File& file) {
+  hid_t fapl = H5Fget_access_plist(file.getId());
+  bool sec2 = (H5Pget_driver(fapl) == H5FD_SEC2);
+  H5Pclose(fapl);
+  void* handle = nullptr;
+  if (!sec2 || (H5Fget_vfd_handle(file.getId(), H5P_DEFAULT, &handle) < 0))
+    return -1;
+  return *static_cast<int*>(handle);
+}
+
+/** @brief Return the position of the raw data of @a dataset in its file,
+ *         or HADDR_UNDEF if the data cannot be copied byte by byte from
+ *         there: the dataset is chunked (and possibly compressed), stored
+ *         in external files or not allocated, or its datatype has
+ *         variable-length elements or references.
+ */
+haddr_t h5_raw_data_address(const H5::DataSet& dataset) {
+  hid_t type_id = H5Dget_type(dataset.getId());
+  bool fixed_size = (H5Tdetect_class(type_id, H5T_VLEN) <= 0) &&
+      (H5Tdetect_class(type_id, H5T_REFERENCE) <= 0) &&
+      (H5Tis_variable_str(type_id) <= 0);
+  H5Tclose(type_id);
+  return fixed_size ? H5Dget_offset(dataset.getId()) : HADDR_UNDEF;
+}
+
+/** @brief Read @a nbytes bytes at position @a offset of file
+ *         descriptor @a fd into @a dest.
+ */
+void pread_bytes(const int fd, char* dest, uint64_t nbytes, uint64_t offset) {
+  while (nbytes > 0) {
+    ssize_t n = pread(fd, dest, nbytes, offset);
+    if (n <= 0) {
+      std::cerr << "ERROR: could not read from HDF5 file.\n";
+      assert(false);
+      return;
+    }
+    dest += n;
+    nbytes -= n;
+    offset += n;
+  }
+}
+
 /** @brief Function to read a dataset (a.k.a. block) from a single HDF5 file.
  *
  * @tparam T Type of the elements in the dataset.
@@ -79,122 +255,405 @@ std::vector<T> read_dataset(const std::string& file_name,
   return retval;
 }
 
-/** @brief Function to read a dataset (a.k.a. block) from a sequence of
- * HDF5 files with filenames ending in .0.hdf5, .1.hdf5, etc.
+/** @brief Read rows [@a row_start, @a row_start + @a nrows) of a dataset
+ *         from an HDF5 file that is already open.
  *
  * @tparam T Type of the elements in the dataset.
- * @param[in] file_base Path to the input files, excluding ".N.hdf5".
+ * @param[in] file An open HDF5 file.
  * @param[in] block_name Name of the dataset.
+ * @param[in] row_start First row to be read.
+ * @param[in] nrows Number of rows to be read.
  * @return A vector with the dataset values.
- *
- * @note The return value is a vector (with an appropriately chosen type).
- *       When reading from a dataset with ndims > 1, the size() of the
- *       output vector equals the size of the first dimension of the
- *       (concatenated) dataset.
  */
 template <typename T>
-std::vector<T> read_dataset_manyfiles(const std::string& file_base,
-    const std::string& block_name) {
+std::vector<T> read_dataset_rows(const H5::H5File& file,
+    const std::string& block_name, const uint64_t row_start,
+    const uint64_t nrows) {
+  H5::DataSet dataset(file.openDataSet(block_name));
 
-  // Iterate over files to get number of subhalos
-  std::vector<uint64_t> file_nsubs;
-  std::vector<uint64_t> file_offsets;
-  int64_t nsubs_in_trees = 0;
-  unsigned int filenum = 0; // cannot have filenum == -1 in this function
-  while (true) {
-    // Path of current merger tree file
-    std::stringstream tmp_stream;
-    tmp_stream << file_base << "." << filenum << ".hdf5";
-    std::string file_name = tmp_stream.str();
+  // Get dimensions of the dataset
+  H5::DataSpace file_space = dataset.getSpace();
+  const unsigned int file_rank = file_space.getSimpleExtentNdims();
+  hsize_t file_dims[file_rank];
+  file_space.getSimpleExtentDims(file_dims, NULL);
+  if (row_start + nrows > file_dims[0]) {
+    std::cerr << "ERROR: rows " << row_start << "-" << row_start + nrows <<
+        " out of range in " << block_name << ".\n";
+    assert(false);
+  }
 
-    // Only proceed if file exists
-    if (!h5_file_exists(file_name))
-      break;
+  // Check that datatype sizes match (necessary but not sufficient)
+  auto dt = dataset.getDataType();
+  std::size_t row_size = dt.getSize();
+  for (unsigned int k = 1; k < file_rank; ++k)
+    row_size = row_size * file_dims[k];
+  if (row_size != sizeof(T)) {
+    std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
+        " vs " << sizeof(T) << ") when reading " << block_name << ".\n";
+    assert(false);
+  }
 
-    // Open dataset
-    H5::H5File file(file_name, H5F_ACC_RDONLY );
-    H5::DataSet dataset(file.openDataSet(block_name));
+  // Select rows in "file space" and read them.
+  hsize_t count[file_rank];
+  hsize_t offset[file_rank];
+  for (unsigned int k = 0; k < file_rank; ++k) {
+    count[k] = file_dims[k];
+    offset[k] = 0;
+  }
+  count[0] = nrows;
+  offset[0] = row_start;
+  std::vector<T> retval(nrows);
+  if (nrows > 0) {
+    file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+    H5::DataSpace mem_space(file_rank, count);
+    dataset.read(retval.data(), dt, mem_space, file_space);
+  }
+  return retval;
+}
+
+/** @brief Read the given rows of a one-dimensional dataset from an
+ *         HDF5 file that is already open.
+ *
+ * @tparam T Type of the elements in the dataset.
+ * @param[in] file An open HDF5 file.
+ * @param[in] block_name Name of the dataset.
+ * @param[in] rows Rows to be read.
+ * @return A vector with the values of the dataset at @a rows.
+ */
+template <typename T>
+std::vector<T> read_dataset_elements(const H5::H5File& file,
+    const std::string& block_name, const std::vector<hsize_t>& rows) {
+  H5::DataSet dataset(file.openDataSet(block_name));
+  H5::DataSpace file_space = dataset.getSpace();
+  assert(file_space.getSimpleExtentNdims() == 1);
+  auto dt = dataset.getDataType();
+  if (dt.getSize() != sizeof(T)) {
+    std::cerr << "ERROR: mismatched datatype sizes (" << dt.getSize() <<
+        " vs " << sizeof(T) << ") when reading " << block_name << ".\n";
+    assert(false);
+  }
+
+  std::vector<T> retval(rows.size());
+  if (!rows.empty()) {
+    file_space.selectElements(H5S_SELECT_SET, rows.size(), rows.data());
+    hsize_t mem_dims[1] = {rows.size()};
+    H5::DataSpace mem_space(1, mem_dims);
+    dataset.read(retval.data(), dt, mem_space, file_space);
+  }
+  return retval;
+}
+
+/** @class RawRowReader
+ * @brief Read rows of a dataset as raw bytes, in the datatype of the file,
+ *        from several threads at once.
+ *
+ * The dataset is opened (and later closed) like any other HDF5 object,
+ * i.e., without other threads making HDF5 calls at the same time, but
+ * read() can be called concurrently: contiguous datasets in files opened
+ * with the default driver are copied with pread at their position in the
+ * file, bypassing the HDF5 library, which serializes concurrent calls
+ * even when it is thread-safe. Other datasets are read through HDF5
+ * under H5Lock.
+ */
+class RawRowReader {
+public:
+  /** @brief Open dataset @a block_name from @a file. */
+  RawRowReader(const H5::H5File& file, const std::string& block_name)
+      : dataset_(), nrows_(0), row_size_(0), fd_(-1), address_(HADDR_UNDEF) {
+    if (H5Lexists(file.getId(), block_name.c_str(), H5P_DEFAULT) <= 0) {
+      std::cerr << "ERROR: dataset " << block_name << " not found in " <<
+          file.getFileName() << ".\n";
+      assert(false);
+    }
+    dataset_ = file.openDataSet(block_name);
 
     // Get dimensions of the dataset (in "file space")
-    H5::DataSpace file_space = dataset.getSpace();
+    H5::DataSpace file_space = dataset_.getSpace();
     const unsigned int file_rank = file_space.getSimpleExtentNdims();
     hsize_t file_dims[file_rank];
     file_space.getSimpleExtentDims(file_dims, NULL);
-
-    // Store number of subhalos
-    file_nsubs.push_back(file_dims[0]);
-    nsubs_in_trees += file_dims[0];
-    if (filenum > 0)
-      file_offsets.push_back(file_offsets[filenum-1] + file_nsubs[filenum-1]);
-    else
-      file_offsets.push_back(0);
-
-    // Next iteration
-    file.close();
-    filenum += 1;
+    nrows_ = file_dims[0];
+    row_size_ = dataset_.getDataType().getSize();
+    for (unsigned int l = 1; l < file_rank; ++l)
+      row_size_ = row_size_ * file_dims[l];
+
+    fd_ = h5_file_descriptor(file);
+    if (fd_ != -1)
+      address_ = h5_raw_data_address(dataset_);
   }
-  assert(file_nsubs.size() == file_offsets.size());
-  const unsigned int nfiles = file_nsubs.size();
 
-  // Store output in 1D vector
-  std::vector<T> retval(nsubs_in_trees);
+  /** @brief Return the number of rows of the dataset. */
+  uint64_t num_rows() const {
+    return nrows_;
+  }
 
-  // Iterate over files to read the data
-  std::cout << "Reading " << block_name << " from " << nfiles << " files...\n";
-  for (filenum = 0; filenum < nfiles; ++filenum) {
-    // Path of current merger tree file
-    std::stringstream tmp_stream;
-    tmp_stream << file_base << "." << filenum << ".hdf5";
-    std::string file_name = tmp_stream.str();
+  /** @brief Return the size of one row of the dataset, in bytes. */
+  std::size_t row_size() const {
+    return row_size_;
+  }
 
-    // Open dataset (the file must exist)
-    H5::H5File file(file_name, H5F_ACC_RDONLY);
-    H5::DataSet dataset(file.openDataSet(block_name));
+  /** @brief Read rows [@a row_start, @a row_start + @a nrows) into
+   *         @a dest, which must hold @a nrows * row_size() bytes.
+   */
+  void read(const uint64_t row_start, const uint64_t nrows,
+      char* dest) const {
+    assert(row_start + nrows <= nrows_);
+    if (nrows == 0)
+      return;
+    if (address_ != HADDR_UNDEF) {
+      pread_bytes(fd_, dest, nrows * row_size_,
+          address_ + row_start * row_size_);
+      return;
+    }
 
-    // Get dimensions of the dataset (in "file space")
-    H5::DataSpace file_space = dataset.getSpace();
+    // Select rows in "file space"
+    H5Lock lock;
+    H5::DataSpace file_space = dataset_.getSpace();
     const unsigned int file_rank = file_space.getSimpleExtentNdims();
-    hsize_t file_dims[file_rank];
-    file_space.getSimpleExtentDims(file_dims, NULL);
-    assert(file_dims[0] == file_nsubs[filenum]); // sanity check
-
-    // Check that datatype sizes match (necessary but not sufficient)
-    auto dt = dataset.getDataType();
-    std::size_t row_size = dt.getSize();
-    for (unsigned int k = 1; k < file_rank; ++k)
-      row_size = row_size * file_dims[k];
-    if (row_size != sizeof(T)) {
-      std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
-          " vs " << sizeof(T) << ") when reading " << block_name << ".\n";
-      assert(false);
+    hsize_t count[file_rank];
+    hsize_t offset[file_rank];
+    file_space.getSimpleExtentDims(count, NULL);
+    for (unsigned int l = 0; l < file_rank; ++l)
+      offset[l] = 0;
+    count[0] = nrows;
+    offset[0] = row_start;
+    file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+    H5::DataSpace mem_space(file_rank, count);
+    dataset_.read(dest, dataset_.getDataType(), mem_space, file_space);
+  }
+
+private:
+  /** The dataset. */
+  H5::DataSet dataset_;
+  /** Number of rows. */
+  uint64_t nrows_;
+  /** Size of one row, in bytes. */
+  std::size_t row_size_;
+  /** File descriptor of the file, or -1 if not available. */
+  int fd_;
+  /** Position of the data in the file, or HADDR_UNDEF to read them
+   * through HDF5.
+   */
+  haddr_t address_;
+};
+
+/** @class DatasetReader
+ * @brief Read several datasets (a.k.a. blocks) from a single HDF5 file or
+ *        from a sequence of files ending in .0.hdf5, .1.hdf5, etc.
+ *
+ * Each file is opened only once. The number of rows in every file is
+ * found before reading, so that each dataset is read directly into its
+ * (preallocated) destination at the right offset. The datasets of all
+ * files are then read in parallel (see RawRowReader).
+ *
+ * Example:
+ *   DatasetReader reader(file_base, -1);
+ *   reader.add("SubhaloID", &subhalo_id);
+ *   reader.add("SnapNum", &snapnum);
+ *   reader.read();
+ */
+class DatasetReader {
+public:
+  /** @brief Constructor.
+   * @param[in] file_base Path to the input files, excluding ".N.hdf5".
+   * @param[in] filenum File number (-1 to read sequence of files).
+   */
+  DatasetReader(const std::string& file_base, const int filenum)
+      : file_names_(), blocks_(), row_start_(0), nrows_(-1) {
+    // If given a valid file number, only read data from that file.
+    if (filenum >= 0) {
+      file_names_.push_back(file_name(file_base, filenum));
+      return;
     }
+    // Otherwise read data from all files, stopping at the first missing one.
+    for (int cur_filenum = 0; ; ++cur_filenum) {
+      std::string cur_file_name = file_name(file_base, cur_filenum);
+      if (!std::ifstream(cur_file_name).good())
+        break;
+      file_names_.push_back(cur_file_name);
+    }
+  }
 
-    // Define the "memory dataspace", which corresponds to the full,
-    // concatenated data. This is the same for all files.
-    const unsigned int mem_rank = file_rank;
-    hsize_t mem_dims[mem_rank];
-    for (hsize_t k = 0; k < file_rank; ++k)
-      mem_dims[k] = file_dims[k];
-    mem_dims[0] = nsubs_in_trees; // note this line in particular
-    H5::DataSpace mem_space(mem_rank, mem_dims);
-
-    // Define "memory hyperslab" (see readdata.cpp from HDF5 tutorial)
-    hsize_t offset_out[mem_rank]; // hyperslab offset
-    hsize_t count_out[mem_rank]; // hyperslab size
-    for (hsize_t k = 0; k < mem_rank; ++k) {
-      offset_out[k] = 0;
-      count_out[k] = mem_dims[k];
+  /** @brief Return the number of files to be read. */
+  std::size_t num_files() const {
+    return file_names_.size();
+  }
+
+  /** @brief Only read rows [@a row_start, @a row_start + @a nrows) of
+   *         each dataset, e.g., a single tree.
+   * @pre A single file is read (filenum >= 0).
+   */
+  void select_rows(const uint64_t row_start, const uint64_t nrows) {
+    assert(file_names_.size() == 1);
+    row_start_ = row_start;
+    nrows_ = nrows;
+  }
+
+  /** @brief Read dataset @a block_name into @a dest. The size of @a T
+   *         must equal the size of one row of the dataset.
+   */
+  template <typename T>
+  void add(const std::string& block_name, std::vector<T>* dest) {
+    Block block;
+    block.name = block_name;
+    block.allocate = [dest, block_name](const uint64_t nrows,
+        const std::size_t row_size) -> char* {
+      if ((row_size != 0) && (row_size != sizeof(T))) {
+        std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
+            " vs " << sizeof(T) << ") when reading " << block_name << ".\n";
+        assert(false);
+      }
+      dest->resize(nrows);
+      return reinterpret_cast<char*>(dest->data());
+    };
+    blocks_.push_back(block);
+  }
+
+  /** @brief Read dataset @a block_name into @a dest as raw bytes, without
+   *         knowing its type, and set @a row_size to the size of one row.
+   */
+  void add_raw(const std::string& block_name, std::vector<char>* dest,
+      std::size_t* row_size) {
+    Block block;
+    block.name = block_name;
+    block.allocate = [dest, row_size](const uint64_t nrows,
+        const std::size_t cur_row_size) -> char* {
+      *row_size = cur_row_size;
+      dest->resize(nrows*cur_row_size);
+      return dest->data();
+    };
+    blocks_.push_back(block);
+  }
+
+  /** @brief Read all datasets added so far.
+   * @return The number of rows of each (concatenated) dataset.
+   */
+  uint64_t read() {
+    const int64_t nfiles = file_names_.size();
+    const int64_t nblocks = blocks_.size();
+    std::vector<H5::H5File> files(nfiles);
+    std::vector<std::vector<RawRowReader>> readers(nfiles);
+    std::vector<uint64_t> file_nrows(nfiles, 0);
+
+    // Open every file and dataset, and get their dimensions.
+    for (int64_t i = 0; i < nfiles; ++i) {
+      files[i].openFile(file_names_[i], H5F_ACC_RDONLY);
+      for (int64_t k = 0; k < nblocks; ++k) {
+        const std::string& block_name = blocks_[k].name;
+        readers[i].emplace_back(files[i], block_name);
+        uint64_t cur_nrows = readers[i][k].num_rows();
+
+        // Only keep the selected rows, if any.
+        if (nrows_ >= 0) {
+          if (row_start_ + nrows_ > cur_nrows) {
+            std::cerr << "ERROR: rows " << row_start_ << "-" <<
+                row_start_ + nrows_ << " out of range in " << block_name <<
+                ".\n";
+            assert(false);
+          }
+          cur_nrows = nrows_;
+        }
+
+        // All datasets in a file must have the same number of rows.
+        if (k == 0)
+          file_nrows[i] = cur_nrows;
+        if (cur_nrows != file_nrows[i]) {
+          std::cerr << "ERROR: wrong number of rows in " << block_name <<
+              " (" << cur_nrows << " vs " << file_nrows[i] << ") in " <<
+              file_names_[i] << ".\n";
+          assert(false);
+        }
+      }
     }
-    offset_out[0] = file_offsets[filenum];
-    count_out[0] = file_nsubs[filenum];
-    mem_space.selectHyperslab(H5S_SELECT_SET, count_out, offset_out);
 
-    // Read data
-    dataset.read(retval.data(), dataset.getDataType(), mem_space, file_space);
+    // Offsets of each file in the concatenated datasets.
+    std::vector<uint64_t> file_offsets(nfiles, 0);
+    uint64_t nrows = 0;
+    for (int64_t i = 0; i < nfiles; ++i) {
+      file_offsets[i] = nrows;
+      nrows += file_nrows[i];
+    }
 
-    // Close HDF5 file
-    file.close();
+    // Allocate output. Row sizes must be the same in all files.
+    std::vector<char*> dests(nblocks);
+    std::vector<std::size_t> block_row_sizes(nblocks, 0);
+    for (int64_t k = 0; k < nblocks; ++k) {
+      for (int64_t i = 0; i < nfiles; ++i) {
+        const std::size_t row_size = readers[i][k].row_size();
+        if (i == 0)
+          block_row_sizes[k] = row_size;
+        if (row_size != block_row_sizes[k]) {
+          std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
+              " vs " << block_row_sizes[k] << ") when reading " <<
+              blocks_[k].name << ".\n";
+          assert(false);
+        }
+      }
+      dests[k] = blocks_[k].allocate(nrows, block_row_sizes[k]);
+    }
+
+    // Read every dataset of every file, in parallel.
+    const uint64_t row_start = (nrows_ >= 0) ? row_start_ : 0;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t j = 0; j < nfiles * nblocks; ++j) {
+      const int64_t i = j / nblocks;
+      const int64_t k = j % nblocks;
+      readers[i][k].read(row_start, file_nrows[i],
+          dests[k] + file_offsets[i]*block_row_sizes[k]);
+    }
+    return nrows;
+  }
+
+private:
+  /** @brief A dataset to be read. */
+  struct Block {
+    // Name of the dataset.
+    std::string name;
+    // Resize the destination for a given number of rows and row size,
+    // and return a pointer to its first element.
+    std::function<char*(const uint64_t, const std::size_t)> allocate;
+  };
+
+  /** @brief Return the path of file number @a filenum. */
+  static std::string file_name(const std::string& file_base,
+      const int filenum) {
+    std::stringstream tmp_stream;
+    tmp_stream << file_base << "." << filenum << ".hdf5";
+    return tmp_stream.str();
   }
+
+  /** Paths of the files to be read. */
+  std::vector<std::string> file_names_;
+  /** Datasets to be read. */
+  std::vector<Block> blocks_;
+  /** First row to be read. */
+  uint64_t row_start_;
+  /** Number of rows to be read (-1 means all). */
+  int64_t nrows_;
+};
+
+/** @brief Function to read a dataset (a.k.a. block) from a sequence of
+ * HDF5 files with filenames ending in .0.hdf5, .1.hdf5, etc.
+ *
+ * @tparam T Type of the elements in the dataset.
+ * @param[in] file_base Path to the input files, excluding ".N.hdf5".
+ * @param[in] block_name Name of the dataset.
+ * @return A vector with the dataset values.
+ *
+ * @note The return value is a vector (with an appropriately chosen type).
+ *       When reading from a dataset with ndims > 1, the size() of the
+ *       output vector equals the size of the first dimension of the
+ *       (concatenated) dataset.
+ */
+template <typename T>
+std::vector<T> read_dataset_manyfiles(const std::string& file_base,
+    const std::string& block_name) {
+  std::vector<T> retval;
+  DatasetReader reader(file_base, -1);
+  reader.add(block_name, &retval);
+  std::cout << "Reading " << block_name << " from " << reader.num_files() <<
+      " files...\n";
+  reader.read();
   return retval;
 }
 
@@ -225,13 +684,92 @@ std::vector<T> read_dataset_by_filenum(const std::string& file_base,
   return read_dataset_manyfiles<T>(file_base, block_name);
 }
 
+/** @class DatasetWriter
+ * @brief Write a one-dimensional dataset of known size in consecutive
+ *        batches of rows, so that the full array need not be in memory.
+ *
+ * Usage example:
+ * @code{.cpp}
+ * DatasetWriter<float> writer(file, "Mass", H5::PredType::NATIVE_FLOAT,
+ *     nrows, 65536, 4);
+ * while (...) {
+ *   std::vector<float> batch = ...;
+ *   writer.write(batch);
+ * }
+ * assert(writer.complete());
+ * @endcode
+ *
+ * @note Member functions do not lock. When several threads make HDF5 calls
+ *       at once, callers should hold an H5Lock, including during
+ *       construction and destruction.
+ */
+template <typename T>
+class DatasetWriter {
+public:
+  /** @brief Create the dataset.
+   * @param[in] file An open HDF5 file.
+   * @param[in] name Name of the new dataset.
+   * @param[in] datatype HDF5 datatype of the elements (same as in memory).
+   * @param[in] nrows Total number of rows that will be written.
+   * @param[in] chunk_rows Number of rows per chunk (zero for contiguous).
+   * @param[in] deflate_level Compression level (zero for no compression).
+   */
+  DatasetWriter(H5::H5File& file, const std::string& name,
+      const H5::DataType& datatype, const hsize_t nrows,
+      const hsize_t chunk_rows = 0, const int deflate_level = 0)
+      : dataset_(), datatype_(datatype), nrows_(nrows), offset_(0) {
+    hsize_t dims[1] = {nrows};
+    H5::DataSpace file_space(1, dims);
+    dataset_ = file.createDataSet(name, datatype, file_space,
+        chunked_layout(1, dims, chunk_rows, deflate_level));
+  }
+
+  /** @brief Write the next @a n rows.
+   * @pre Total number of rows written does not exceed @a nrows.
+   */
+  void write(const T* data, const hsize_t n) {
+    assert(offset_ + n <= nrows_);
+    if (n == 0)
+      return;
+    hsize_t count[1] = {n};
+    hsize_t offset[1] = {offset_};
+    H5::DataSpace mem_space(1, count);
+    H5::DataSpace file_space = dataset_.getSpace();
+    file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+    dataset_.write(data, datatype_, mem_space, file_space);
+    offset_ += n;
+  }
+
+  /** @brief Write the next @a rows.size() rows. */
+  void write(const std::vector<T>& rows) {
+    write(rows.data(), rows.size());
+  }
+
+  /** @brief Return true if all rows have been written. */
+  bool complete() const {
+    return offset_ == nrows_;
+  }
+
+private:
+  H5::DataSet dataset_;
+  H5::DataType datatype_;
+  hsize_t nrows_;
+  hsize_t offset_;
+};
+
 /** @brief Function to add a new one-dimensional array to an open HDF5 file.
  *
+ * @param[in] chunk_rows Number of rows per chunk (zero for contiguous).
+ *            Chunks of a few thousand rows, which hold the rows of one
+ *            or a few trees, let readers of a row range skip the rest.
+ * @param[in] deflate_level Compression level (zero for no compression).
+ *            Only used for chunked datasets.
  * @note Byte order is little-endian by default.
  */
 template <typename T>
 void add_array(H5::H5File& file, const std::vector<T>& array,
-    const std::string& array_name, H5::DataType datatype) {
+    const std::string& array_name, H5::DataType datatype,
+    const hsize_t chunk_rows = 0, const int deflate_level = 0) {
 
   // Only proceed if array is non-empty
   if (array.size() == 0)
@@ -243,7 +781,8 @@ void add_array(H5::H5File& file, const std::vector<T>& array,
   H5::DataSpace dataspace(1, dimsf);  // rank == 1
 
   // Create dataset
-  H5::DataSet dataset = file.createDataSet(array_name, datatype, dataspace);
+  H5::DataSet dataset = file.createDataSet(array_name, datatype, dataspace,
+      chunked_layout(1, dimsf, chunk_rows, deflate_level));
 
   // Write to dataset using default memory space
   dataset.write(array.data(), datatype, dataspace);
@@ -252,11 +791,15 @@ void add_array(H5::H5File& file, const std::vector<T>& array,
 /** @brief Function to add a new two-dimensional array to an open HDF5 file.
  * @tparam T Must be the FloatArray type defined in TreeTypes.hpp,
  *           or at least something that defines a size().
+ * @param[in] chunk_rows Number of rows per chunk (zero for contiguous).
+ * @param[in] deflate_level Compression level (zero for no compression).
+ *            Only used for chunked datasets.
  * @note Byte order is little-endian by default.
  */
 template <typename T>
 void add_array_2d(H5::H5File& file, const std::vector<T>& array,
-    const std::string& array_name, H5::DataType datatype) {
+    const std::string& array_name, H5::DataType datatype,
+    const hsize_t chunk_rows = 0, const int deflate_level = 0) {
 
   // Only proceed if array is non-empty
   if (array.size() == 0)
@@ -270,7 +813,8 @@ void add_array_2d(H5::H5File& file, const std::vector<T>& array,
   H5::DataSpace dataspace(2, dimsf);  // rank == 2
 
   // Create dataset
-  H5::DataSet dataset = file.createDataSet(array_name, datatype, dataspace);
+  H5::DataSet dataset = file.createDataSet(array_name, datatype, dataspace,
+      chunked_layout(2, dimsf, chunk_rows, deflate_level));
 
   // Write to dataset using default memory space
   dataset.write(array.data(), datatype, dataspace);
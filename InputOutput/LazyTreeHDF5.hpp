@@ -0,0 +1,208 @@
+#pragma once
+/** @file LazyTreeHDF5.hpp
+ * @brief Define a class for loading individual SubLink merger trees on
+ *        demand, without reading the full merger tree files.
+ *
+ * Subhalos are located through the offsets files (offsets/offsets_NNN.hdf5,
+ * see Python/compute_offsets.py), like in the TreeDB class from
+ * readtreeHDF5.py, and only the rows of the requested tree or subtree are
+ * read from the merger tree files.
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <map>
+#include <list>
+#include <tuple>
+#include <memory>
+
+#include "ReadTreeHDF5.hpp"
+#include "TreeOffsets.hpp"
+
+/** @class LazyTree
+ * @brief Load single trees or subtrees on demand, keeping the most
+ *        recently used ones in memory:
+ *
+ *     LazyTree lazy_tree(treedir, "tree_extended", {"SubhaloMassType"});
+ *     auto tree = lazy_tree.tree(135, subfind_id);
+ *     auto sub = tree->subhalo(135, subfind_id);
+ *
+ * Each tree is returned as a (partial) Tree object, which stays valid for
+ * as long as the caller holds the pointer, even after it is evicted.
+ *
+ * @note Not thread-safe.
+ */
+class LazyTree {
+public:
+  /** @brief Constructor.
+   * @param[in] treedir Directory containing the merger tree files and
+   *            the "offsets" directory.
+   * @param[in] name Suffix of the merger tree filenames, e.g., "tree_extended".
+   * @param[in] fields Names of extra fields to load for every tree.
+   * @param[in] max_memory Approximate memory limit (in bytes) for the
+   *            trees kept in memory.
+   */
+  LazyTree(const std::string& treedir, const std::string& name,
+      const std::vector<std::string>& fields = std::vector<std::string>(),
+      const uint64_t max_memory = 1024*1024*1024)
+      : treedir_(treedir), name_(name), fields_(fields),
+        max_memory_(max_memory), memory_(0), offsets_(treedir),
+        tree_files_(), trees_(), lru_() {
+  }
+
+  /** @brief Return the full merger tree containing the subhalo given by
+   *         @a snapnum and @a subfind_id, or nullptr if the subhalo is
+   *         not found in the merger trees.
+   */
+  std::shared_ptr<const Tree> tree(const snapnum_type snapnum,
+      const index_type subfind_id) {
+    auto loc = offsets_.locate(snapnum, subfind_id);
+    if (!loc.is_valid())
+      return nullptr;
+
+    // The first row of the tree is found SubhaloID - TreeID rows before
+    // this subhalo, and the tree ends where TreeID changes, which includes
+    // every root descendant of the tree (i.e., all its FoF-linked subtrees).
+    const H5::H5File& file = tree_file(loc.filenum);
+    auto tree_id = read_dataset_rows<tree_id_type>(
+        file, "TreeID", loc.row, 1)[0];
+    uint64_t row_start = loc.row - (loc.subhalo_id - tree_id);
+    return load(loc.filenum, row_start,
+        tree_end(file, loc.row, tree_id) - row_start);
+  }
+
+  /** @brief Return the subtree rooted at the subhalo given by @a snapnum
+   *         and @a subfind_id, i.e., the subhalo and all its progenitors,
+   *         or nullptr if the subhalo is not found in the merger trees.
+   */
+  std::shared_ptr<const Tree> subtree(const snapnum_type snapnum,
+      const index_type subfind_id) {
+    auto loc = offsets_.locate(snapnum, subfind_id);
+    if (!loc.is_valid())
+      return nullptr;
+    return load(loc.filenum, loc.row,
+        loc.last_progenitor_id - loc.subhalo_id + 1);
+  }
+
+  /** @brief Return the (approximate) memory used by the trees that are
+   *         currently kept, in bytes.
+   */
+  uint64_t memory_usage() const {
+    return memory_;
+  }
+
+  /** @brief Return the number of trees that are currently kept. */
+  std::size_t num_trees() const {
+    return trees_.size();
+  }
+
+private:
+  /** Identifies a set of rows: (filenum, row_start, nrows). */
+  typedef std::tuple<int, uint64_t, uint64_t> key_type;
+
+  /** A tree that is kept in memory. */
+  struct Entry {
+    std::shared_ptr<const Tree> tree;
+    // Position in lru_.
+    std::list<key_type>::iterator lru_it;
+  };
+
+  /** @brief Return the given rows as a Tree, reading them if necessary,
+   *         and evict the least recently used trees above the memory limit.
+   */
+  std::shared_ptr<const Tree> load(const int filenum, const uint64_t row_start,
+      const uint64_t nrows) {
+    key_type key(filenum, row_start, nrows);
+    auto it = trees_.find(key);
+    if (it != trees_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+      return it->second.tree;
+    }
+
+    std::shared_ptr<const Tree> tree(
+        new Tree(treedir_, name_, filenum, row_start, nrows, fields_));
+    lru_.push_front(key);
+    Entry entry = {tree, lru_.begin()};
+    trees_[key] = entry;
+    memory_ += tree->memory_size();
+
+    // Always keep the tree that was just loaded.
+    while ((memory_ > max_memory_) && (lru_.size() > 1)) {
+      auto& evicted = trees_.at(lru_.back());
+      memory_ -= evicted.tree->memory_size();
+      trees_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    return tree;
+  }
+
+  /** @brief Return one past the last row of the tree @a tree_id, which
+   *         contains @a row. TreeIDs increase along each merger tree file,
+   *         so the end is found by exponential and then binary search,
+   *         reading a single TreeID at a time.
+   */
+  static uint64_t tree_end(const H5::H5File& file, const uint64_t row,
+      const tree_id_type tree_id) {
+    const uint64_t nrows =
+        file.openDataSet("TreeID").getSpace().getSimpleExtentNpoints();
+    auto same_tree = [&](const uint64_t r) {
+      return read_dataset_rows<tree_id_type>(file, "TreeID", r, 1)[0] ==
+          tree_id;
+    };
+    // Invariant: row lo belongs to the tree, and row hi does not
+    // (or is the end of the file).
+    uint64_t lo = row;
+    uint64_t step = 1;
+    uint64_t hi = row + step;
+    while ((hi < nrows) && same_tree(hi)) {
+      lo = hi;
+      step *= 2;
+      hi = lo + step;
+    }
+    if (hi > nrows)
+      hi = nrows;
+    while (hi - lo > 1) {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (same_tree(mid))
+        lo = mid;
+      else
+        hi = mid;
+    }
+    return hi;
+  }
+
+  /** @brief Return merger tree file number @a filenum, opening it
+   *         if necessary.
+   */
+  const H5::H5File& tree_file(const int filenum) {
+    auto it = tree_files_.find(filenum);
+    if (it != tree_files_.end())
+      return it->second;
+    std::stringstream tmp_stream;
+    tmp_stream << treedir_ << "/" << name_ << "." << filenum << ".hdf5";
+    return tree_files_[filenum] = H5::H5File(tmp_stream.str(), H5F_ACC_RDONLY);
+  }
+
+  /** Directory containing the merger tree files. */
+  std::string treedir_;
+  /** Suffix of the merger tree filenames. */
+  std::string name_;
+  /** Extra fields to load. */
+  std::vector<std::string> fields_;
+  /** Approximate memory limit, in bytes. */
+  uint64_t max_memory_;
+  /** Memory used by the trees in trees_, in bytes. */
+  uint64_t memory_;
+  /** Locates subhalos in the merger tree files. */
+  TreeOffsets offsets_;
+  /** Merger tree files, opened on demand. */
+  std::map<int, H5::H5File> tree_files_;
+  /** Trees kept in memory. */
+  std::map<key_type, Entry> trees_;
+  /** Keys of trees_, from most to least recently used. */
+  std::list<key_type> lru_;
+};
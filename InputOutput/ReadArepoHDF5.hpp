@@ -24,6 +24,40 @@
  * }
  * @endcode
  *
+ * Usage example 3: read several blocks from the same snapshot, opening
+ * each snapshot file only once
+ * @code{.cpp}
+ * arepo::SnapshotReader reader(basedir, snapnum);
+ * auto ids = reader.read_block<uint64_t>("ParticleIDs", parttype);
+ * auto masses = reader.read_block<float>("Masses", parttype);
+ * @endcode
+ *
+ * Usage example 4: read the IDs and masses of star-forming gas cells in
+ * a single pass over the snapshot files
+ * @code{.cpp}
+ * std::vector<uint64_t> ids;
+ * std::vector<float> masses, sfr;
+ * arepo::SnapshotReader reader(basedir, snapnum);
+ * reader.add("ParticleIDs", &ids);
+ * reader.add("Masses", &masses);
+ * reader.add("StarFormationRate", &sfr);
+ * reader.read_if(0, [&sfr](uint64_t i) { return sfr[i] > 0; });
+ * @endcode
+ *
+ * Usage example 5: add up the masses of all DM particles, a few million
+ * at a time
+ * @code{.cpp}
+ * std::vector<float> masses;
+ * arepo::SnapshotReader reader(basedir, snapnum);
+ * arepo::BlockStream stream(reader, 1);
+ * stream.add("Masses", &masses);
+ * double total_mass = 0;
+ * while (uint64_t nrows = stream.next()) {
+ *   for (uint64_t i = 0; i < nrows; ++i)
+ *     total_mass += masses[i];
+ * }
+ * @endcode
+ *
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
  */
 
@@ -32,9 +66,17 @@
 #include <string>
 #include <sstream>
 #include <iomanip>  // setfill, setw, setprecision
+#include <algorithm>  // min, max, sort, upper_bound
+#include <functional>
+#include <utility>  // pair
+#include <limits>
+#include <cstring>  // memcpy
+#include <future>  // async
+#include <memory>  // shared_ptr
 #include <cassert>
 
 #include "H5Cpp_wrapper.hpp"
+#include "GeneralHDF5.hpp"  // H5Lock, pread_bytes
 #include "../Util/TreeTypes.hpp"
 
 /** @namespace arepo
@@ -42,19 +84,18 @@
  */
 namespace arepo {
 
-/** @brief Function to read a scalar attribute from the snapshot header.
+/** @brief Function to read a scalar attribute from the header of an
+ *         open snapshot file.
  *
  * @tparam T Type of the attribute.
- * @param[in] file_name Path to the input file.
+ * @param[in] file The input file.
  * @param[in] attr_name Name of the attribute.
  * @return The attribute value.
  */
 template <typename T>
-T get_scalar_attribute(const std::string& file_name,
-    const std::string& attr_name) {
+T get_scalar_attribute(const H5::H5File& file, const std::string& attr_name) {
 
   // Open attribute from snapshot header
-  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
   auto header_group = H5::Group(file.openGroup("Header"));
   auto myattr = H5::Attribute(header_group.openAttribute(attr_name));
 
@@ -66,23 +107,37 @@ T get_scalar_attribute(const std::string& file_name,
   T retval;
   myattr.read(myattr.getDataType(), &retval);
 
-  file.close();
+  return retval;
+}
 
+/** @brief Function to read a scalar attribute from the snapshot header.
+ *
+ * @tparam T Type of the attribute.
+ * @param[in] file_name Path to the input file.
+ * @param[in] attr_name Name of the attribute.
+ * @return The attribute value.
+ */
+template <typename T>
+T get_scalar_attribute(const std::string& file_name,
+    const std::string& attr_name) {
+  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
+  T retval = get_scalar_attribute<T>(file, attr_name);
+  file.close();
   return retval;
 }
 
-/** @brief Function to read an attribute array from the snapshot header.
+/** @brief Function to read an attribute array from the header of an
+ *         open snapshot file.
  *
  * @tparam T Type of the elements of the attribute array.
- * @param[in] file_name Path to the input file.
+ * @param[in] file The input file.
  * @param[in] attr_name Name of the attribute array.
  * @return A vector with the attribute array values.
  */
 template <typename T>
-std::vector<T> get_vector_attribute(const std::string& file_name,
+std::vector<T> get_vector_attribute(const H5::H5File& file,
     const std::string& attr_name) {
   // Open attribute from snapshot header
-  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
   auto header_group = H5::Group(file.openGroup("Header"));
   auto myattr = H5::Attribute(header_group.openAttribute(attr_name));
 
@@ -99,71 +154,30 @@ std::vector<T> get_vector_attribute(const std::string& file_name,
   std::vector<T> retval(attr_len);
   myattr.read(myattr.getDataType(), retval.data());
 
-  file.close();
-
   return retval;
 }
 
-/** @brief Get the datatype size of a given dataset (a.k.a. block).
- * @param[in] basedir Directory containing the snapshot files.
- * @param[in] snapnum Snapshot number.
- * @param[in] block_name Name of the dataset.
- * @param[in] parttype The particle type.
+/** @brief Function to read an attribute array from the snapshot header.
  *
- * @return The datatype size of the dataset.
+ * @tparam T Type of the elements of the attribute array.
+ * @param[in] file_name Path to the input file.
+ * @param[in] attr_name Name of the attribute array.
+ * @return A vector with the attribute array values.
  */
-std::size_t get_datatype_size(const std::string& basedir,
-    const int16_t snapnum, const std::string& block_name,
-    const int parttype) {
-
-  // Group name corresponding to particle type.
-  std::stringstream ss;
-  ss << "/PartType" << parttype;
-  std::string parttype_str = ss.str();
-
-  // Snapshot filename without the file number
-  ss.str("");
-  ss << basedir << "/snapdir_" <<
-      std::setfill('0') << std::setw(3) << snapnum << "/snap_" <<
-      std::setfill('0') << std::setw(3) << snapnum;
-  std::string file_name_base = ss.str();
-
-  // Name of first file (just to read header)
-  ss.str("");
-  ss << file_name_base << ".0.hdf5";
-  std::string file_name = ss.str();
-
-  // Iterate over files until we find one that contains the specified dataset.
-  auto nfiles = get_scalar_attribute<int32_t>(file_name, "NumFilesPerSnapshot");
-  for (int32_t filenum=0; filenum < nfiles; filenum++) {
-    // Open current file
-    ss.str("");
-    ss << file_name_base << "." << filenum << ".hdf5";
-    file_name = ss.str();
-    auto file = H5::H5File(file_name, H5F_ACC_RDONLY);
-    // Only proceed if group exists.
-    if (!H5Lexists(file.getId(), parttype_str.data(), H5P_DEFAULT)) {
-      file.close();
-      continue;
-    }
-    // Return datatype size.
-    auto group = H5::Group(file.openGroup(parttype_str));
-    auto dataset = H5::DataSet(group.openDataSet("Coordinates"));
-    auto dt = dataset.getDataType();
-    file.close();
-    return dt.getSize();
-  }
-  std::cerr << "ERROR: " << parttype_str << "/" << block_name << " not found!\n";
-  assert(false);
-  return 0;
+template <typename T>
+std::vector<T> get_vector_attribute(const std::string& file_name,
+    const std::string& attr_name) {
+  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
+  auto retval = get_vector_attribute<T>(file, attr_name);
+  file.close();
+  return retval;
 }
 
-
 /** @brief Function to read a dataset (a.k.a. block)
- * from a single file.
+ * from a single (open) file.
  *
  * @tparam T Type of the elements in the dataset.
- * @param[in] file_name Path to the input file.
+ * @param[in] file The input file.
  * @param[in] block_name Name of the dataset.
  * @param[in] parttype The particle type.
  * @param[in] read_num If nonzero, read -at most- this many elements.
@@ -174,7 +188,7 @@ std::size_t get_datatype_size(const std::string& basedir,
  *       output vector equals the size of the first dimension of the dataset.
  */
 template <typename T>
-std::vector<T> read_block_single_file(const std::string& file_name,
+std::vector<T> read_block_single_file(const H5::H5File& file,
     const std::string& block_name, const int parttype, const uint64_t read_num = 0) {
 
   // Create group name corresponding to particle type.
@@ -182,16 +196,11 @@ std::vector<T> read_block_single_file(const std::string& file_name,
   ss << "/PartType" << parttype;
   std::string parttype_str = ss.str();
 
-  // Only proceed if group exists (have a peek at the file).
-  auto tmp_file = H5::H5File(file_name, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (H5Lexists(tmp_file.getId(), parttype_str.data(), H5P_DEFAULT) == false) {
-    tmp_file.close();
+  // Only proceed if group exists.
+  if (H5Lexists(file.getId(), parttype_str.data(), H5P_DEFAULT) == false)
     return std::vector<T>();
-  }
-  tmp_file.close();
 
   // Open the specified dataset.
-  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
   auto group = H5::Group(file.openGroup(parttype_str));
   auto dataset = H5::DataSet(group.openDataSet(block_name));
 
@@ -210,14 +219,26 @@ std::vector<T> read_block_single_file(const std::string& file_name,
     file_space.selectHyperslab( H5S_SELECT_SET, count, offset );
   }
 
-  // Check that datatype sizes match (necessary but not sufficient)
+  // Check that datatypes match. Rows of a known native type can be
+  // converted by HDF5; otherwise, only the sizes can be compared
+  // (necessary but not sufficient).
   auto dt = dataset.getDataType();
-  std::size_t row_size = dt.getSize();
+  std::size_t file_count = 1;
   for (unsigned int k = 1; k < file_rank; ++k)
-    row_size = row_size * file_dims[k];
-  if (row_size != sizeof(T)) {
-    std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
-        " vs " << sizeof(T) << ") when reading " << block_name << ".\n";
+    file_count = file_count * file_dims[k];
+  if (NativeType<T>::type() != nullptr) {
+    if (!native_type_matches(dt, file_count, *NativeType<T>::type(),
+        NativeType<T>::count)) {
+      std::cerr << "ERROR: mismatched datatypes when reading " <<
+          block_name << ".\n";
+      assert(false);
+    }
+    dt = *NativeType<T>::type();
+  }
+  else if (dt.getSize() * file_count != sizeof(T)) {
+    std::cerr << "ERROR: mismatched datatype sizes (" <<
+        dt.getSize() * file_count << " vs " << sizeof(T) <<
+        ") when reading " << block_name << ".\n";
     assert(false);
   }
 
@@ -229,92 +250,823 @@ std::vector<T> read_block_single_file(const std::string& file_name,
 
   // Read data
   std::vector<T> retval(mem_dims[0]);  // Output vector is 1D.
-  dataset.read(retval.data(), dataset.getDataType(), mem_space, file_space);
+  dataset.read(retval.data(), dt, mem_space, file_space);
 
-  file.close();
+  return retval;
+}
 
+/** @brief Function to read a dataset (a.k.a. block)
+ * from a single file.
+ *
+ * @tparam T Type of the elements in the dataset.
+ * @param[in] file_name Path to the input file.
+ * @param[in] block_name Name of the dataset.
+ * @param[in] parttype The particle type.
+ * @param[in] read_num If nonzero, read -at most- this many elements.
+ * @return A vector with the dataset values.
+ */
+template <typename T>
+std::vector<T> read_block_single_file(const std::string& file_name,
+    const std::string& block_name, const int parttype, const uint64_t read_num = 0) {
+  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
+  auto retval = read_block_single_file<T>(file, block_name, parttype, read_num);
+  file.close();
   return retval;
 }
 
-/** @brief Function to read a dataset (a.k.a. block) from the snapshot files.
+/** @class SnapshotReader
+ * @brief Read several blocks from the same snapshot, opening each
+ *        snapshot file only once:
  *
- * @tparam T Type of the elements in the datasets.
+ *     arepo::SnapshotReader reader(basedir, snapnum);
+ *     auto ids = reader.read_block<uint64_t>("ParticleIDs", 4);
+ *     auto masses = reader.read_block<float>("Masses", 4);
+ *
+ * The files are opened by the constructor, which also caches the
+ * particle counts from their headers, and stay open for as long as the
+ * SnapshotReader exists. Several blocks can also be read together, in a
+ * single pass over the files, optionally keeping only some rows:
+ *
+ *     reader.add("ParticleIDs", &ids);
+ *     reader.add("Masses", &masses);
+ *     reader.read(4);
+ */
+class SnapshotReader {
+public:
+  /** @brief Constructor.
+   * @param[in] basedir Directory containing the snapshot files.
+   * @param[in] snapnum Snapshot number.
+   */
+  SnapshotReader(const std::string& basedir, const int16_t snapnum)
+      : file_name_base_(), files_(), npart_total_(), npart_this_file_(),
+        blocks_() {
+    // Snapshot filename without the file number
+    std::stringstream tmp_stream;
+    tmp_stream << basedir << "/snapdir_" <<
+        std::setfill('0') << std::setw(3) << snapnum << "/snap_" <<
+        std::setfill('0') << std::setw(3) << snapnum;
+    file_name_base_ = tmp_stream.str();
+
+    // Get total number of particles from the first file
+    files_.push_back(H5::H5File(file_name(0), H5F_ACC_RDONLY));
+    auto npart_total_vect_lowword = get_vector_attribute<uint32_t>(files_[0],
+        "NumPart_Total");
+    auto npart_total_vect_highword = get_vector_attribute<uint32_t>(files_[0],
+        "NumPart_Total_HighWord");
+    for (std::size_t k = 0; k < npart_total_vect_lowword.size(); ++k) {
+      npart_total_.push_back((part_id_type)npart_total_vect_lowword[k] |
+          ((part_id_type)npart_total_vect_highword[k] << 32));
+    }
+
+    // Open the other files, and get the number of particles in each one
+    auto nfiles = arepo::get_scalar_attribute<int32_t>(files_[0],
+        "NumFilesPerSnapshot");
+    for (int32_t filenum = 1; filenum < nfiles; ++filenum)
+      files_.push_back(H5::H5File(file_name(filenum), H5F_ACC_RDONLY));
+    for (int32_t filenum = 0; filenum < nfiles; ++filenum) {
+      npart_this_file_.push_back(get_vector_attribute<int32_t>(
+          files_[filenum], "NumPart_ThisFile"));
+    }
+  }
+
+  /** Return the number of files per snapshot. */
+  int32_t num_files() const {
+    return files_.size();
+  }
+
+  /** Return the total number of particles of type @a parttype. */
+  part_id_type num_part_total(const int parttype) const {
+    return npart_total_[parttype];
+  }
+
+  /** Return the number of particles of type @a parttype in file @a filenum. */
+  part_id_type num_part_this_file(const int32_t filenum,
+      const int parttype) const {
+    return npart_this_file_[filenum][parttype];
+  }
+
+  /** @brief Return a scalar attribute from the snapshot header.
+   * @tparam T Type of the attribute.
+   */
+  template <typename T>
+  T get_scalar_attribute(const std::string& attr_name) const {
+    return arepo::get_scalar_attribute<T>(files_[0], attr_name);
+  }
+
+  /** @brief Get the datatype size of a given dataset (a.k.a. block).
+   * @param[in] block_name Name of the dataset.
+   * @param[in] parttype The particle type.
+   *
+   * @return The datatype size of the dataset.
+   */
+  std::size_t get_datatype_size(const std::string& block_name,
+      const int parttype) const {
+
+    // Group name corresponding to particle type.
+    std::stringstream ss;
+    ss << "/PartType" << parttype;
+    std::string parttype_str = ss.str();
+
+    // Iterate over files until we find one that contains the specified dataset.
+    for (int32_t filenum = 0; filenum < num_files(); ++filenum) {
+      // Only proceed if group exists.
+      if (!H5Lexists(files_[filenum].getId(), parttype_str.data(), H5P_DEFAULT))
+        continue;
+      // Return datatype size.
+      auto group = H5::Group(files_[filenum].openGroup(parttype_str));
+      auto dataset = H5::DataSet(group.openDataSet(block_name));
+      auto dt = dataset.getDataType();
+      return dt.getSize();
+    }
+    std::cerr << "ERROR: " << parttype_str << "/" << block_name << " not found!\n";
+    assert(false);
+    return 0;
+  }
+
+  /** @brief Read a dataset (a.k.a. block) from the snapshot files.
+   *
+   * @tparam T Type of the elements in the datasets.
+   * @param[in] block_name Name of the dataset.
+   * @param[in] parttype The particle type.
+   * @param[in] read_num If nonzero, only read this many total elements
+   *            (i.e., rows).
+   * @return A vector with the dataset values.
+   *
+   * The number of particles in each file is known from the headers, so
+   * each file is read directly into its slice of the output vector, and
+   * files are read concurrently (with OpenMP). Contiguous, uncompressed
+   * datasets (the usual layout of snapshot files) are read with pread
+   * at their offset in the file, bypassing the HDF5 library, which
+   * serializes concurrent calls. Other datasets are read through HDF5.
+   *
+   * @note The return value is a vector (with an appropriately chosen type).
+   *       When reading from a dataset with ndims > 1, the size() of the
+   *       output vector equals the size of the first dimension of the
+   *       (concatenated) dataset.
+   */
+  template <typename T>
+  std::vector<T> read_block(const std::string& block_name, const int parttype,
+      const uint64_t read_num = 0) const {
+    std::vector<T> data_total;
+    std::vector<Block> blocks(1, make_block(block_name, &data_total));
+    read_blocks(blocks, parttype, read_num, nullptr, nullptr);
+    return data_total;
+  }
+
+  /** @brief Read dataset @a block_name into @a dest with the next call
+   *         to read() or read_if(). The size of @a T must equal the size
+   *         of one row of the dataset.
+   */
+  template <typename T>
+  void add(const std::string& block_name, std::vector<T>* dest) {
+    blocks_.push_back(make_block(block_name, dest));
+  }
+
+  /** @brief Read all datasets added so far for particle type @a parttype,
+   *         going through the snapshot files only once.
+   *
+   * Like read_block(), but all datasets of each file are read together.
+   * The list of datasets is cleared afterwards.
+   *
+   * @param[in] parttype The particle type.
+   * @param[in] read_num If nonzero, only read this many total rows.
+   * @return The number of rows of each (concatenated) dataset.
+   */
+  uint64_t read(const int parttype, const uint64_t read_num = 0) {
+    return read_if(parttype, nullptr, nullptr, read_num);
+  }
+
+  /** @brief Like read(), but only keep the rows for which @a keep is true.
+   *
+   * @a keep is called with the index of each row in the full (unfiltered)
+   * datasets, once all datasets have been read for that row, so it can
+   * look up values in the destination vectors, e.g.:
+   *
+   *     reader.add("ParticleIDs", &ids);
+   *     reader.add("StarFormationRate", &sfr);
+   *     reader.read_if(0, [&sfr](uint64_t i) { return sfr[i] > 0; }, &rows);
+   *
+   * It may be called concurrently from several threads.
+   *
+   * @param[in] parttype The particle type.
+   * @param[in] keep Row predicate.
+   * @param[out] rows If not null, the indices of the rows that were kept.
+   * @param[in] read_num If nonzero, only consider this many total rows.
+   * @return The number of rows that were kept.
+   */
+  uint64_t read_if(const int parttype,
+      const std::function<bool(const uint64_t)>& keep,
+      std::vector<part_id_type>* rows = nullptr, const uint64_t read_num = 0) {
+    std::vector<Block> blocks;
+    blocks.swap(blocks_);
+    return read_blocks(blocks, parttype, read_num, keep, rows);
+  }
+
+  /** @brief Read only some ranges of rows of a dataset (a.k.a. block),
+   *         e.g., the particles of a few subhalos.
+   *
+   * The ranges are sorted and merged, and the rows of each file are read
+   * with a single hyperslab selection (the union of the ranges that
+   * overlap the file), so that files without any selected rows are not
+   * read at all, and chunked datasets only decompress the chunks needed.
+   *
+   * @tparam T Type of the elements in the datasets.
+   * @param[in] block_name Name of the dataset.
+   * @param[in] parttype The particle type.
+   * @param[in] ranges (First row, number of rows) of each range, counting
+   *            rows across all the snapshot files.
+   * @return The rows of every range, concatenated in the order of
+   *         @a ranges (overlapping ranges are copied as many times).
+   */
+  template <typename T>
+  std::vector<T> read_rows(const std::string& block_name, const int parttype,
+      const std::vector<std::pair<uint64_t, uint64_t>>& ranges) const {
+
+    // Sort ranges and merge those that overlap or touch.
+    std::vector<std::pair<uint64_t, uint64_t>> sorted;
+    for (auto& range : ranges) {
+      if (range.second > 0)
+        sorted.push_back(range);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<std::pair<uint64_t, uint64_t>> merged;  // (first, last+1)
+    for (auto& range : sorted) {
+      uint64_t first = range.first, end = range.first + range.second;
+      if (!merged.empty() && (first <= merged.back().second))
+        merged.back().second = std::max(merged.back().second, end);
+      else
+        merged.emplace_back(first, end);
+    }
+    if ((!merged.empty()) && (merged.back().second > num_part_total(parttype))) {
+      std::cerr << "ERROR: rows out of range when reading " << block_name <<
+          ".\n";
+      assert(false);
+    }
+
+    // Read the merged ranges, one after the other, file by file.
+    const Block block = make_block(block_name, static_cast<std::vector<T>*>(
+        nullptr));
+    std::vector<T> data_merged;
+    std::size_t k = 0;  // first merged range that has not been fully read
+    part_id_type file_offset = 0;
+    for (int32_t filenum = 0; filenum < num_files(); ++filenum) {
+      const part_id_type file_end = file_offset +
+          num_part_this_file(filenum, parttype);
+
+      // Select the parts of the merged ranges within this file.
+      hsize_t nrows = 0;
+      H5::DataSpace file_space;
+      H5::DataSet dataset;
+      for ( ; k < merged.size(); ++k) {
+        uint64_t first = std::max<uint64_t>(merged[k].first, file_offset);
+        uint64_t end = std::min<uint64_t>(merged[k].second, file_end);
+        if (first < end) {
+          if (nrows == 0) {
+            dataset = open_dataset(filenum, block, parttype);
+            file_space = dataset.getSpace();
+          }
+          const unsigned int file_rank = file_space.getSimpleExtentNdims();
+          hsize_t count[file_rank];
+          hsize_t offset[file_rank];
+          file_space.getSimpleExtentDims(count, NULL);
+          for (unsigned int l = 0; l < file_rank; ++l)
+            offset[l] = 0;
+          offset[0] = first - file_offset;
+          count[0] = end - first;
+          file_space.selectHyperslab((nrows == 0) ? H5S_SELECT_SET :
+              H5S_SELECT_OR, count, offset);
+          nrows += end - first;
+        }
+        // Continue with the next file if this range extends beyond it.
+        if (merged[k].second > file_end)
+          break;
+      }
+
+      // Read the selected rows, which are stored in the same order.
+      if (nrows > 0) {
+        const unsigned int file_rank = file_space.getSimpleExtentNdims();
+        hsize_t mem_dims[file_rank];
+        file_space.getSimpleExtentDims(mem_dims, NULL);
+        mem_dims[0] = nrows;
+        H5::DataSpace mem_space(file_rank, mem_dims);
+        std::size_t pos = data_merged.size();
+        data_merged.resize(pos + nrows);
+        dataset.read(&data_merged[pos], mem_type(block, dataset), mem_space,
+            file_space);
+      }
+      file_offset = file_end;
+      if (k == merged.size())
+        break;
+    }
+
+    // A single range needs no copying.
+    if ((ranges.size() == 1) && (sorted.size() == 1))
+      return data_merged;
+
+    // Copy each range, in the original order.
+    std::vector<uint64_t> merged_pos(merged.size(), 0);
+    for (std::size_t j = 1; j < merged.size(); ++j)
+      merged_pos[j] = merged_pos[j-1] + merged[j-1].second - merged[j-1].first;
+    std::vector<T> retval;
+    retval.reserve(data_merged.size());
+    for (auto& range : ranges) {
+      if (range.second == 0)
+        continue;
+      // Last merged range that starts at or before this one.
+      std::size_t j = std::upper_bound(merged.begin(), merged.end(),
+          std::make_pair(range.first, std::numeric_limits<uint64_t>::max())) -
+          merged.begin() - 1;
+      auto it = data_merged.begin() + merged_pos[j] +
+          (range.first - merged[j].first);
+      retval.insert(retval.end(), it, it + range.second);
+    }
+    return retval;
+  }
+
+private:
+  /** @brief A dataset to be read. */
+  struct Block {
+    // Name of the dataset.
+    std::string name;
+    // Size of one row in memory.
+    std::size_t row_size;
+    // Native datatype of the elements of each row in memory, and their
+    // number, or nullptr if unknown (then rows are read as they are
+    // stored in the file).
+    const H5::PredType* elem_type;
+    std::size_t elem_count;
+    // Resize the destination for a given number of rows, and return a
+    // pointer to its first element.
+    std::function<char*(const uint64_t)> allocate;
+  };
+
+  /** @brief Return a Block that reads dataset @a block_name into @a dest. */
+  template <typename T>
+  static Block make_block(const std::string& block_name, std::vector<T>* dest) {
+    Block block;
+    block.name = block_name;
+    block.row_size = sizeof(T);
+    block.elem_type = NativeType<T>::type();
+    block.elem_count = NativeType<T>::count;
+    block.allocate = [dest](const uint64_t nrows) -> char* {
+      dest->resize(nrows);
+      return reinterpret_cast<char*>(dest->data());
+    };
+    return block;
+  }
+
+  /** @brief Read @a blocks (see read_block and read_if).
+   * @return The number of rows that were kept.
+   */
+  uint64_t read_blocks(const std::vector<Block>& blocks, const int parttype,
+      const uint64_t read_num, const std::function<bool(const uint64_t)>& keep,
+      std::vector<part_id_type>* rows) const {
+
+    // Get total number of particles (or modify to selective global read)
+    part_id_type npart_total = num_part_total(parttype);
+    if (read_num > 0)
+      npart_total = read_num;
+
+    // Number of particles to read from each file (according to the file
+    // headers), and their offsets in the output vectors.
+    const int32_t nfiles = num_files();
+    const std::size_t nblocks = blocks.size();
+    std::vector<part_id_type> file_nrows(nfiles, 0);
+    std::vector<part_id_type> file_offsets(nfiles, 0);
+    part_id_type nrows = 0;
+    for (int32_t filenum = 0; filenum < nfiles; ++filenum) {
+      file_offsets[filenum] = nrows;
+      file_nrows[filenum] = std::min(num_part_this_file(filenum, parttype),
+          npart_total - nrows);
+      nrows += file_nrows[filenum];
+    }
+
+    // Check total number of particles with header.
+    if (nrows != npart_total)
+      std::cerr << "BAD: total number of particles does not match with header ["
+                << nrows << " vs " << npart_total << "].\n";
+
+    // Open datasets and check them against the headers. Also find out
+    // where the data are stored, if contiguous and uncompressed, and
+    // whether they must be converted to a different datatype.
+    std::vector<std::vector<H5::DataSet>> datasets(nfiles);
+    std::vector<std::vector<H5::DataType>> file_types(nfiles);
+    std::vector<std::vector<haddr_t>> addresses(nfiles);
+    std::vector<int> fds(nfiles, -1);
+    // Whether block k of file filenum must be converted (at index
+    // filenum*nblocks + k), and the size of one row in the file, so that
+    // the parallel loop below makes no HDF5 calls outside of H5Lock.
+    std::vector<char> convert(nfiles * nblocks, 0);
+    std::vector<std::size_t> file_row_sizes(nfiles * nblocks, 0);
+    for (int32_t filenum = 0; filenum < nfiles; ++filenum) {
+      if (file_nrows[filenum] == 0)
+        continue;
+      fds[filenum] = h5_file_descriptor(files_[filenum]);
+      for (std::size_t k = 0; k < nblocks; ++k) {
+        datasets[filenum].push_back(open_dataset(filenum, blocks[k],
+            parttype));
+        file_types[filenum].push_back(datasets[filenum][k].getDataType());
+        addresses[filenum].push_back((fds[filenum] != -1) ?
+            h5_raw_data_address(datasets[filenum][k]) : HADDR_UNDEF);
+        const H5::DataType& file_type = file_types[filenum][k];
+        convert[filenum*nblocks + k] = (blocks[k].elem_type != nullptr) &&
+            !(file_type == *blocks[k].elem_type);
+        file_row_sizes[filenum*nblocks + k] =
+            file_type.getSize() * blocks[k].elem_count;
+      }
+    }
+
+    // Allocate output.
+    std::vector<char*> dests(nblocks);
+    for (std::size_t k = 0; k < nblocks; ++k)
+      dests[k] = blocks[k].allocate(nrows);
+
+    // Read each file directly into its slice of the output vectors, in
+    // parallel. Contiguous datasets are copied byte by byte with pread,
+    // which does not hold the global lock of the HDF5 library, and then
+    // converted to the datatype in memory if needed, a few rows at a
+    // time. Rows are tested as soon as all datasets of their file have
+    // been read.
+    std::vector<char> keep_row(keep ? nrows : 0, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int32_t filenum = 0; filenum < nfiles; ++filenum) {
+      if (file_nrows[filenum] == 0)
+        continue;
+      for (std::size_t k = 0; k < nblocks; ++k) {
+        char* dest = dests[k] + file_offsets[filenum] * blocks[k].row_size;
+        if (addresses[filenum][k] != HADDR_UNDEF) {
+          if (!convert[filenum*nblocks + k])
+            pread_bytes(fds[filenum], dest,
+                file_nrows[filenum] * blocks[k].row_size, addresses[filenum][k]);
+          else
+            read_bytes_converted(fds[filenum], dest, file_nrows[filenum],
+                addresses[filenum][k], file_types[filenum][k],
+                file_row_sizes[filenum*nblocks + k], blocks[k]);
+          continue;
+        }
+        H5Lock lock;
+        const H5::DataSet& dataset = datasets[filenum][k];
+        H5::DataSpace file_space = dataset.getSpace();
+        const unsigned int file_rank = file_space.getSimpleExtentNdims();
+        hsize_t count[file_rank];
+        hsize_t offset[file_rank];
+        file_space.getSimpleExtentDims(count, NULL);
+        for (unsigned int l = 0; l < file_rank; ++l)
+          offset[l] = 0;
+        count[0] = file_nrows[filenum];
+        file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+        H5::DataSpace mem_space(file_rank, count);
+        dataset.read(dest, mem_type(blocks[k], dataset), mem_space,
+            file_space);
+      }
+      if (keep) {
+        for (part_id_type i = file_offsets[filenum];
+            i < file_offsets[filenum] + file_nrows[filenum]; ++i)
+          keep_row[i] = keep(i);
+      }
+    }
+    if (!keep)
+      return nrows;
+
+    // Move the rows that are kept to the front, in order.
+    std::vector<part_id_type> kept_rows;
+    for (part_id_type i = 0; i < nrows; ++i) {
+      if (keep_row[i])
+        kept_rows.push_back(i);
+    }
+    for (std::size_t k = 0; k < nblocks; ++k) {
+      const std::size_t row_size = blocks[k].row_size;
+      for (std::size_t j = 0; j < kept_rows.size(); ++j) {
+        if (kept_rows[j] != j)
+          std::memcpy(dests[k] + j*row_size, dests[k] + kept_rows[j]*row_size,
+              row_size);
+      }
+      blocks[k].allocate(kept_rows.size());
+    }
+    const uint64_t nkept = kept_rows.size();
+    if (rows != nullptr)
+      rows->swap(kept_rows);
+    return nkept;
+  }
+  /** @brief Open the dataset of @a block for particle type @a parttype
+   *         from file @a filenum, checking its number of rows against the
+   *         file header and its datatype against that of @a block.
+   */
+  H5::DataSet open_dataset(const int32_t filenum, const Block& block,
+      const int parttype) const {
+    const std::string& block_name = block.name;
+    std::stringstream ss;
+    ss << "/PartType" << parttype;
+    auto group = H5::Group(files_[filenum].openGroup(ss.str()));
+    auto dataset = H5::DataSet(group.openDataSet(block_name));
+
+    // Get dimensions of the dataset
+    H5::DataSpace file_space = dataset.getSpace();
+    const unsigned int file_rank = file_space.getSimpleExtentNdims();
+    hsize_t file_dims[file_rank];
+    file_space.getSimpleExtentDims(file_dims, NULL);
+
+    // Check number of particles with file header.
+    if (file_dims[0] != num_part_this_file(filenum, parttype)) {
+      std::cerr << "ERROR: number of particles in file " << filenum <<
+          " does not match with header.\n";
+      assert(false);
+    }
+
+    // Check that datatypes match. Rows of a known native type can be
+    // converted by HDF5; otherwise, only the sizes can be compared
+    // (necessary but not sufficient).
+    auto file_type = dataset.getDataType();
+    std::size_t file_count = 1;
+    for (unsigned int k = 1; k < file_rank; ++k)
+      file_count = file_count * file_dims[k];
+    if (block.elem_type != nullptr) {
+      if (!native_type_matches(file_type, file_count, *block.elem_type,
+          block.elem_count)) {
+        std::cerr << "ERROR: mismatched datatypes when reading " <<
+            block_name << ".\n";
+        assert(false);
+      }
+    }
+    else if (file_type.getSize() * file_count != block.row_size) {
+      std::cerr << "ERROR: mismatched datatype sizes (" <<
+          file_type.getSize() * file_count << " vs " << block.row_size <<
+          ") when reading " << block_name << ".\n";
+      assert(false);
+    }
+    return dataset;
+  }
+
+  /** @brief Return the datatype in which to read the elements of
+   *         @a block from @a dataset.
+   */
+  static H5::DataType mem_type(const Block& block, const H5::DataSet& dataset) {
+    if (block.elem_type == nullptr)
+      return dataset.getDataType();
+    return *block.elem_type;
+  }
+
+  /** @brief Read @a nrows rows of datatype @a file_type at position
+   *         @a offset of file descriptor @a fd, each @a file_row_size
+   *         bytes long, and convert them into rows of @a block at @a dest,
+   *         going through a buffer of bounded size.
+   */
+  static void read_bytes_converted(const int fd, char* dest,
+      const uint64_t nrows, uint64_t offset, const H5::DataType& file_type,
+      const std::size_t file_row_size, const Block& block) {
+    const std::size_t max_row_size = std::max(file_row_size, block.row_size);
+    const uint64_t chunk_rows = std::max<uint64_t>(1,
+        convert_buffer_size / max_row_size);
+    std::vector<char> buffer(std::min(nrows, chunk_rows) * max_row_size);
+    for (uint64_t first = 0; first < nrows; first += chunk_rows) {
+      const uint64_t n = std::min(chunk_rows, nrows - first);
+      pread_bytes(fd, buffer.data(), n * file_row_size, offset);
+      {
+        H5Lock lock;
+        file_type.convert(*block.elem_type, n * block.elem_count,
+            buffer.data(), nullptr);
+      }
+      std::memcpy(dest, buffer.data(), n * block.row_size);
+      dest += n * block.row_size;
+      offset += n * file_row_size;
+    }
+  }
+
+  /** Size of the buffer used to convert datatypes (in bytes). */
+  static const std::size_t convert_buffer_size = 16 * 1024 * 1024;
+
+  /** Return the name of file number @a filenum. */
+  std::string file_name(const int32_t filenum) const {
+    std::stringstream tmp_stream;
+    tmp_stream << file_name_base_ << "." << filenum << ".hdf5";
+    return tmp_stream.str();
+  }
+
+  /** Snapshot filename without the file number. */
+  std::string file_name_base_;
+  /** Snapshot files, kept open. */
+  std::vector<H5::H5File> files_;
+  /** Total number of particles of each type. */
+  std::vector<part_id_type> npart_total_;
+  /** Number of particles of each type in each file. */
+  std::vector<std::vector<int32_t>> npart_this_file_;
+  /** Datasets to be read by read() or read_if(). */
+  std::vector<Block> blocks_;
+};
+
+/** @class BlockStream
+ * @brief Read one or more datasets (a.k.a. blocks) of a snapshot in
+ *        chunks of a fixed number of rows, so that they can be processed
+ *        in bounded memory:
+ *
+ *     arepo::BlockStream stream(reader, parttype);
+ *     stream.add("ParticleIDs", &ids);
+ *     stream.add("Masses", &masses);
+ *     while (uint64_t nrows = stream.next()) {
+ *       // ids[i] and masses[i] are row stream.first_row() + i.
+ *     }
+ *
+ * While a chunk is being processed, the next one is read on a background
+ * thread, if the HDF5 library is thread-safe. Each dataset then takes
+ * up to twice the chunk size in memory.
+ *
+ * @note The SnapshotReader must outlive the BlockStream.
+ */
+class BlockStream {
+public:
+  /** @brief Constructor.
+   * @param[in] snapshot The snapshot to read from.
+   * @param[in] parttype The particle type.
+   * @param[in] chunk_rows Number of rows per chunk.
+   */
+  BlockStream(const SnapshotReader& snapshot, const int parttype,
+      const uint64_t chunk_rows = 1 << 22)
+      : snapshot_(snapshot), parttype_(parttype),
+        nrows_total_(snapshot.num_part_total(parttype)),
+        chunk_rows_(std::max<uint64_t>(1, chunk_rows)), blocks_(), pos_(0),
+        first_row_(0), pending_() {
+  }
+
+  /** @brief Destructor. Waits for the chunk being read, if any. */
+  ~BlockStream() {
+    if (pending_.valid())
+      pending_.wait();
+  }
+
+  /** @brief Read the rows of dataset @a block_name into @a dest, one
+   *         chunk per call to next(). Must be called before next().
+   */
+  template <typename T>
+  void add(const std::string& block_name, std::vector<T>* dest) {
+    if ((pos_ > 0) || pending_.valid()) {
+      std::cerr << "ERROR: cannot add " << block_name <<
+          " to a BlockStream that has already started.\n";
+      assert(false);
+    }
+    auto buffer = std::make_shared<std::vector<T>>();
+    const SnapshotReader& snapshot = snapshot_;
+    const int parttype = parttype_;
+    Block block;
+    block.read = [&snapshot, block_name, parttype, buffer](
+        const uint64_t first, const uint64_t nrows) {
+      *buffer = snapshot.read_rows<T>(block_name, parttype,
+          std::vector<std::pair<uint64_t, uint64_t>>(1,
+          std::make_pair(first, nrows)));
+    };
+    block.swap = [buffer, dest]() {
+      dest->swap(*buffer);
+    };
+    blocks_.push_back(block);
+  }
+
+  /** @brief Read the next chunk of all datasets into their destination
+   *         vectors.
+   * @return The number of rows in the chunk, or zero once all rows have
+   *         been read.
+   */
+  uint64_t next() {
+    const uint64_t nrows = std::min(chunk_rows_, nrows_total_ - pos_);
+    if (nrows == 0)
+      return 0;
+
+    // Wait for the chunk, or read it now.
+    if (pending_.valid())
+      pending_.get();
+    else
+      read_chunk(pos_, nrows);
+    for (auto& block : blocks_)
+      block.swap();
+    first_row_ = pos_;
+    pos_ += nrows;
+
+    // Read the next chunk in the background.
+#ifdef H5_HAVE_THREADSAFE
+    const uint64_t nrows_next = std::min(chunk_rows_, nrows_total_ - pos_);
+    if (nrows_next > 0) {
+      pending_ = std::async(std::launch::async, &BlockStream::read_chunk,
+          this, pos_, nrows_next);
+    }
+#endif
+    return nrows;
+  }
+
+  /** @brief Return the index of the first row of the chunk returned by
+   *         the last call to next().
+   */
+  uint64_t first_row() const {
+    return first_row_;
+  }
+
+  /** Return the total number of rows of each dataset. */
+  uint64_t num_rows() const {
+    return nrows_total_;
+  }
+
+private:
+  /** @brief A dataset being read. */
+  struct Block {
+    // Read a chunk of rows into an internal buffer.
+    std::function<void(const uint64_t, const uint64_t)> read;
+    // Exchange the internal buffer with the destination vector.
+    std::function<void()> swap;
+  };
+
+  /** @brief Read @a nrows rows, starting from row @a first, of all
+   *         datasets into their internal buffers.
+   */
+  void read_chunk(const uint64_t first, const uint64_t nrows) {
+    for (auto& block : blocks_)
+      block.read(first, nrows);
+  }
+
+  /** The snapshot. */
+  const SnapshotReader& snapshot_;
+  /** The particle type. */
+  int parttype_;
+  /** Total number of rows. */
+  uint64_t nrows_total_;
+  /** Number of rows per chunk. */
+  uint64_t chunk_rows_;
+  /** Datasets to be read. */
+  std::vector<Block> blocks_;
+  /** Index of the first row that has not been returned yet. */
+  uint64_t pos_;
+  /** Index of the first row returned by the last call to next(). */
+  uint64_t first_row_;
+  /** Chunk being read in the background. */
+  std::future<void> pending_;
+};
+
+/** @brief Get the datatype size of a given dataset (a.k.a. block).
  * @param[in] basedir Directory containing the snapshot files.
  * @param[in] snapnum Snapshot number.
  * @param[in] block_name Name of the dataset.
  * @param[in] parttype The particle type.
- * @param[in] read_num If nonzero, only read this many total elements (1D).
- * @return A vector with the dataset values.
  *
- * @note The return value is a vector (with an appropriately chosen type).
- *       When reading from a dataset with ndims > 1, the size() of the
- *       output vector equals the size of the first dimension of the
- *       (concatenated) dataset.
+ * @return The datatype size of the dataset.
  */
-template <typename T>
-std::vector<T> read_block(const std::string& basedir,
+std::size_t get_datatype_size(const std::string& basedir,
     const int16_t snapnum, const std::string& block_name,
-    const int parttype, const uint64_t read_num = 0) {
+    const int parttype) {
+
+  // Group name corresponding to particle type.
+  std::stringstream ss;
+  ss << "/PartType" << parttype;
+  std::string parttype_str = ss.str();
 
   // Snapshot filename without the file number
-  std::stringstream tmp_stream;
-  tmp_stream << basedir << "/snapdir_" <<
+  ss.str("");
+  ss << basedir << "/snapdir_" <<
       std::setfill('0') << std::setw(3) << snapnum << "/snap_" <<
       std::setfill('0') << std::setw(3) << snapnum;
-  std::string file_name_base = tmp_stream.str();
-
-  // Name of first file (just to read header)
-  std::stringstream sstream;
-  sstream << file_name_base << ".0.hdf5";
-  std::string file_name = sstream.str();
-
-  // Get total number of particles
-  auto npart_total_vect_lowword = get_vector_attribute<uint32_t>(file_name,
-      "NumPart_Total");
-  auto npart_total_vect_highword = get_vector_attribute<uint32_t>(file_name,
-      "NumPart_Total_HighWord");
-  part_id_type npart_total = (int64_t)npart_total_vect_lowword[parttype] | 
-                             ((int64_t)npart_total_vect_highword[parttype] << 32);
-
-  // Modify to selective global read
-  if(read_num > 0)
-    npart_total = read_num;
-
-  // Allocate memory for output vector
-  std::vector<T> data_total;
-  data_total.reserve(npart_total);
-
-  // Load data from each file and append to big vector
-  auto nfiles = get_scalar_attribute<int32_t>(file_name, "NumFilesPerSnapshot");
+  std::string file_name_base = ss.str();
+
+  // Iterate over files until we find one that contains the specified
+  // dataset (opening each file only once).
+  int32_t nfiles = 1;
   for (int32_t filenum=0; filenum < nfiles; filenum++) {
-    // Load data from current file.
-    sstream.str("");
-    sstream << file_name_base << "." << filenum << ".hdf5";
-    file_name = sstream.str();
-    auto data_thisfile = read_block_single_file<T>(file_name, block_name, parttype, npart_total);
-
-    // Get number of particles according to file header (just to check)
-    auto npart_thisfile_vect = get_vector_attribute<int32_t>(file_name,
-        "NumPart_ThisFile");
-    part_id_type npart_thisfile = npart_thisfile_vect[parttype];
-    if ((data_thisfile.size() != npart_thisfile) && (read_num == 0))
-      std::cerr << "BAD: number of particles in file " << filenum <<
-        " does not match with header.\n";
-
-    // Concatenate vectors.
-    data_total.insert(data_total.end(), data_thisfile.begin(), data_thisfile.end());
-
-    npart_total -= data_thisfile.size(); // number left to read
-    if(npart_total == 0)
-      break;
+    // Open current file
+    ss.str("");
+    ss << file_name_base << "." << filenum << ".hdf5";
+    auto file = H5::H5File(ss.str(), H5F_ACC_RDONLY);
+    if (filenum == 0)
+      nfiles = get_scalar_attribute<int32_t>(file, "NumFilesPerSnapshot");
+    // Only proceed if group exists.
+    if (!H5Lexists(file.getId(), parttype_str.data(), H5P_DEFAULT)) {
+      file.close();
+      continue;
+    }
+    // Return datatype size.
+    auto group = H5::Group(file.openGroup(parttype_str));
+    auto dataset = H5::DataSet(group.openDataSet(block_name));
+    auto dt = dataset.getDataType();
+    file.close();
+    return dt.getSize();
   }
+  std::cerr << "ERROR: " << parttype_str << "/" << block_name << " not found!\n";
+  assert(false);
+  return 0;
+}
 
-  // Check total number of particles with header.
-  if ((data_total.size() != npart_total) && (npart_total > 0))
-    std::cerr << "BAD: total number of particles does not match with header ["
-              << data_total.size() << " vs " << npart_total << "].\n";
-
-  return data_total;
+/** @brief Function to read a dataset (a.k.a. block) from the snapshot files.
+ *
+ * @tparam T Type of the elements in the datasets.
+ * @param[in] basedir Directory containing the snapshot files.
+ * @param[in] snapnum Snapshot number.
+ * @param[in] block_name Name of the dataset.
+ * @param[in] parttype The particle type.
+ * @param[in] read_num If nonzero, only read this many total elements (1D).
+ * @return A vector with the dataset values.
+ *
+ * @note To read several blocks from the same snapshot, use a
+ *       SnapshotReader, which opens the snapshot files only once.
+ */
+template <typename T>
+std::vector<T> read_block(const std::string& basedir,
+    const int16_t snapnum, const std::string& block_name,
+    const int parttype, const uint64_t read_num = 0) {
+  return SnapshotReader(basedir, snapnum).read_block<T>(
+      block_name, parttype, read_num);
 }
 
 }  // end namespace arepo
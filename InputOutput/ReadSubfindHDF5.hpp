@@ -10,9 +10,14 @@
 #include <string>
 #include <sstream>
 #include <iomanip>  // setfill, setw, setprecision
+#include <functional>
+#include <cstring>  // memcpy
 #include <cassert>
+#include <unistd.h>  // access
+#include <sys/stat.h>  // stat
 
 #include "H5Cpp_wrapper.hpp"
+#include "ColumnFile.hpp"
 #include "../Util/TreeTypes.hpp"
 
 /** @namespace subfind
@@ -20,29 +25,18 @@
  */
 namespace subfind {
 
-/** @brief Function to read a scalar attribute from a Subfind output file.
+/** @brief Function to read a scalar attribute from an open Subfind
+ *         output file.
  *
  * @tparam T Type of the attribute.
- * @param[in] basedir Directory containing the Subfind output files.
- * @param[in] snapnum Snapshot number.
+ * @param[in] file The input file.
  * @param[in] attr_name Name of the attribute.
- * @param[in] filenum File number.
  * @return The attribute value.
  */
 template <typename T>
-T get_scalar_attribute(const std::string& basedir, const snapnum_type snapnum,
-    const std::string& attr_name, const int32_t filenum = 0) {
-
-  // Create filename
-  std::stringstream tmp_stream;
-  tmp_stream << basedir << "/groups_" <<
-      std::setfill('0') << std::setw(3) << snapnum << "/fof_subhalo_tab_" <<
-      std::setfill('0') << std::setw(3) << snapnum;
-  tmp_stream << "." << filenum << ".hdf5";
-  std::string file_name = tmp_stream.str();
+T get_scalar_attribute(const H5::H5File& file, const std::string& attr_name) {
 
   // Open attribute from file header
-  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
   auto header_group = H5::Group(file.openGroup("Header"));
   auto myattr = H5::Attribute(header_group.openAttribute(attr_name));
 
@@ -54,8 +48,52 @@ T get_scalar_attribute(const std::string& basedir, const snapnum_type snapnum,
   T retval;
   myattr.read(myattr.getDataType(), &retval);
 
-  file.close();
+  return retval;
+}
+
+/** @brief Return the name of a Subfind output file.
+ * @param[in] basedir Directory containing the Subfind output files.
+ * @param[in] snapnum Snapshot number.
+ * @param[in] filenum File number.
+ */
+std::string file_name(const std::string& basedir, const snapnum_type snapnum,
+    const int32_t filenum) {
+  std::stringstream tmp_stream;
+  tmp_stream << basedir << "/groups_" <<
+      std::setfill('0') << std::setw(3) << snapnum << "/fof_subhalo_tab_" <<
+      std::setfill('0') << std::setw(3) << snapnum;
+  tmp_stream << "." << filenum << ".hdf5";
+  return tmp_stream.str();
+}
 
+/** @brief Return the name of the column file in which the Subfind
+ *         catalog of a given snapshot is cached (see CatalogReader).
+ * @param[in] cache_dir Directory containing the cached catalogs.
+ * @param[in] snapnum Snapshot number.
+ */
+std::string cache_file_name(const std::string& cache_dir,
+    const snapnum_type snapnum) {
+  std::stringstream tmp_stream;
+  tmp_stream << cache_dir << "/fof_subhalo_tab_" <<
+      std::setfill('0') << std::setw(3) << snapnum << ".cols";
+  return tmp_stream.str();
+}
+
+/** @brief Function to read a scalar attribute from a Subfind output file.
+ *
+ * @tparam T Type of the attribute.
+ * @param[in] basedir Directory containing the Subfind output files.
+ * @param[in] snapnum Snapshot number.
+ * @param[in] attr_name Name of the attribute.
+ * @param[in] filenum File number.
+ * @return The attribute value.
+ */
+template <typename T>
+T get_scalar_attribute(const std::string& basedir, const snapnum_type snapnum,
+    const std::string& attr_name, const int32_t filenum = 0) {
+  auto file = H5::H5File(file_name(basedir, snapnum, filenum), H5F_ACC_RDONLY );
+  T retval = get_scalar_attribute<T>(file, attr_name);
+  file.close();
   return retval;
 }
 
@@ -72,12 +110,11 @@ T get_scalar_attribute(const std::string& basedir, const snapnum_type snapnum,
  * @return A vector with the dataset values.
  */
 template <typename T>
-std::vector<T> read_block_single_file(const std::string& file_name,
+std::vector<T> read_block_single_file(const H5::H5File& file,
     const std::string& group_name, const std::string& block_name,
     const int parttype = -1) {
 
   // Open the specified dataset.
-  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
   auto group = H5::Group(file.openGroup(group_name));
   auto dataset = H5::DataSet(group.openDataSet(block_name));
 
@@ -133,11 +170,518 @@ std::vector<T> read_block_single_file(const std::string& file_name,
   // Read data
   dataset.read(retval.data(), dataset.getDataType(), mem_space, file_space);
 
-  file.close();
+  return retval;
+}
 
+/** @brief Function to read a dataset (a.k.a. block)
+ *         or a dataset "column" from a single file.
+ *
+ * @tparam T Type of the elements in the dataset.
+ * @param[in] file_name Path to the input file.
+ * @param[in] group_name The HDF5 group name, i.e., @a Group or @a Subhalo.
+ * @param[in] block_name Name of the dataset.
+ * @param[in] parttype The 0-indexed column number, if any (-1 otherwise).
+ *
+ * @pre Dataset is one- or two-dimensional.
+ * @return A vector with the dataset values.
+ */
+template <typename T>
+std::vector<T> read_block_single_file(const std::string& file_name,
+    const std::string& group_name, const std::string& block_name,
+    const int parttype = -1) {
+  auto file = H5::H5File(file_name, H5F_ACC_RDONLY );
+  auto retval = read_block_single_file<T>(file, group_name, block_name,
+      parttype);
+  file.close();
   return retval;
 }
 
+/** @class CatalogReader
+ * @brief Read several blocks from the same Subfind catalog, opening each
+ *        file only once:
+ *
+ *     subfind::CatalogReader reader(basedir, snapnum);
+ *     auto sub_len = reader.read_block<uint32_t>("Subhalo", "SubhaloLen");
+ *     auto sub_grnr = reader.read_block<uint32_t>("Subhalo", "SubhaloGrNr");
+ *
+ * The files are opened by the constructor, which also caches the number
+ * of objects from their headers, and stay open for as long as the
+ * CatalogReader exists. Several blocks can also be read together, in a
+ * single pass over the files:
+ *
+ *     reader.add("Subhalo", "SubhaloLen", &sub_len);
+ *     reader.add("Subhalo", "SubhaloMassType", &sub_mass, 4);
+ *     reader.read();
+ *
+ * If given a cache directory, the whole catalog is converted the first
+ * time into a single column file (see ColumnFile.hpp) with one column
+ * per dataset, e.g., "Subhalo/SubhaloLenType", which is then memory-mapped
+ * instead of opening the HDF5 files. Later reads of the same snapshot,
+ * by this or other programs, come from the page cache. The column file
+ * also records the size and modification time of every HDF5 file, and
+ * is written again if any of them has changed.
+ */
+class CatalogReader {
+public:
+  /** @brief Constructor.
+   * @param[in] basedir Directory containing the Subfind output files.
+   * @param[in] snapnum Snapshot number.
+   * @param[in] cache_dir If not empty, directory containing the cached
+   *            catalogs (see cache_file_name), where the catalog is
+   *            cached if it is not already.
+   */
+  CatalogReader(const std::string& basedir, const snapnum_type snapnum,
+      const std::string& cache_dir = "")
+      : basedir_(basedir), snapnum_(snapnum), files_(), nfiles_(0),
+        ngroups_total_(0), nsubs_total_(0), ngroups_this_file_(),
+        nsubs_this_file_(), cache_(), blocks_() {
+    if (!cache_dir.empty()) {
+      std::string cache_name = cache_file_name(cache_dir, snapnum);
+      bool cached = (::access(cache_name.c_str(), F_OK) == 0);
+      if (cached) {
+        cache_ = MappedColumnFile(cache_name, "SubfindCatalog");
+        if (!cache_is_current()) {
+          std::cout << "Catalog has changed since it was cached. Caching " <<
+              "again: " << cache_name << "\n";
+          cache_ = MappedColumnFile();
+          cached = false;
+        }
+      }
+      if (!cached) {
+        CatalogReader(basedir, snapnum).write_cache(cache_name);
+        cache_ = MappedColumnFile(cache_name, "SubfindCatalog");
+      }
+      nfiles_ = cached_value<int32_t>("_NumFiles");
+      ngroups_total_ = cached_value<int32_t>("_NgroupsTotal");
+      nsubs_total_ = cached_value<int32_t>("_NsubgroupsTotal");
+      return;
+    }
+
+    files_.push_back(H5::H5File(file_name(basedir, snapnum, 0), H5F_ACC_RDONLY));
+    ngroups_total_ = subfind::get_scalar_attribute<int32_t>(files_[0],
+        "Ngroups_Total");
+    nsubs_total_ = subfind::get_scalar_attribute<int32_t>(files_[0],
+        "Nsubgroups_Total");
+    auto nfiles = subfind::get_scalar_attribute<int32_t>(files_[0],
+        "NumFiles");
+    nfiles_ = nfiles;
+    for (int32_t filenum = 1; filenum < nfiles; ++filenum) {
+      files_.push_back(H5::H5File(file_name(basedir, snapnum, filenum),
+          H5F_ACC_RDONLY));
+    }
+    for (int32_t filenum = 0; filenum < nfiles; ++filenum) {
+      ngroups_this_file_.push_back(subfind::get_scalar_attribute<int32_t>(
+          files_[filenum], "Ngroups_ThisFile"));
+      nsubs_this_file_.push_back(subfind::get_scalar_attribute<int32_t>(
+          files_[filenum], "Nsubgroups_ThisFile"));
+    }
+  }
+
+  /** Return the number of files. */
+  int32_t num_files() const {
+    return nfiles_;
+  }
+
+  /** Return the total number of FoF groups. */
+  int32_t num_groups() const {
+    return ngroups_total_;
+  }
+
+  /** Return the total number of subhalos. */
+  int32_t num_subhalos() const {
+    return nsubs_total_;
+  }
+
+  /** @brief Return a scalar attribute from the header of file @a filenum.
+   * @tparam T Type of the attribute.
+   */
+  template <typename T>
+  T get_scalar_attribute(const std::string& attr_name,
+      const int32_t filenum = 0) const {
+    if (files_.empty())  // cached
+      return subfind::get_scalar_attribute<T>(basedir_, snapnum_, attr_name,
+          filenum);
+    return subfind::get_scalar_attribute<T>(files_[filenum], attr_name);
+  }
+
+  /** @brief Read a dataset (a.k.a. block) or a dataset "column."
+   *
+   * @tparam T Type of the elements in the dataset.
+   * @param[in] group_name The HDF5 group name, i.e., @a Group or @a Subhalo.
+   * @param[in] block_name Name of the dataset.
+   * @param[in] parttype The 0-indexed column number, if any (-1 otherwise).
+   *
+   * @pre (group_name == "Group") || (group_name == "Subhalo")
+   *
+   * @return A vector with the dataset values.
+   */
+  template <typename T>
+  std::vector<T> read_block(const std::string& group_name,
+      const std::string& block_name, const int parttype = -1) const {
+    std::vector<T> data_total;
+    std::vector<Block> blocks(1, make_block(group_name, block_name,
+        &data_total, parttype));
+    read_blocks(blocks);
+    return data_total;
+  }
+
+  /** @brief Read a dataset (or a dataset "column") into @a dest with the
+   *         next call to read(). Arguments are the same as in read_block().
+   */
+  template <typename T>
+  void add(const std::string& group_name, const std::string& block_name,
+      std::vector<T>* dest, const int parttype = -1) {
+    blocks_.push_back(make_block(group_name, block_name, dest, parttype));
+  }
+
+  /** @brief Read all datasets added so far, going through the files only
+   *         once, and clear the list of datasets.
+   */
+  void read() {
+    std::vector<Block> blocks;
+    blocks.swap(blocks_);
+    read_blocks(blocks);
+  }
+
+  /** @brief Write all datasets of the Group and Subhalo groups, whole and
+   *         concatenated over all files, to the column file @a file_name.
+   *
+   * @note The whole catalog is kept in memory while it is written.
+   */
+  void write_cache(const std::string& file_name) const {
+    // Find the datasets, and the size of their rows, in the first file
+    // that contains objects of each group.
+    std::vector<Block> blocks;
+    std::vector<std::vector<char>> values;
+    for (const std::string group_name : {"Group", "Subhalo"}) {
+      bool groups = (group_name == "Group");
+      const auto& len_this_file = groups ? ngroups_this_file_ : nsubs_this_file_;
+      int32_t filenum = 0;
+      while ((filenum < num_files()) && (len_this_file[filenum] <= 0))
+        ++filenum;
+      if (filenum == num_files())
+        continue;
+      auto group = H5::Group(files_[filenum].openGroup(group_name));
+      for (hsize_t i = 0; i < group.getNumObjs(); ++i) {
+        std::string block_name = group.getObjnameByIdx(i);
+        if (group.childObjType(block_name) != H5O_TYPE_DATASET)
+          continue;
+        auto dataset = H5::DataSet(group.openDataSet(block_name));
+        H5::DataSpace file_space = dataset.getSpace();
+        const unsigned int file_rank = file_space.getSimpleExtentNdims();
+        hsize_t file_dims[file_rank];
+        file_space.getSimpleExtentDims(file_dims, NULL);
+        std::size_t row_size = dataset.getDataType().getSize();
+        for (unsigned int k = 1; k < file_rank; ++k)
+          row_size = row_size * file_dims[k];
+        Block block;
+        block.group_name = group_name;
+        block.name = block_name;
+        block.parttype = -1;
+        block.row_size = row_size;
+        blocks.push_back(block);
+      }
+    }
+
+    // Size and modification time of the files, before reading them.
+    std::vector<int64_t> file_sizes(num_files());
+    std::vector<int64_t> file_mtimes(num_files());
+    for (int32_t filenum = 0; filenum < num_files(); ++filenum)
+      file_stamp(subfind::file_name(basedir_, snapnum_, filenum),
+          file_sizes[filenum], file_mtimes[filenum]);
+
+    // Read them in a single pass over the files, and write them.
+    values.resize(blocks.size());
+    for (std::size_t k = 0; k < blocks.size(); ++k) {
+      std::vector<char>* dest = &values[k];
+      const std::size_t row_size = blocks[k].row_size;
+      blocks[k].allocate = [dest, row_size](const uint64_t nrows) -> char* {
+        dest->resize(nrows * row_size);
+        return dest->data();
+      };
+    }
+    read_blocks(blocks);
+    ColumnFileWriter writer("SubfindCatalog");
+    std::vector<int32_t> nfiles(1, num_files());
+    std::vector<int32_t> ngroups(1, ngroups_total_);
+    std::vector<int32_t> nsubs(1, nsubs_total_);
+    writer.add("_NumFiles", nfiles);
+    writer.add("_NgroupsTotal", ngroups);
+    writer.add("_NsubgroupsTotal", nsubs);
+    writer.add("_FileSizes", file_sizes);
+    writer.add("_FileMTimes", file_mtimes);
+    for (std::size_t k = 0; k < blocks.size(); ++k) {
+      writer.add(blocks[k].group_name + "/" + blocks[k].name, values[k].data(),
+          values[k].size() / blocks[k].row_size, blocks[k].row_size);
+    }
+    writer.write(file_name);
+  }
+
+private:
+  /** @brief A dataset (or dataset column) to be read. */
+  struct Block {
+    // Group and dataset names.
+    std::string group_name;
+    std::string name;
+    // Column number, or -1 for the full rows.
+    int parttype;
+    // Size of one row in memory.
+    std::size_t row_size;
+    // Resize the destination for a given number of rows, and return a
+    // pointer to its first element.
+    std::function<char*(const uint64_t)> allocate;
+  };
+
+  /** @brief Return a Block that reads the given dataset into @a dest. */
+  template <typename T>
+  static Block make_block(const std::string& group_name,
+      const std::string& block_name, std::vector<T>* dest,
+      const int parttype) {
+    // Check precondition
+    assert((group_name == "Group") || (group_name == "Subhalo"));
+    Block block;
+    block.group_name = group_name;
+    block.name = block_name;
+    block.parttype = parttype;
+    block.row_size = sizeof(T);
+    block.allocate = [dest](const uint64_t nrows) -> char* {
+      dest->resize(nrows);
+      return reinterpret_cast<char*>(dest->data());
+    };
+    return block;
+  }
+
+  /** @brief Read @a blocks, file by file. Since the number of objects in
+   *         each file is known from the headers, every file is read
+   *         directly into its slice of the output vectors.
+   */
+  void read_blocks(const std::vector<Block>& blocks) const {
+    if (files_.empty()) {
+      read_cached_blocks(blocks);
+      return;
+    }
+    const std::size_t nblocks = blocks.size();
+    std::vector<char*> dests(nblocks);
+    std::vector<uint64_t> offsets(nblocks, 0);
+    for (std::size_t k = 0; k < nblocks; ++k) {
+      bool groups = (blocks[k].group_name == "Group");
+      dests[k] = blocks[k].allocate(groups ? ngroups_total_ : nsubs_total_);
+    }
+
+    // Iterate over files to read data
+    for (int32_t filenum = 0; filenum < num_files(); ++filenum) {
+      for (std::size_t k = 0; k < nblocks; ++k) {
+        // Skip empty group files
+        bool groups = (blocks[k].group_name == "Group");
+        int32_t len_thisfile = groups ? ngroups_this_file_[filenum] :
+            nsubs_this_file_[filenum];
+        if (len_thisfile <= 0)
+          continue;
+
+        // Sanity check
+        int32_t len_total = groups ? ngroups_total_ : nsubs_total_;
+        if (offsets[k] + len_thisfile > static_cast<uint64_t>(len_total)) {
+          std::cerr << "ERROR: total number of objects does not match with header.\n";
+          assert(false);
+        }
+
+        read_block_into(files_[filenum], blocks[k], len_thisfile,
+            dests[k] + offsets[k]*blocks[k].row_size);
+        offsets[k] += len_thisfile;
+      }
+    }
+
+    // Check total number of objects
+    for (std::size_t k = 0; k < nblocks; ++k) {
+      bool groups = (blocks[k].group_name == "Group");
+      if (offsets[k] != static_cast<uint64_t>(groups ? ngroups_total_ :
+          nsubs_total_))
+        std::cerr << "BAD: total number of objects does not match with header.\n";
+    }
+  }
+
+  /** @brief Copy @a blocks from the cached catalog. */
+  void read_cached_blocks(const std::vector<Block>& blocks) const {
+    for (auto& block : blocks) {
+      bool groups = (block.group_name == "Group");
+      const uint64_t nrows = groups ? ngroups_total_ : nsubs_total_;
+      char* dest = block.allocate(nrows);
+      if (nrows == 0)
+        continue;
+      int64_t k = cache_.find(block.group_name + "/" + block.name);
+      if (k == -1) {
+        std::cerr << "ERROR: " << block.group_name << "/" << block.name <<
+            " not found in cached catalog.\n";
+        assert(false);
+        continue;
+      }
+
+      // Check number of rows and datatype sizes (necessary but not
+      // sufficient). Columns of 2D datasets are assumed to have the
+      // same type.
+      const ColumnFileEntry& entry = cache_.entry(k);
+      const uint64_t ncols = (block.parttype == -1) ? 1 :
+          entry.row_size / block.row_size;
+      if ((entry.nrows != nrows) || (entry.row_size != ncols*block.row_size) ||
+          (block.parttype >= static_cast<int>(ncols))) {
+        std::cerr << "ERROR: mismatched datatype sizes (" << entry.row_size <<
+            " vs " << block.row_size << ") when reading " << block.name;
+        if (block.parttype != -1)
+          std::cerr << " [" << block.parttype << "]";
+        std::cerr << " from cached catalog.\n";
+        assert(false);
+        continue;
+      }
+
+      const char* src = cache_.values(k);
+      if (block.parttype == -1) {
+        std::memcpy(dest, src, nrows * block.row_size);
+        continue;
+      }
+      src += block.parttype * block.row_size;
+      for (uint64_t i = 0; i < nrows; ++i) {
+        std::memcpy(dest + i*block.row_size, src + i*entry.row_size,
+            block.row_size);
+      }
+    }
+  }
+
+  /** @brief Get the size and modification time (in nanoseconds) of
+   *         @a file_name, or -1 for both if it cannot be accessed.
+   */
+  static void file_stamp(const std::string& file_name, int64_t& size,
+      int64_t& mtime) {
+    struct stat buf;
+    if (::stat(file_name.c_str(), &buf) != 0) {
+      size = -1;
+      mtime = -1;
+      return;
+    }
+    size = buf.st_size;
+    mtime = static_cast<int64_t>(buf.st_mtim.tv_sec) * 1000000000 +
+        buf.st_mtim.tv_nsec;
+  }
+
+  /** @brief Return true if the cached catalog records the same number of
+   *         files, and the same size and modification time for each file,
+   *         as found in the Subfind output directory. Files that are no
+   *         longer there are not checked.
+   */
+  bool cache_is_current() const {
+    int64_t k_nfiles = cache_.find("_NumFiles");
+    int64_t k_sizes = cache_.find("_FileSizes");
+    int64_t k_mtimes = cache_.find("_FileMTimes");
+    if ((k_nfiles == -1) || (k_sizes == -1) || (k_mtimes == -1))
+      return false;
+    auto nfiles = cached_value<int32_t>("_NumFiles");
+    if ((cache_.entry(k_sizes).nrows != static_cast<uint64_t>(nfiles)) ||
+        (cache_.entry(k_mtimes).nrows != static_cast<uint64_t>(nfiles)))
+      return false;
+    const int64_t* sizes = reinterpret_cast<const int64_t*>(
+        cache_.values(k_sizes));
+    const int64_t* mtimes = reinterpret_cast<const int64_t*>(
+        cache_.values(k_mtimes));
+    for (int32_t filenum = 0; filenum < nfiles; ++filenum) {
+      int64_t size, mtime;
+      file_stamp(subfind::file_name(basedir_, snapnum_, filenum), size, mtime);
+      if (size == -1)
+        continue;
+      if ((size != sizes[filenum]) || (mtime != mtimes[filenum]))
+        return false;
+    }
+    // A catalog that was written again with more files.
+    if (::access(subfind::file_name(basedir_, snapnum_, nfiles).c_str(),
+        F_OK) == 0)
+      return false;
+    return true;
+  }
+
+  /** @brief Return the value of a one-row column of the cached catalog. */
+  template <typename T>
+  T cached_value(const std::string& name) const {
+    int64_t k = cache_.find(name);
+    if ((k == -1) || (cache_.entry(k).nrows != 1) ||
+        (cache_.entry(k).row_size != sizeof(T))) {
+      std::cerr << "Error: " << name << " not found in cached catalog.\n";
+      exit(1);
+    }
+    return *reinterpret_cast<const T*>(cache_.values(k));
+  }
+
+  /** @brief Read @a block from a single file into @a dest, checking that
+   *         it has @a nrows rows.
+   */
+  static void read_block_into(const H5::H5File& file, const Block& block,
+      const uint64_t nrows, char* dest) {
+
+    // Open the specified dataset.
+    auto group = H5::Group(file.openGroup(block.group_name));
+    auto dataset = H5::DataSet(group.openDataSet(block.name));
+
+    // Get dimensions of the dataset
+    H5::DataSpace file_space = dataset.getSpace();
+    const unsigned int file_rank = file_space.getSimpleExtentNdims();
+    hsize_t file_dims[file_rank];
+    file_space.getSimpleExtentDims(file_dims, NULL);
+    if (file_dims[0] != nrows) {
+      std::cerr << "ERROR: number of objects in " << block.name <<
+          " does not match with header.\n";
+      assert(false);
+    }
+
+    // Check that datatype sizes match (necessary but not sufficient)
+    std::size_t row_size = dataset.getDataType().getSize();
+    if (block.parttype == -1) {
+      for (unsigned int k = 1; k < file_rank; ++k)
+        row_size = row_size * file_dims[k];
+    }
+    if (row_size != block.row_size) {
+      std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
+          " vs " << block.row_size << ") when reading " << block.name;
+      if (block.parttype != -1)
+        std::cerr << " [" << block.parttype << "]";
+      std::cerr << ".\n";
+      assert(false);
+    }
+
+    // When parttype == -1, dataspace in memory is the same as in the
+    // HDF5 file. Otherwise we are only interested in a single column.
+    H5::DataSpace mem_space(file_rank, file_dims);
+    if (block.parttype != -1) {
+      assert((file_rank == 2) && (block.parttype >= 0));
+      // Define hyperslab (offset and size) for column of interest.
+      hsize_t offset[2] = {0, static_cast<hsize_t>(block.parttype)};
+      hsize_t count[2]  = {file_dims[0], 1};
+      file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+      // The dataspace becomes 1D
+      hsize_t mem_dims_1d[1] = {file_dims[0]};
+      mem_space.setExtentSimple(1, mem_dims_1d);
+    }
+
+    // Read data
+    dataset.read(dest, dataset.getDataType(), mem_space, file_space);
+  }
+
+  /** Directory containing the Subfind output files. */
+  std::string basedir_;
+  /** Snapshot number. */
+  snapnum_type snapnum_;
+  /** Subfind output files, kept open (empty if cached). */
+  std::vector<H5::H5File> files_;
+  /** Number of files. */
+  int32_t nfiles_;
+  /** Total number of FoF groups and subhalos. */
+  int32_t ngroups_total_;
+  int32_t nsubs_total_;
+  /** Number of FoF groups and subhalos in each file. */
+  std::vector<int32_t> ngroups_this_file_;
+  std::vector<int32_t> nsubs_this_file_;
+  /** The cached catalog, if any. */
+  MappedColumnFile cache_;
+  /** Datasets to be read by read(). */
+  std::vector<Block> blocks_;
+};
+
 /** @brief Function to read a dataset (a.k.a. block)
  *         or a dataset "column."
  *
@@ -151,74 +695,16 @@ std::vector<T> read_block_single_file(const std::string& file_name,
  * @pre (group_name == "Group") || (group_name == "Subhalo")
  *
  * @return A vector with the dataset values.
+ *
+ * @note To read several blocks from the same catalog, use a
+ *       CatalogReader, which opens the files only once.
  */
 template <typename T>
 std::vector<T> read_block(const std::string& basedir,
     const snapnum_type snapnum, const std::string& group_name,
     const std::string& block_name, const int parttype = -1) {
-
-  // Check precondition
-  assert((group_name == "Group") || (group_name == "Subhalo"));
-
-  // Create initial filename
-  std::stringstream tmp_stream;
-  tmp_stream << basedir << "/groups_" <<
-      std::setfill('0') << std::setw(3) << snapnum << "/fof_subhalo_tab_" <<
-      std::setfill('0') << std::setw(3) << snapnum;
-  std::string file_name_base = tmp_stream.str();
-  tmp_stream << ".0.hdf5";
-  std::string file_name = tmp_stream.str();
-
-  // Get total number of objects
-  std::string attr_name;
-  if (group_name == "Group")
-    attr_name = "Ngroups_Total";
-  else
-    attr_name = "Nsubgroups_Total";
-  auto len_total = get_scalar_attribute<int32_t>(basedir, snapnum, attr_name);
-
-  // Allocate memory for result
-  std::vector<T> data_total;
-  data_total.reserve(len_total);
-
-  // Iterate over files to read data
-  auto nfiles = get_scalar_attribute<int32_t>(basedir, snapnum, "NumFiles");
-  for (int32_t filenum = 0; filenum < nfiles; ++filenum) {
-
-    // Get number of objects in this file
-    if (group_name == "Group")
-      attr_name = "Ngroups_ThisFile";
-    else
-      attr_name = "Nsubgroups_ThisFile";
-    auto len_thisfile = get_scalar_attribute<int32_t>(basedir, snapnum,
-        attr_name, filenum);
-
-    // Skip empty group files
-    if (len_thisfile <= 0)
-      continue;
-
-    // Create filename and read data
-    tmp_stream.str("");
-    tmp_stream << file_name_base << "." << filenum << ".hdf5";
-    file_name = tmp_stream.str();
-    std::vector<T> data_thisfile = read_block_single_file<T>(file_name,
-        group_name, block_name, parttype);
-
-    // Sanity check
-    if (data_thisfile.size() != static_cast<uint32_t>(len_thisfile))
-      std::cerr << "BAD: number of objects in file " << filenum <<
-                   " does not match with header.\n";
-
-    // Append data to output array
-    data_total.insert(data_total.end(), data_thisfile.begin(),
-        data_thisfile.end());
-  }
-
-  // Check total number of particles
-  if (data_total.size() != static_cast<uint32_t>(len_total))
-    std::cerr << "BAD: total number of objects does not match with header.\n";
-
-  return data_total;
+  return CatalogReader(basedir, snapnum).read_block<T>(group_name,
+      block_name, parttype);
 }
 
 }  // end namespace subfind
@@ -2,6 +2,16 @@
 /** @file ReadTreeHDF5.hpp
  * @brief Define a class for reading and traversing SubLink merger trees.
  *
+ * The tree is stored in columns (one array per field), and links between
+ * subhalos are resolved by offset arithmetic on the subhalo IDs. Besides
+ * the "minimal" fields, any other field from the merger tree files can be
+ * loaded by name at runtime.
+ *
+ * A loaded tree can also be saved to a binary file (see compile_tree.cpp)
+ * and memory-mapped later on, which makes loading almost instantaneous,
+ * or published in POSIX shared memory (see publish_tree.cpp), so that
+ * concurrent analysis processes on a node share a single copy of it.
+ *
  * See tree_test.cpp for an usage example.
  *
  * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
@@ -13,24 +23,29 @@
 #include <sstream>
 #include <cassert>
 #include <tuple>  // std::tie
-
-#include <algorithm>  // stable_sort, lower_bound
-#ifdef USE_OPENMP
-#include <parallel/algorithm>  // parallel stable_sort
-#endif
+#include <map>
+#include <algorithm>  // min, max
+#include <limits>
+#include <utility>  // move
 
 #include "GeneralHDF5.hpp"
+#include "ColumnFile.hpp"
 #include "../Util/GeneralUtil.hpp"  // totally_ordered
 #include "../Util/TreeTypes.hpp"
 
 /** @class Tree
  * @brief A class that loads a merger tree, representing it
  *        as a linked-list structure.
+ *
+ * Subhalo IDs have the form TreeID + (row within tree), and the rows of
+ * each tree are stored contiguously. Hence the subhalo with ID @a id is
+ * found @a id - SubhaloID[row] rows away from any @a row of the same tree,
+ * which is used to follow links without sorting or searching.
  */
 class Tree {
 private:
- // Predeclare internal type for subhalos.
- struct internal_subhalo;
+ // Predeclare internal type for the columns.
+ struct Columns;
 
 public:
   /////////////////////////////
@@ -55,10 +70,16 @@ public:
   /** @brief Synonym for BranchIterator. */
   typedef BranchIterator branch_iterator;
 
-  /** @brief Format of the subhalo data.
+  // Predeclaration of Column class.
+  template <typename T>
+  class Column;
+
+  /** @brief Format of the subhalo data, consisting of the "minimal" fields.
    *
-   * Extra quantities can be chosen from the list found in
-   * http://www.illustris-project.org/w/index.php/Merger_Trees#Tree_format.
+   * Extra quantities (see the list found in
+   * http://www.illustris-project.org/w/index.php/Merger_Trees#Tree_format)
+   * are requested when constructing the Tree and accessed by name,
+   * with Subhalo::get() or column().
    */
   struct DataFormat {
     // Fields corresponding to "minimal" data format.
@@ -79,20 +100,6 @@ public:
     real_type MassHistory;
     index_type SubfindID;
 
-    // Additional fields from "extended" format.
-#ifdef COUNT_MERGERS
-    FloatArray<6> SubhaloMassType;
-    real_type Group_M_Crit200;
-#endif
-#ifdef INFALL_CATALOG
-    FloatArray<3> GroupPos;
-    real_type Group_R_Crit200;
-    real_type SubhaloMass;
-    FloatArray<6> SubhaloMassType;
-    FloatArray<3> SubhaloPos;
-    real_type SubhaloVmax;
-#endif
-
     /** Constructor. */
     DataFormat(sub_id_type SubhaloID_,
                sub_id_type SubhaloIDRaw_,
@@ -109,23 +116,7 @@ public:
                sub_len_type NumParticles_,
                real_type Mass_,
                real_type MassHistory_,
-               index_type SubfindID_
-
-#ifdef COUNT_MERGERS
-               ,
-               FloatArray<6>& SubhaloMassType_,
-               real_type Group_M_Crit200_
-#endif
-#ifdef INFALL_CATALOG
-               ,
-               FloatArray<3> GroupPos_,
-               real_type Group_R_Crit200_,
-               real_type SubhaloMass_,
-               FloatArray<6>& SubhaloMassType_,
-               FloatArray<3>& SubhaloPos_,
-               real_type SubhaloVmax_
-#endif
-               )
+               index_type SubfindID_)
         : SubhaloID(SubhaloID_),
           SubhaloIDRaw(SubhaloIDRaw_),
           LastProgenitorID(LastProgenitorID_),
@@ -141,23 +132,7 @@ public:
           NumParticles(NumParticles_),
           Mass(Mass_),
           MassHistory(MassHistory_),
-          SubfindID(SubfindID_)
-
-#ifdef COUNT_MERGERS
-          ,
-          SubhaloMassType(SubhaloMassType_),
-          Group_M_Crit200(Group_M_Crit200_)
-#endif
-#ifdef INFALL_CATALOG
-          ,
-          GroupPos(GroupPos_),
-          Group_R_Crit200(Group_R_Crit200_),
-          SubhaloMass(SubhaloMass_),
-          SubhaloMassType(SubhaloMassType_),
-          SubhaloPos(SubhaloPos_),
-          SubhaloVmax(SubhaloVmax_)
-#endif
-          {
+          SubfindID(SubfindID_) {
     }
   };
 
@@ -172,61 +147,115 @@ public:
    * @param[in] treedir Directory containing the merger tree files.
    * @param[in] name Suffix of the merger tree filenames, e.g., "tree_extended".
    * @param[in] filenum File number; -1 reads data from all merger tree files.
+   * @param[in] fields Names of extra fields to load, besides the "minimal"
+   *            ones, e.g., {"SubhaloMassType", "Group_M_Crit200"}.
    */
-  Tree(const std::string& treedir, const std::string& name, const int filenum)
-      : subhalos_() {
+  Tree(const std::string& treedir, const std::string& name, const int filenum,
+      const std::vector<std::string>& fields = std::vector<std::string>())
+      : columns_(), fields_(), buffers_(), mapped_file_(),
+        snapshot_offsets_(), snapshot_first_ids_(), snapshot_rows_(),
+        snapshot_offsets_buffer_(), snapshot_first_ids_buffer_(),
+        snapshot_rows_buffer_(), subhalo_offsets_(), subhalo_rows_(),
+        subhalo_offsets_buffer_(), subhalo_rows_buffer_(), branch_tops_(),
+        branch_tops_buffer_(), descendant_jumps_(), descendant_jumps_buffer_(),
+        partial_(false) {
 
     // "Base" path of the merger tree files.
     std::stringstream tmp_stream;
     tmp_stream << treedir << "/" << name;
     std::string treefilebase = tmp_stream.str();
 
-    // Get array with subhalos sorted by their unique ID.
-    auto all_subs = get_sorted_subhalos(treefilebase, filenum);
+    // Read one column per field.
+    std::cout << "Reading data from path " << treefilebase << "...\n";
+    WallClock wall_clock;
+    DatasetReader reader(treefilebase, filenum);
+    read_columns(reader, fields);
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
-    // Link subhalos
+    // Index subhalos by snapshot and Subfind ID, and check links.
     std::cout << "Linking subhalos..." << std::endl;
+    wall_clock.start();
+    index_subhalos();
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+  }
+
+  /** @brief Construct a Tree from rows [@a row_start, @a row_start +
+   *         @a nrows) of a single merger tree file, e.g., one tree or
+   *         subtree (see LazyTree). Prints nothing.
+   * @param[in] treedir Directory containing the merger tree files.
+   * @param[in] name Suffix of the merger tree filenames, e.g., "tree_extended".
+   * @param[in] filenum File number.
+   * @param[in] row_start First row to be read.
+   * @param[in] nrows Number of rows to be read.
+   * @param[in] fields Names of extra fields to load.
+   *
+   * @note Links to subhalos outside these rows (e.g., the descendant of
+   *       the first subhalo of a subtree) return invalid Subhalo objects.
+   */
+  Tree(const std::string& treedir, const std::string& name, const int filenum,
+      const uint64_t row_start, const uint64_t nrows,
+      const std::vector<std::string>& fields = std::vector<std::string>())
+      : columns_(), fields_(), buffers_(), mapped_file_(),
+        snapshot_offsets_(), snapshot_first_ids_(), snapshot_rows_(),
+        snapshot_offsets_buffer_(), snapshot_first_ids_buffer_(),
+        snapshot_rows_buffer_(), subhalo_offsets_(), subhalo_rows_(),
+        subhalo_offsets_buffer_(), subhalo_rows_buffer_(), branch_tops_(),
+        branch_tops_buffer_(), descendant_jumps_(), descendant_jumps_buffer_(),
+        partial_(true) {
+    assert(filenum >= 0);
+    std::stringstream tmp_stream;
+    tmp_stream << treedir << "/" << name;
+    DatasetReader reader(tmp_stream.str(), filenum);
+    reader.select_rows(row_start, nrows);
+    read_columns(reader, fields);
+    index_subhalos();
+  }
+
+  /** @brief Constructor. Load a tree previously written with save(), by
+   *         mapping the file into memory.
+   * @param[in] file_name Path to the compiled tree.
+   *
+   * @note All the fields stored in the file are available. Links were
+   *       checked before saving, so this takes (almost) no time.
+   */
+  explicit Tree(const std::string& file_name)
+      : Tree(MappedColumnFile(file_name, "SubLinkTree"), file_name) {
+  }
+
+  /** @brief Attach to a tree published in POSIX shared memory with
+   *         publish(), e.g., by publish_tree.cpp. The data are mapped
+   *         read-only, so that all processes on a node share one copy.
+   * @param[in] shm_name Name of the shared memory object.
+   */
+  static Tree attach(const std::string& shm_name) {
+    return Tree(MappedColumnFile::open_shared_memory(shm_name, "SubLinkTree"),
+        shm_name);
+  }
+
+  /** @brief Write this tree, with all its fields and the index of
+   *         subhalos by snapshot and Subfind ID, to a binary file that
+   *         can be loaded with Tree(file_name).
+   */
+  void save(const std::string& file_name) const {
+    std::cout << "Writing compiled tree to " << file_name << "...\n";
     WallClock wall_clock;
-    for (auto it = all_subs.begin(); it != all_subs.end(); ++it) {
-      internal_subhalo* sub = *it;
-
-      // Increase size of subhalos_ as necessary, initializing
-      // new elements to nullptr. Note that subhalos_[snapnum].size()
-      // is not necessarily equal to the number of subhalos in the
-      // corresponding Subfind catalog.
-      if (static_cast<std::size_t>(sub->data_.SnapNum+1) > subhalos_.size())
-        subhalos_.resize(sub->data_.SnapNum+1);
-      if (static_cast<std::size_t>(sub->data_.SubfindID+1) >
-          subhalos_[sub->data_.SnapNum].size())
-        subhalos_[sub->data_.SnapNum].resize(sub->data_.SubfindID+1, nullptr);
-
-      // Add subhalo to corresponding snapshot
-      subhalos_[sub->data_.SnapNum][sub->data_.SubfindID] = sub;
-
-      // Establish links between subhalos
-#ifdef EXTRA_POINTERS
-      establish_link(all_subs, sub->last_progenitor_, sub->data_.LastProgenitorID);
-      establish_link(all_subs, sub->main_leaf_progenitor_, sub->data_.MainLeafProgenitorID);
-      establish_link(all_subs, sub->root_descendant_, sub->data_.RootDescendantID);
-#endif
-      establish_link(all_subs, sub->first_progenitor_, sub->data_.FirstProgenitorID);
-      establish_link(all_subs, sub->next_progenitor_, sub->data_.NextProgenitorID);
-      establish_link(all_subs, sub->descendant_, sub->data_.DescendantID);
-      establish_link(all_subs, sub->first_subhalo_in_fof_group_, sub->data_.FirstSubhaloInFOFGroupID);
-      establish_link(all_subs, sub->next_subhalo_in_fof_group_, sub->data_.NextSubhaloInFOFGroupID);
-    }
+    ColumnFileWriter writer = column_writer();
+    writer.write(file_name);
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
   }
 
-  /** Destructor. */
-  ~Tree() {
-    // Iterate over vector of vectors
-    for (auto it1 = subhalos_.begin(); it1 != subhalos_.end(); ++it1) {
-      for (auto it2 = (*it1).begin(); it2 != (*it1).end(); ++it2) {
-        internal_subhalo* cur_sub = *it2;
-        delete cur_sub;
-      }
-    }
+  /** @brief Same as save(), but write the tree to the POSIX shared
+   *         memory object @a shm_name (e.g., "/tree_L75n1820"), which can
+   *         be attached to with attach(). The object persists until it is
+   *         removed with MappedColumnFile::remove_shared_memory().
+   */
+  void publish(const std::string& shm_name) const {
+    std::cout << "Publishing tree to shared memory object " << shm_name <<
+        "...\n";
+    WallClock wall_clock;
+    ColumnFileWriter writer = column_writer();
+    writer.publish(shm_name);
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
   }
 
   /////////////
@@ -239,7 +268,31 @@ public:
    * snapshot number.
    */
   uint16_t num_snapshots() const {
-    return subhalos_.size();
+    if (snapshot_offsets_.size() == 0)
+      return 0;
+    return snapshot_offsets_.size() - 1;
+  }
+
+  /** Return the number of subhalos (rows) in the tree. */
+  uint64_t num_subhalos() const {
+    return columns_.size();
+  }
+
+  /** Return the (approximate) amount of memory allocated by this Tree,
+   * in bytes, not counting memory-mapped files.
+   */
+  uint64_t memory_size() const {
+    uint64_t retval = sizeof(*this);
+    for (auto it = buffers_.begin(); it != buffers_.end(); ++it)
+      retval += it->first.size() + it->second.capacity();
+    retval += snapshot_offsets_buffer_.capacity() * sizeof(uint64_t);
+    retval += snapshot_first_ids_buffer_.capacity() * sizeof(index_type);
+    retval += snapshot_rows_buffer_.capacity() * sizeof(int64_t);
+    retval += subhalo_offsets_buffer_.capacity() * sizeof(uint64_t);
+    retval += subhalo_rows_buffer_.capacity() * sizeof(int64_t);
+    retval += branch_tops_buffer_.capacity() * sizeof(int64_t);
+    retval += descendant_jumps_buffer_.capacity() * sizeof(int64_t);
+    return retval;
   }
 
   ///////////////
@@ -262,7 +315,7 @@ public:
 
     /** Return the number of (non-empty) subhalos in this Snapshot. */
     std::size_t nsubs() const {
-      return t_->subhalos_[snap_].size();
+      return t_->snapshot_size(snap_);
     }
 
     /** Test whether this Snapshot and @a x are equal. */
@@ -278,14 +331,14 @@ public:
     /** Return an iterator pointing to the first subhalo in this snapshot. */
     SnapshotIterator begin() const {
 //      assert(is_valid());
-      return SnapshotIterator(t_, snap_, 0);
+      return SnapshotIterator(t_, t_->subhalo_offsets_[snap_]);
     }
     /** Return iterator pointing to one-past-the-last subhalo in this
      * snapshot.
      */
     SnapshotIterator end() const {
 //      assert(is_valid());
-      return SnapshotIterator(t_, snap_, t_->subhalos_[snap_].size());
+      return SnapshotIterator(t_, t_->subhalo_offsets_[snap_+1]);
     }
 
     /** Helper function to determine whether this Snapshot is valid. */
@@ -315,6 +368,34 @@ public:
     return Snapshot(this, snapnum);
   }
 
+  /** @brief Evaluate @a f for every subhalo from snapshot @a snapnum, in
+   *         parallel, and return the results indexed by Subfind ID:
+   *
+   *     auto mstar_total = tree.compute_catalog<real_type>(snapnum, nsubs,
+   *         [&mstar](const Subhalo& sub) { return mstar.subtree_sum(sub); });
+   *
+   * @param[in] nsubs Number of subhalos in the Subfind catalog.
+   * @param[in] f Function object returning a T for a Subhalo.
+   * @param[in] fill Value for the subhalos that are not in the tree.
+   * @pre @a nsubs >= Snapshot::nsubs()
+   */
+  template <typename T, typename F>
+  std::vector<T> compute_catalog(const snapnum_type snapnum,
+      const uint64_t nsubs, F f, const T& fill = T()) const {
+    std::vector<T> retval(nsubs, fill);
+    if (snapnum >= num_snapshots())
+      return retval;
+    assert(nsubs >= snapshot_size(snapnum));
+    const int64_t pos_begin = subhalo_offsets_[snapnum];
+    const int64_t pos_end = subhalo_offsets_[snapnum+1];
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int64_t pos = pos_begin; pos < pos_end; ++pos) {
+      auto row = subhalo_rows_[pos];
+      retval[columns_.SubfindID[row]] = f(Subhalo(this, row));
+    }
+    return retval;
+  }
+
   //////////////
   // SUBHALOS //
   //////////////
@@ -325,96 +406,184 @@ public:
   class Subhalo : private totally_ordered<Subhalo> {
   public:
     /** Construct an invalid Subhalo. */
-    Subhalo() : t_(nullptr), snap_(-1), idx_(-1) {
+    Subhalo() : t_(nullptr), row_(-1) {
     }
 
-    /** Return the snapshot number of this Subhalo. */
+    /** Return the snapshot number of this Subhalo, or -1 if invalid. */
     snapnum_type snapnum() const {
-      return snap_;
+      return is_valid() ? t_->columns_.SnapNum[row_] : -1;
     }
-    /** Return the Subfind ID of this Subhalo. */
+    /** Return the Subfind ID of this Subhalo, or -1 if invalid. */
     index_type index() const {
-      return idx_;
+      return is_valid() ? t_->columns_.SubfindID[row_] : -1;
+    }
+    /** Return the Tree containing this Subhalo.
+     * @pre @a t_ != @a nullptr.
+     */
+    const Tree& tree() const {
+      return *t_;
     }
 
     /** Test whether this Subhalo and @a x are equal. */
     bool operator==(const Subhalo& x) const {
-      return (snap_ == x.snap_) && (idx_ == x.idx_) && (t_ == x.t_);
+      return (row_ == x.row_) && (t_ == x.t_);
     }
     /** Test whether this Subhalo is less than @a x in the global order.
      * @note An alternative ordering is given by SubhaloID, which orders
      *       subhalos in a depth-first fashion in the merger tree.
      */
     bool operator<(const Subhalo& x) const {
-      // Compare t_, then snap_, then idx_
-      return std::tie(t_, snap_, idx_) < std::tie(x.t_, x.snap_, x.idx_);
+      // Compare t_, then snapnum, then Subfind ID (invalid Subhalos first)
+      if ((t_ != x.t_) || (row_ == -1) || (x.row_ == -1))
+        return std::tie(t_, row_) < std::tie(x.t_, x.row_);
+      return std::make_tuple(snapnum(), index()) <
+          std::make_tuple(x.snapnum(), x.index());
+    }
+
+    /** Return data as found in the merger tree.
+     * @note The data are gathered from the columns, i.e., this is a copy.
+     */
+    DataFormat data() const {
+      return t_->columns_.row(fetch());
     }
 
-    /** Return reference to data as found in the merger tree. */
-    const DataFormat& data() const {
-      return fetch()->data_;
+    /** @brief Return the value of a field by name, e.g.,
+     *         get<FloatArray<6>>("SubhaloMassType").
+     * @note Looks up the field on every call. Inside loops, use a
+     *       Column handle instead (see Tree::column()).
+     */
+    template <typename T>
+    const T& get(const std::string& field) const {
+      return t_->column<T>(field)[*this];
     }
 
     // The member functions below return "linked" Subhalo objects.
-#ifdef EXTRA_POINTERS
+    // All links are always loaded, so EXTRA_POINTERS is no longer needed.
     Subhalo last_progenitor() const {
-      return ptr_to_sub(fetch()->last_progenitor_);
+      return follow(t_->columns_.LastProgenitorID);
     }
     Subhalo main_leaf_progenitor() const {
-      return ptr_to_sub(fetch()->main_leaf_progenitor_);
+      return follow(t_->columns_.MainLeafProgenitorID);
     }
     Subhalo root_descendant() const {
-      return ptr_to_sub(fetch()->root_descendant_);
+      return follow(t_->columns_.RootDescendantID);
     }
-#endif
     Subhalo first_progenitor() const {
-      return ptr_to_sub(fetch()->first_progenitor_);
+      return follow(t_->columns_.FirstProgenitorID);
     }
     Subhalo next_progenitor() const {
-      return ptr_to_sub(fetch()->next_progenitor_);
+      return follow(t_->columns_.NextProgenitorID);
     }
     Subhalo descendant() const {
-      return ptr_to_sub(fetch()->descendant_);
+      return follow(t_->columns_.DescendantID);
     }
     Subhalo first_subhalo_in_fof_group() const {
-      return ptr_to_sub(fetch()->first_subhalo_in_fof_group_);
+      return follow(t_->columns_.FirstSubhaloInFOFGroupID);
     }
     Subhalo next_subhalo_in_fof_group() const {
-      return ptr_to_sub(fetch()->next_subhalo_in_fof_group_);
+      return follow(t_->columns_.NextSubhaloInFOFGroupID);
+    }
+
+    /** @brief Return the latest progenitor along the main branch such
+     *         that result.snapnum() <= @a snapnum (possibly this Subhalo),
+     *         or an invalid Subhalo if the main branch is truncated before
+     *         reaching @a snapnum.
+     * @note Takes O(log n) time, where n is the length of the main branch.
+     */
+    Subhalo main_progenitor_at(const snapnum_type snapnum) const {
+      auto row = t_->main_progenitor_row(fetch(), snapnum);
+      return (row != -1) ? Subhalo(t_, row) : Subhalo();
+    }
+
+    /** @brief Return the earliest descendant such that
+     *         result.snapnum() >= @a snapnum (possibly this Subhalo), or
+     *         an invalid Subhalo if the "forward branch" is truncated
+     *         before reaching @a snapnum.
+     * @note Jumps over whole main-branch segments, so that it takes
+     *       O(log n) time per merger along the way.
+     */
+    Subhalo descendant_at(const snapnum_type snapnum) const {
+      auto row = t_->descendant_row(fetch(), snapnum);
+      return (row != -1) ? Subhalo(t_, row) : Subhalo();
+    }
+
+    /** @brief Return true if @a prog is this Subhalo or one of its
+     *         progenitors. Takes O(1) time.
+     * @pre This Subhalo and @a prog are valid.
+     */
+    bool has_progenitor(const Subhalo& prog) const {
+      return (t_ == prog.t_) && t_->in_subtree(fetch(), prog.fetch());
+    }
+
+    /** @brief Return true if this Subhalo and @a x lie along the same
+     *         main branch, i.e., if one is a main progenitor of the other.
+     *         Takes O(1) time.
+     * @pre This Subhalo and @a x are valid.
+     */
+    bool shares_main_branch(const Subhalo& x) const {
+      return (t_ == x.t_) && (t_->columns_.MainLeafProgenitorID[fetch()] ==
+          t_->columns_.MainLeafProgenitorID[x.fetch()]);
+    }
+
+    /** @brief Return the first common descendant of this Subhalo and
+     *         @a x, which is one of them if the other one is among its
+     *         progenitors, or an invalid Subhalo if they never merge
+     *         (or their common descendants were not loaded).
+     * @note Takes O(log n) time, where n is the number of descendants.
+     * @pre This Subhalo and @a x are valid.
+     */
+    Subhalo first_common_descendant(const Subhalo& x) const {
+      if (t_ != x.t_)
+        return Subhalo();
+      auto row = t_->common_descendant_row(fetch(), x.fetch());
+      return (row != -1) ? Subhalo(t_, row) : Subhalo();
+    }
+
+    /** @brief Return the first descendant of this Subhalo (possibly
+     *         itself) that lies along the main branch of @a x, i.e., where
+     *         its "forward" branch joins that of @a x, or an invalid
+     *         Subhalo if @a x is not one of its descendants.
+     * @note Takes O(log n) time, where n is the number of descendants.
+     * @pre This Subhalo and @a x are valid.
+     */
+    Subhalo descendant_along_main_branch(const Subhalo& x) const {
+      if ((t_ != x.t_) || !x.has_progenitor(*this))
+        return Subhalo();
+      auto row = t_->main_branch_junction_row(fetch(), x.fetch());
+      return (row != -1) ? Subhalo(t_, row) : Subhalo();
     }
 
     /** Helper function to determine whether this Subhalo is valid. */
     bool is_valid() const {
-      return (t_ != nullptr) &&
-          (snap_ >= 0) && (static_cast<std::size_t>(snap_) < t_->num_snapshots()) &&
-          (idx_ >= 0)  && (static_cast<std::size_t>(idx_)  < t_->subhalos_[snap_].size()) &&
-          (t_->subhalos_[snap_][idx_] != nullptr);
+      return (t_ != nullptr) && (row_ >= 0);
     }
 
   private:
     friend class Tree;
+    template <typename U>
+    friend class Tree::Column;
     // Pointer back to the Tree containing this Subhalo.
     Tree* t_;
-    // Snapshot number where this subhalo is found.
-    snapnum_type snap_;
-    // Index of this subhalo in the Subfind catalog.
-    index_type idx_;
+    // Row of this subhalo in the columns.
+    int64_t row_;
     /** Private constructor. */
-    Subhalo(const tree_type* t, snapnum_type snap, index_type idx)
-        : t_(const_cast<tree_type*>(t)), snap_(snap), idx_(idx) {
+    Subhalo(const tree_type* t, int64_t row)
+        : t_(const_cast<tree_type*>(t)), row_(row) {
     }
-    /** Return a pointer to the corresponding internal_subhalo. */
-    internal_subhalo* fetch() const {
+    /** Return the row of this Subhalo in the columns. */
+    int64_t fetch() const {
 //      assert(is_valid());
-      return t_->subhalos_[snap_][idx_];
+      return row_;
     }
-    /** Return a Subhalo object for a given internal_subhalo*.
-     * @param[in] p Pointer to @a internal_subhalo object.
+    /** Return the Subhalo whose ID is stored in column @a ids,
+     * or an invalid Subhalo if there is none.
      * @pre @a t_ != @a nullptr.
      */
-    Subhalo ptr_to_sub(internal_subhalo* p) const {
-      if (p != nullptr)
-        return Subhalo(t_, p->data_.SnapNum, p->data_.SubfindID);
+    Subhalo follow(const ColumnView<sub_id_type>& ids) const {
+      auto row = fetch();
+      auto linked_row = t_->linked_row(row, ids[row]);
+      if (linked_row != -1)
+        return Subhalo(t_, linked_row);
       return Subhalo();
     }
   };
@@ -427,10 +596,258 @@ public:
    */
   Subhalo subhalo(snapnum_type snapnum, index_type idx) const {
     assert((snapnum >= 0) && (snapnum < num_snapshots()) && (idx >= 0));
-    if ((static_cast<std::size_t>(idx) >= subhalos_[snapnum].size()) ||
-        (subhalos_[snapnum][idx] == nullptr))
+    if (static_cast<uint64_t>(idx) >= snapshot_size(snapnum))
+      return Subhalo();
+    auto row = snapshot_row(snapnum, idx);
+    if (row == -1)
       return Subhalo();
-    return Subhalo(this, snapnum, idx);
+    return Subhalo(this, row);
+  }
+
+  /////////////
+  // COLUMNS //
+  /////////////
+
+  /** @class Column
+   * @brief Handle to the values of one field, found by name only once:
+   *
+   *     auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
+   *     for (...)
+   *       mstar = mass_type[sub][4];
+   */
+  template <typename T>
+  class Column {
+  public:
+    /** Construct an invalid Column. */
+    Column() : t_(nullptr), values_(nullptr) {
+    }
+
+    /** Return the value for Subhalo @a sub.
+     * @pre @a sub is a valid Subhalo from the same Tree.
+     */
+    const T& operator[](const Subhalo& sub) const {
+      assert(sub.t_ == t_);
+      return values_[sub.fetch()];
+    }
+
+  private:
+    friend class Tree;
+    // Pointer back to the Tree containing this Column.
+    const Tree* t_;
+    // Values, indexed by row.
+    const T* values_;
+    /** Private constructor. */
+    Column(const Tree* t, const T* values) : t_(t), values_(values) {
+    }
+  };
+
+  /** @brief Return a handle to the values of @a field, which is either a
+   *         "minimal" field or one of the extra fields passed to the
+   *         constructor.
+   * @tparam T Type of each value, e.g., real_type or FloatArray<6>.
+   */
+  template <typename T>
+  Column<T> column(const std::string& field) const {
+    std::size_t row_size = 0;
+    const void* values = column_values(field, row_size);
+    if (row_size != sizeof(T)) {
+      std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
+          " vs " << sizeof(T) << ") when accessing " << field << ".\n";
+      assert(false);
+    }
+    return Column<T>(this, static_cast<const T*>(values));
+  }
+
+  /** Return true if @a field is available, i.e., can be passed to column(). */
+  bool has_field(const std::string& field) const {
+    return fields_.count(field) > 0;
+  }
+
+  //////////////////////////
+  // MAIN BRANCH STATISTICS //
+  //////////////////////////
+
+  /** @class Tree::BranchMax
+   * @brief For every Subhalo, the progenitor along its main branch
+   *        (including itself) where some quantity reaches its maximum,
+   *        and the maximum value (see main_branch_max()).
+   */
+  class BranchMax {
+  public:
+    /** Construct an invalid BranchMax. */
+    BranchMax() : t_(nullptr), rows_(), values_() {
+    }
+
+    /** Return the progenitor along the main branch of @a sub where the
+     * quantity is largest. Ties go to the latest progenitor.
+     * @pre @a sub is a valid Subhalo from the same Tree.
+     */
+    Subhalo argmax(const Subhalo& sub) const {
+      assert(sub.t_ == t_);
+      return Subhalo(t_, rows_[sub.row_]);
+    }
+
+    /** Return the maximum of the quantity along the main branch of @a sub.
+     * @pre @a sub is a valid Subhalo from the same Tree.
+     */
+    real_type max(const Subhalo& sub) const {
+      assert(sub.t_ == t_);
+      return values_[sub.row_];
+    }
+
+  private:
+    friend class Tree;
+    // Pointer back to the Tree.
+    const Tree* t_;
+    // Row of the maximum, indexed by row.
+    std::vector<int64_t> rows_;
+    // Value of the maximum, indexed by row.
+    std::vector<real_type> values_;
+  };
+
+  /** @brief Find the maximum of @a value along the main branch of every
+   *         Subhalo, in a single sweep over the tree:
+   *
+   *     auto mass = tree.column<real_type>("Mass");
+   *     auto tmax = tree.main_branch_max(
+   *         [&mass](const Subhalo& sub) { return mass[sub]; });
+   *     auto sub_tmax = tmax.argmax(sub);  // O(1)
+   *
+   * @param[in] value Function object returning a real_type for a Subhalo.
+   *
+   * Each main-branch segment (see branch_tops_) is swept from its leaf
+   * upwards, so that every row reuses the result of its first progenitor.
+   * Segments are independent and are processed in parallel.
+   */
+  template <typename F>
+  BranchMax main_branch_max(F value) const {
+    const auto& c = columns_;
+    const int64_t nrows = c.size();
+    BranchMax retval;
+    retval.t_ = this;
+    retval.rows_.resize(nrows);
+    retval.values_.resize(nrows);
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (int64_t top = 0; top < nrows; ++top) {
+      if (branch_tops_[top] != top)
+        continue;
+      // The main branch may be truncated in partial trees.
+      int64_t last = last_row(top, c.MainLeafProgenitorID[top]);
+      for (int64_t row = last; row >= top; --row) {
+        real_type v = value(Subhalo(this, row));
+        if ((row < last) && (retval.values_[row+1] > v)) {
+          retval.rows_[row] = retval.rows_[row+1];
+          retval.values_[row] = retval.values_[row+1];
+        }
+        else {
+          retval.rows_[row] = row;
+          retval.values_[row] = v;
+        }
+      }
+    }
+    return retval;
+  }
+
+  //////////////////////
+  // SUBTREE AGGREGATES //
+  //////////////////////
+
+  /** @class Tree::Aggregate
+   * @brief Sums and maxima of some quantity over the subtree (a Subhalo
+   *        and all its progenitors) or the main branch of any Subhalo,
+   *        in O(1) time (see aggregate()).
+   *
+   * Since rows are in depth-first order, the subtree of the subhalo at
+   * @a row is the row range [row, row + LastProgenitorID - SubhaloID], and
+   * its main branch is [row, row + MainLeafProgenitorID - SubhaloID].
+   * Counts (e.g., the number of leaves) are sums of 0/1 values.
+   */
+  class Aggregate {
+  public:
+    /** Construct an invalid Aggregate. */
+    Aggregate() : t_(nullptr), prefix_(), max_() {
+    }
+
+    /** Return the sum over the subtree of @a sub (including itself).
+     * @pre @a sub is a valid Subhalo from the same Tree.
+     */
+    double subtree_sum(const Subhalo& sub) const {
+      assert(sub.t_ == t_);
+      return range_sum(sub.row_,
+          t_->last_row(sub.row_, t_->columns_.LastProgenitorID[sub.row_]));
+    }
+
+    /** Return the maximum over the subtree of @a sub (including itself).
+     * @pre @a sub is a valid Subhalo from the same Tree.
+     */
+    real_type subtree_max(const Subhalo& sub) const {
+      assert(sub.t_ == t_);
+      return max_[sub.row_];
+    }
+
+    /** Return the sum over the main branch of @a sub (including itself).
+     * @pre @a sub is a valid Subhalo from the same Tree.
+     */
+    double main_branch_sum(const Subhalo& sub) const {
+      assert(sub.t_ == t_);
+      return range_sum(sub.row_,
+          t_->last_row(sub.row_, t_->columns_.MainLeafProgenitorID[sub.row_]));
+    }
+
+  private:
+    friend class Tree;
+    // Pointer back to the Tree.
+    const Tree* t_;
+    // Sum over rows [0, row), indexed by row (one extra element).
+    std::vector<double> prefix_;
+    // Maximum over the subtree, indexed by row.
+    std::vector<real_type> max_;
+    /** Return the sum over rows [first, last]. */
+    double range_sum(const int64_t first, const int64_t last) const {
+      return prefix_[last+1] - prefix_[first];
+    }
+  };
+
+  /** @brief Precompute subtree sums and maxima of @a value for every
+   *         Subhalo:
+   *
+   *     auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
+   *     auto mstar = tree.aggregate(
+   *         [&mass_type](const Subhalo& sub) { return mass_type[sub][4]; });
+   *     auto mstar_total = mstar.subtree_sum(sub);  // O(1)
+   *
+   * @param[in] value Function object returning a real_type for a Subhalo.
+   *
+   * @a value is evaluated in parallel. Sums are differences of prefix sums
+   * (in double precision) over the rows. Since subtrees are nested, the
+   * maxima are found in a single backward sweep, where each row combines
+   * the results of its progenitors, which tile the rest of its subtree.
+   */
+  template <typename F>
+  Aggregate aggregate(F value) const {
+    const auto& c = columns_;
+    const int64_t nrows = c.size();
+    Aggregate retval;
+    retval.t_ = this;
+    retval.prefix_.resize(nrows+1);
+    retval.max_.resize(nrows);
+#pragma omp parallel for
+    for (int64_t row = 0; row < nrows; ++row) {
+      real_type v = value(Subhalo(this, row));
+      retval.prefix_[row+1] = v;
+      retval.max_[row] = v;
+    }
+    retval.prefix_[0] = 0;
+    for (int64_t row = 0; row < nrows; ++row)
+      retval.prefix_[row+1] += retval.prefix_[row];
+    for (int64_t row = nrows - 1; row >= 0; --row) {
+      int64_t last = last_row(row, c.LastProgenitorID[row]);
+      for (int64_t prog = row + 1; prog <= last;
+          prog = last_row(prog, c.LastProgenitorID[prog]) + 1) {
+        retval.max_[row] = std::max(retval.max_[row], retval.max_[prog]);
+      }
+    }
+    return retval;
   }
 
   ///////////////
@@ -457,7 +874,7 @@ public:
     typedef std::ptrdiff_t difference_type;
 
     /** Construct an invalid SnapshotIterator. */
-    SnapshotIterator() : t_(nullptr), snap_(-1), idx_(-1) {
+    SnapshotIterator() : t_(nullptr), pos_(0) {
     }
 
     /** Method to dereference a SnapshotIterator.
@@ -465,53 +882,32 @@ public:
      */
     Subhalo operator*() const {
       assert(is_valid());
-      return Subhalo(t_, snap_, idx_);
+      return Subhalo(t_, t_->subhalo_rows_[pos_]);
     }
     /** Method to increment a SnapshotIterator. */
     SnapshotIterator& operator++() {
-      ++idx_;
-      fix();
+      ++pos_;
       return *this;
     }
     /** Method to compare two SnapshotIterators.
      * @note Invalid SnapshotIterators are always equal to each other.
      */
     bool operator==(const SnapshotIterator& x) const {
-      return (t_ == x.t_) && (snap_ == x.snap_) && (idx_ == x.idx_);
+      return (t_ == x.t_) && (pos_ == x.pos_);
     }
 
    private:
     friend class Tree;
     Tree* t_;
-    snapnum_type snap_;
-    index_type idx_;
+    // Position in subhalo_rows_.
+    uint64_t pos_;
     /** Private constructor. */
-    SnapshotIterator(const tree_type* t, snapnum_type snap, index_type idx)
-        : t_(const_cast<tree_type*>(t)), snap_(snap), idx_(idx) {
-      fix();
+    SnapshotIterator(const tree_type* t, uint64_t pos)
+        : t_(const_cast<tree_type*>(t)), pos_(pos) {
     }
     /** Helper function to determine whether this iterator is valid. */
     bool is_valid() const {
-      return (t_ != nullptr) &&
-          (snap_ >= 0) && (static_cast<std::size_t>(snap_) < t_->num_snapshots()) &&
-          (idx_ >= 0)  && (static_cast<std::size_t>(idx_)  < t_->subhalos_[snap_].size()) &&
-          (t_->subhalos_[snap_][idx_] != nullptr);
-    }
-    /** Function to advance an iterator to a valid position or end(). */
-    void fix() {
-      assert(t_ != nullptr);
-      assert((snap_ >= 0) && (static_cast<std::size_t>(snap_) < t_->num_snapshots()));
-      assert(idx_ >= 0);
-      auto nsubs = t_->subhalos_[snap_].size();
-      // If idx_ >= nsubs, return end().
-      if (static_cast<std::size_t>(idx_) >= nsubs) {
-        idx_ = nsubs;
-        return;
-      }
-      // Advance until a valid Subhalo or end() is reached.
-      while ((t_->subhalos_[snap_][idx_] == nullptr) &&
-          (static_cast<std::size_t>(idx_) < nsubs))
-        ++idx_;
+      return (t_ != nullptr) && (pos_ < t_->subhalo_rows_.size());
     }
   };
 
@@ -520,177 +916,599 @@ private:
   // PRIVATE TYPES //
   ///////////////////
 
-  /** Internal type for subhalos. */
-  struct internal_subhalo {
+  /** @brief Internal storage for subhalos: one column per field of
+   *         DataFormat, indexed by row. Rows are in the same (depth-first)
+   *         order as in the merger tree files.
+   */
+  struct Columns {
     // Fields from "minimal" data format.
-    DataFormat data_;
-    // Links to other subhalos.
-#ifdef EXTRA_POINTERS
-    internal_subhalo* last_progenitor_ = nullptr;
-    internal_subhalo* main_leaf_progenitor_ = nullptr;
-    internal_subhalo* root_descendant_ = nullptr;
-#endif
-    internal_subhalo* first_progenitor_ = nullptr;
-    internal_subhalo* next_progenitor_ = nullptr;
-    internal_subhalo* descendant_ = nullptr;
-    internal_subhalo* first_subhalo_in_fof_group_ = nullptr;
-    internal_subhalo* next_subhalo_in_fof_group_ = nullptr;
-    /** Constructor. */
-    internal_subhalo(const DataFormat data)
-        : data_(data),
-#ifdef EXTRA_POINTERS
-          last_progenitor_(nullptr),
-          main_leaf_progenitor_(nullptr),
-          root_descendant_(nullptr),
-#endif
-          first_progenitor_(nullptr),
-          next_progenitor_(nullptr),
-          descendant_(nullptr),
-          first_subhalo_in_fof_group_(nullptr),
-          next_subhalo_in_fof_group_(nullptr) {
-    }
-    /** Default destructor. */
-    ~internal_subhalo() = default;
+    ColumnView<sub_id_type> SubhaloID;
+    ColumnView<sub_id_type> SubhaloIDRaw;
+    ColumnView<sub_id_type> LastProgenitorID;
+    ColumnView<sub_id_type> MainLeafProgenitorID;
+    ColumnView<sub_id_type> RootDescendantID;
+    ColumnView<tree_id_type> TreeID;
+    ColumnView<snapnum_type> SnapNum;
+    ColumnView<sub_id_type> FirstProgenitorID;
+    ColumnView<sub_id_type> NextProgenitorID;
+    ColumnView<sub_id_type> DescendantID;
+    ColumnView<sub_id_type> FirstSubhaloInFOFGroupID;
+    ColumnView<sub_id_type> NextSubhaloInFOFGroupID;
+    ColumnView<sub_len_type> NumParticles;
+    ColumnView<real_type> Mass;
+    ColumnView<real_type> MassHistory;
+    ColumnView<index_type> SubfindID;
+
+    /** Return the number of rows. */
+    uint64_t size() const {
+      return SubhaloID.size();
+    }
+
+    /** Gather the fields of a given row into a DataFormat object. */
+    DataFormat row(const uint64_t rownum) const {
+      return DataFormat(
+          SubhaloID[rownum],
+          SubhaloIDRaw[rownum],
+          LastProgenitorID[rownum],
+          MainLeafProgenitorID[rownum],
+          RootDescendantID[rownum],
+          TreeID[rownum],
+          SnapNum[rownum],
+          FirstProgenitorID[rownum],
+          NextProgenitorID[rownum],
+          DescendantID[rownum],
+          FirstSubhaloInFOFGroupID[rownum],
+          NextSubhaloInFOFGroupID[rownum],
+          NumParticles[rownum],
+          Mass[rownum],
+          MassHistory[rownum],
+          SubfindID[rownum]);
+    }
+  };
+
+  /** @brief Values of a field, whose type is only known when it is
+   *         accessed (see column()).
+   */
+  struct RawColumn {
+    // Size in bytes of each value.
+    std::size_t row_size;
+    // Number of values.
+    uint64_t nrows;
+    // Values, indexed by row.
+    const char* values;
   };
 
   //////////////////////////////
   // PRIVATE MEMBER FUNCTIONS //
   //////////////////////////////
 
-  /** Compare two internal_subhalo pointers by their subhalo ID.
-   * @pre @a a and @a b are not @a nullptr.
+  /** @brief Construct a Tree from a compiled tree (see save() and
+   *         publish()) that is already mapped into memory.
+   * @param[in] mapped_file The mapped file or shared memory object.
+   * @param[in] source Name of the file or shared memory object.
    */
-  static bool compareBySubhaloID(internal_subhalo * const & a,
-      internal_subhalo * const & b) {
-    return (*a).data_.SubhaloID < (*b).data_.SubhaloID;
+  Tree(MappedColumnFile&& mapped_file, const std::string& source)
+      : columns_(), fields_(), buffers_(), mapped_file_(std::move(mapped_file)),
+        snapshot_offsets_(), snapshot_first_ids_(), snapshot_rows_(),
+        snapshot_offsets_buffer_(), snapshot_first_ids_buffer_(),
+        snapshot_rows_buffer_(), subhalo_offsets_(), subhalo_rows_(),
+        subhalo_offsets_buffer_(), subhalo_rows_buffer_(), branch_tops_(),
+        branch_tops_buffer_(), descendant_jumps_(), descendant_jumps_buffer_(),
+        partial_(false) {
+    std::cout << "Loading compiled tree from " << source << "...\n";
+    WallClock wall_clock;
+    for (uint64_t k = 0; k < mapped_file_.num_columns(); ++k) {
+      const auto& entry = mapped_file_.entry(k);
+      const char* values = mapped_file_.values(k);
+      std::string name(entry.name);
+      if (name == "_SnapshotOffsets") {
+        snapshot_offsets_ = ColumnView<uint64_t>(
+            reinterpret_cast<const uint64_t*>(values), entry.nrows);
+      }
+      else if (name == "_SnapshotFirstIDs") {
+        snapshot_first_ids_ = ColumnView<index_type>(
+            reinterpret_cast<const index_type*>(values), entry.nrows);
+      }
+      else if (name == "_SnapshotRows") {
+        snapshot_rows_ = ColumnView<int64_t>(
+            reinterpret_cast<const int64_t*>(values), entry.nrows);
+      }
+      else if (name == "_SubhaloOffsets") {
+        subhalo_offsets_ = ColumnView<uint64_t>(
+            reinterpret_cast<const uint64_t*>(values), entry.nrows);
+      }
+      else if (name == "_SubhaloRows") {
+        subhalo_rows_ = ColumnView<int64_t>(
+            reinterpret_cast<const int64_t*>(values), entry.nrows);
+      }
+      else if (name == "_BranchTops") {
+        branch_tops_ = ColumnView<int64_t>(
+            reinterpret_cast<const int64_t*>(values), entry.nrows);
+      }
+      else if (name == "_DescendantJumps") {
+        descendant_jumps_ = ColumnView<int64_t>(
+            reinterpret_cast<const int64_t*>(values), entry.nrows);
+      }
+      else {
+        RawColumn raw_column = {entry.row_size, entry.nrows, values};
+        fields_[name] = raw_column;
+      }
+    }
+    bind_columns();
+
+    // Make sure that the index is consistent with the columns.
+    bool good = (snapshot_offsets_.size() > 0) &&
+        (snapshot_offsets_[snapshot_offsets_.size()-1] == snapshot_rows_.size()) &&
+        (snapshot_first_ids_.size() + 1 == snapshot_offsets_.size()) &&
+        (subhalo_offsets_.size() == snapshot_offsets_.size()) &&
+        (subhalo_rows_.size() == columns_.size()) &&
+        (branch_tops_.size() == columns_.size()) &&
+        (descendant_jumps_.size() == columns_.size());
+    for (auto it = fields_.begin(); it != fields_.end(); ++it)
+      good = good && (it->second.nrows == columns_.size());
+    if (!good) {
+      std::cerr << "Error: " << source << " is not a valid compiled tree " <<
+          "(or was compiled by an older version)." << std::endl;
+      exit(1);
+    }
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
   }
 
-  /** Compare an internal_subhalo pointer with a subhalo ID.
-   * @pre @a sub is not @a nullptr.
+
+  /** @brief Return a writer with all the fields of this tree and the
+   *         index of subhalos by snapshot and Subfind ID.
+   *
+   * @note The writer refers to the data of this tree.
    */
-  static bool compareWithSubhaloID(internal_subhalo * const & sub,
-      const sub_id_type& sub_id) {
-    return (*sub).data_.SubhaloID < sub_id;
+  ColumnFileWriter column_writer() const {
+    ColumnFileWriter writer("SubLinkTree");
+    for (auto it = fields_.begin(); it != fields_.end(); ++it) {
+      writer.add(it->first, it->second.values, it->second.nrows,
+          it->second.row_size);
+    }
+    writer.add("_SnapshotOffsets", snapshot_offsets_.data(),
+        snapshot_offsets_.size(), sizeof(uint64_t));
+    writer.add("_SnapshotFirstIDs", snapshot_first_ids_.data(),
+        snapshot_first_ids_.size(), sizeof(index_type));
+    writer.add("_SnapshotRows", snapshot_rows_.data(),
+        snapshot_rows_.size(), sizeof(int64_t));
+    writer.add("_SubhaloOffsets", subhalo_offsets_.data(),
+        subhalo_offsets_.size(), sizeof(uint64_t));
+    writer.add("_SubhaloRows", subhalo_rows_.data(),
+        subhalo_rows_.size(), sizeof(int64_t));
+    writer.add("_BranchTops", branch_tops_.data(),
+        branch_tops_.size(), sizeof(int64_t));
+    writer.add("_DescendantJumps", descendant_jumps_.data(),
+        descendant_jumps_.size(), sizeof(int64_t));
+    return writer;
   }
 
-  /** @brief Read data from HDF5 file and return a temporary mapping between
-   *         SubhaloIDs and pointers to internal_subhalos.
+  /** @brief Read data from HDF5 file(s) with @a reader, including the
+   *         requested extra @a fields.
+   *
+   * Each file is opened once and all fields are read together (see
+   * DatasetReader).
    */
-  std::vector<internal_subhalo*> get_sorted_subhalos(
-      const std::string& treefilebase, const int filenum) const {
+  void read_columns(DatasetReader& reader,
+      const std::vector<std::string>& fields) {
+    std::vector<std::string> names = {"SubhaloID", "SubhaloIDRaw",
+        "LastProgenitorID", "MainLeafProgenitorID", "RootDescendantID",
+        "TreeID", "SnapNum", "FirstProgenitorID", "NextProgenitorID",
+        "DescendantID", "FirstSubhaloInFOFGroupID", "NextSubhaloInFOFGroupID",
+        "NumParticles", "Mass", "MassHistory", "SubfindID"};
+    names.insert(names.end(), fields.begin(), fields.end());
+    for (auto it = names.begin(); it != names.end(); ++it) {
+      // Skip repeated fields.
+      if (fields_.count(*it) == 0)
+        reader.add_raw(*it, &buffers_[*it], &fields_[*it].row_size);
+    }
+    uint64_t nrows = reader.read();
+    for (auto it = fields_.begin(); it != fields_.end(); ++it) {
+      it->second.nrows = nrows;
+      it->second.values = buffers_.at(it->first).data();
+    }
+    bind_columns();
+  }
 
-    // Read data
-    std::cout << "Reading data from path " << treefilebase << "...\n";
-    WallClock wall_clock;
-    auto SubhaloID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "SubhaloID");
-    auto SubhaloIDRaw = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "SubhaloIDRaw");
-    auto LastProgenitorID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "LastProgenitorID");
-    auto MainLeafProgenitorID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "MainLeafProgenitorID");
-    auto RootDescendantID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "RootDescendantID");
-    auto TreeID = read_dataset_by_filenum<tree_id_type>(treefilebase, filenum, "TreeID");
-    auto SnapNum = read_dataset_by_filenum<snapnum_type>(treefilebase, filenum, "SnapNum");
-    auto FirstProgenitorID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "FirstProgenitorID");
-    auto NextProgenitorID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "NextProgenitorID");
-    auto DescendantID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "DescendantID");
-    auto FirstSubhaloInFOFGroupID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "FirstSubhaloInFOFGroupID");
-    auto NextSubhaloInFOFGroupID = read_dataset_by_filenum<sub_id_type>(treefilebase, filenum, "NextSubhaloInFOFGroupID");
-    auto NumParticles = read_dataset_by_filenum<uint32_t>(treefilebase, filenum, "NumParticles");
-    auto Mass = read_dataset_by_filenum<real_type>(treefilebase, filenum, "Mass");
-    auto MassHistory = read_dataset_by_filenum<real_type>(treefilebase, filenum, "MassHistory");
-    auto SubfindID = read_dataset_by_filenum<index_type>(treefilebase, filenum, "SubfindID");
-
-#ifdef COUNT_MERGERS
-    auto SubhaloMassType = read_dataset_by_filenum<FloatArray<6>>(treefilebase, filenum, "SubhaloMassType");
-    auto Group_M_Crit200 = read_dataset_by_filenum<real_type>(treefilebase, filenum, "Group_M_Crit200");
-#endif
-#ifdef INFALL_CATALOG
-    auto GroupPos = read_dataset_by_filenum<FloatArray<3>>(treefilebase, filenum, "GroupPos");
-    auto Group_R_Crit200 = read_dataset_by_filenum<real_type>(treefilebase, filenum, "Group_R_Crit200");
-    auto SubhaloMass = read_dataset_by_filenum<real_type>(treefilebase, filenum, "SubhaloMass");
-    auto SubhaloMassType = read_dataset_by_filenum<FloatArray<6>>(treefilebase, filenum, "SubhaloMassType");
-    auto SubhaloPos = read_dataset_by_filenum<FloatArray<3>>(treefilebase, filenum, "SubhaloPos");
-    auto SubhaloVmax = read_dataset_by_filenum<real_type>(treefilebase, filenum, "SubhaloVmax");
-#endif
-    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+  /** @brief Point the "minimal" columns to the values of each field. */
+  void bind_columns() {
+    auto& c = columns_;
+    bind(c.SubhaloID, "SubhaloID");
+    bind(c.SubhaloIDRaw, "SubhaloIDRaw");
+    bind(c.LastProgenitorID, "LastProgenitorID");
+    bind(c.MainLeafProgenitorID, "MainLeafProgenitorID");
+    bind(c.RootDescendantID, "RootDescendantID");
+    bind(c.TreeID, "TreeID");
+    bind(c.SnapNum, "SnapNum");
+    bind(c.FirstProgenitorID, "FirstProgenitorID");
+    bind(c.NextProgenitorID, "NextProgenitorID");
+    bind(c.DescendantID, "DescendantID");
+    bind(c.FirstSubhaloInFOFGroupID, "FirstSubhaloInFOFGroupID");
+    bind(c.NextSubhaloInFOFGroupID, "NextSubhaloInFOFGroupID");
+    bind(c.NumParticles, "NumParticles");
+    bind(c.Mass, "Mass");
+    bind(c.MassHistory, "MassHistory");
+    bind(c.SubfindID, "SubfindID");
+  }
 
-    // Create internal_subhalo objects, storing pointers to them in a vector.
-    wall_clock.start();
-    std::cout << "Creating subhalo objects...\n";
-    uint64_t nrows = SubhaloID.size();
-    std::vector<internal_subhalo*> all_subs;
-    for (uint64_t rownum = 0; rownum < nrows; ++rownum) {
-      all_subs.emplace_back(new internal_subhalo(
-          DataFormat(
-              SubhaloID[rownum],
-              SubhaloIDRaw[rownum],
-              LastProgenitorID[rownum],
-              MainLeafProgenitorID[rownum],
-              RootDescendantID[rownum],
-              TreeID[rownum],
-              SnapNum[rownum],
-              FirstProgenitorID[rownum],
-              NextProgenitorID[rownum],
-              DescendantID[rownum],
-              FirstSubhaloInFOFGroupID[rownum],
-              NextSubhaloInFOFGroupID[rownum],
-              NumParticles[rownum],
-              Mass[rownum],
-              MassHistory[rownum],
-              SubfindID[rownum]
-
-#ifdef COUNT_MERGERS
-              ,
-              SubhaloMassType[rownum],
-              Group_M_Crit200[rownum]
-#endif
-#ifdef INFALL_CATALOG
-              ,
-              GroupPos[rownum],
-              Group_R_Crit200[rownum],
-              SubhaloMass[rownum],
-              SubhaloMassType[rownum],
-              SubhaloPos[rownum],
-              SubhaloVmax[rownum]
-#endif
-              )));
+  /** @brief Helper function for bind_columns(). */
+  template <typename T>
+  void bind(ColumnView<T>& column, const std::string& field) {
+    std::size_t row_size = 0;
+    const void* values = column_values(field, row_size);
+    if (row_size != sizeof(T)) {
+      std::cerr << "ERROR: mismatched datatype sizes (" << row_size <<
+          " vs " << sizeof(T) << ") when reading " << field << ".\n";
+      assert(false);
     }
-    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+    column = ColumnView<T>(static_cast<const T*>(values),
+        fields_.at(field).nrows);
+  }
 
-    // Sort array
-    std::cout << "Sorting array...\n";
-    wall_clock.start();
-    CPUClock cpu_clock;
-#ifdef USE_OPENMP
-    __gnu_parallel::stable_sort(all_subs.begin(), all_subs.end(), compareBySubhaloID);
-#else
-    std::stable_sort(all_subs.begin(), all_subs.end(), compareBySubhaloID);
-#endif
-    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
-    std::cout << "Speedup: " << cpu_clock.seconds()/wall_clock.seconds() << ".\n";
+  /** @brief Return the values of @a field and set @a row_size. */
+  const void* column_values(const std::string& field,
+      std::size_t& row_size) const {
+    auto it = fields_.find(field);
+    if (it == fields_.end()) {
+      std::cerr << "Error: " << field << " not included in trees." << std::endl;
+      exit(1);
+    }
+    row_size = it->second.row_size;
+    return it->second.values;
+  }
 
-    return all_subs;
+  /** @brief Return one plus the largest Subfind ID in snapshot
+   *         @a snapnum, or zero if there are no subhalos.
+   */
+  uint64_t snapshot_size(const snapnum_type snapnum) const {
+    uint64_t n = snapshot_offsets_[snapnum+1] - snapshot_offsets_[snapnum];
+    return (n > 0) ? snapshot_first_ids_[snapnum] + n : 0;
   }
 
-  /** Associate the pointer @a sub, initally set to @a nullptr, with the
-   * subhalo with identifier @a sub_id.
+  /** @brief Return the row of the subhalo given by @a snapnum and
+   *         @a subfind_id, or -1 if it is not in the tree.
+   * @pre @a subfind_id < snapshot_size(@a snapnum)
    */
-  void establish_link(const std::vector<internal_subhalo*>& all_subs,
-      internal_subhalo*& sub, const sub_id_type& sub_id) const {
+  int64_t snapshot_row(const snapnum_type snapnum,
+      const index_type subfind_id) const {
+    if (subfind_id < snapshot_first_ids_[snapnum])
+      return -1;
+    return snapshot_rows_[snapshot_offsets_[snapnum] + subfind_id -
+        snapshot_first_ids_[snapnum]];
+  }
+
+  /** @brief Return the row of the subhalo with ID @a sub_id, given the
+   *         @a row of a subhalo from the same tree, or -1 if @a sub_id == -1
+   *         or the subhalo was not loaded.
+   */
+  int64_t linked_row(const int64_t row, const sub_id_type sub_id) const {
+    if (sub_id == -1)
+      return -1;
+    int64_t target = row + (sub_id - columns_.SubhaloID[row]);
+    if ((target < 0) || (static_cast<uint64_t>(target) >= columns_.size()))
+      return -1;
+    return target;
+  }
+
+  /** @brief Check that the subhalo with ID @a sub_id (if any) is found
+   *         where linked_row() expects it. Links to subhalos outside the
+   *         loaded rows are only allowed for partial trees.
+   */
+  bool check_link(const int64_t row, const sub_id_type sub_id) const {
     if (sub_id == -1)
-      return;
-    auto it = std::lower_bound(all_subs.begin(), all_subs.end(), sub_id,
-        compareWithSubhaloID);
-    assert(it != all_subs.end());
-    sub = *it;
-    assert(sub->data_.SubhaloID == sub_id);
+      return true;
+    auto target = linked_row(row, sub_id);
+    if (target == -1)
+      return partial_;
+    return columns_.SubhaloID[target] == sub_id;
+  }
+
+  /** @brief Check that the main branch of the subhalo at @a row is
+   *         found in rows [row, row + MainLeafProgenitorID - SubhaloID],
+   *         i.e., that the first progenitor is always the next row.
+   */
+  bool check_main_branch(const int64_t row) const {
+    const auto& c = columns_;
+    if (c.FirstProgenitorID[row] == -1)
+      return c.MainLeafProgenitorID[row] == c.SubhaloID[row];
+    if (c.FirstProgenitorID[row] != c.SubhaloID[row] + 1)
+      return false;
+    if (static_cast<uint64_t>(row+1) >= c.size())
+      return partial_;
+    return c.MainLeafProgenitorID[row+1] == c.MainLeafProgenitorID[row];
+  }
+
+  /** @brief Return the row of the subhalo with ID @a last_id, given the
+   *         @a row of a subhalo from the same tree and @a last_id >=
+   *         SubhaloID[row], or the last loaded row if it comes after it
+   *         (which happens when subtrees are truncated in partial trees).
+   */
+  int64_t last_row(const int64_t row, const sub_id_type last_id) const {
+    return std::min(row + (last_id - columns_.SubhaloID[row]),
+        static_cast<int64_t>(columns_.size()) - 1);
+  }
+
+  /** @brief Return the row of the latest progenitor along the main branch
+   *         of the subhalo at @a row with SnapNum <= @a snapnum, or -1.
+   *
+   * Since the main branch occupies consecutive rows, ordered by
+   * decreasing SnapNum, this is a binary search.
+   */
+  int64_t main_progenitor_row(const int64_t row,
+      const snapnum_type snapnum) const {
+    const auto& c = columns_;
+    if (c.SnapNum[row] <= snapnum)
+      return row;
+    // The main branch may be truncated in partial trees.
+    int64_t last = last_row(row, c.MainLeafProgenitorID[row]);
+    int64_t lo = row + 1, hi = last + 1;
+    while (lo < hi) {
+      int64_t mid = lo + (hi - lo) / 2;
+      if (c.SnapNum[mid] > snapnum)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return (lo <= last) ? lo : -1;
+  }
+
+  /** @brief Return the row of the earliest descendant of the subhalo at
+   *         @a row with SnapNum >= @a snapnum, or -1.
+   *
+   * Descendants are found one main-branch segment at a time: the
+   * segment [branch_tops_[row], row] is searched with a binary search,
+   * and then the walk continues from the descendant of its top.
+   */
+  int64_t descendant_row(int64_t row, const snapnum_type snapnum) const {
+    const auto& c = columns_;
+    while (row != -1) {
+      if (c.SnapNum[row] >= snapnum)
+        return row;
+      int64_t top = branch_tops_[row];
+      if (c.SnapNum[top] >= snapnum) {
+        // Find the last row in [top, row) with SnapNum >= snapnum.
+        int64_t lo = top, hi = row;
+        while (hi - lo > 1) {
+          int64_t mid = lo + (hi - lo) / 2;
+          if (c.SnapNum[mid] >= snapnum)
+            lo = mid;
+          else
+            hi = mid;
+        }
+        return lo;
+      }
+      row = linked_row(top, c.DescendantID[top]);
+    }
+    return -1;
+  }
+
+  /** @brief Return true if the subhalo at @a prog_row is the subhalo at
+   *         @a row or one of its progenitors.
+   */
+  bool in_subtree(const int64_t row, const int64_t prog_row) const {
+    return (prog_row >= row) &&
+        (prog_row <= last_row(row, columns_.LastProgenitorID[row]));
+  }
+
+  /** @brief Return the row of the first common descendant of the
+   *         subhalos at @a row1 and @a row2, or -1.
+   *
+   * The descendants of @a row2 are visited until finding one whose
+   * subtree contains @a row1. Their subtrees are nested, so a jump (see
+   * descendant_jumps_) can be taken whenever it does not reach such a
+   * subtree, which takes O(log n) steps in total.
+   */
+  int64_t common_descendant_row(const int64_t row1, int64_t row2) const {
+    while (!in_subtree(row2, row1)) {
+      auto jump = descendant_jumps_[row2];
+      if ((jump != row2) && !in_subtree(jump, row1))
+        row2 = jump;
+      else
+        row2 = linked_row(row2, columns_.DescendantID[row2]);
+      if (row2 == -1)
+        return -1;
+    }
+    return row2;
+  }
+
+  /** @brief Return the row of the first descendant of the subhalo at
+   *         @a row that lies along the main branch of its descendant at
+   *         @a desc_row, or -1.
+   *
+   * Along the way, these are the descendants whose subtrees contain the
+   * main leaf progenitor of @a desc_row, so that they are found like a
+   * common descendant (see common_descendant_row()).
+   */
+  int64_t main_branch_junction_row(const int64_t row,
+      const int64_t desc_row) const {
+    auto leaf_row = linked_row(desc_row,
+        columns_.MainLeafProgenitorID[desc_row]);
+    if (leaf_row == -1)
+      return -1;
+    return common_descendant_row(leaf_row, row);
+  }
+
+  /** @brief Fill the (snapshot, Subfind ID) -> row mapping, and make sure
+   *         that all links can be resolved by offset arithmetic.
+   */
+  void index_subhalos() {
+    const auto& c = columns_;
+    const int64_t nrows = c.size();
+
+    // Note that snapshot_size(snapnum) is not necessarily equal to the
+    // number of subhalos in the corresponding Subfind catalog. Only the
+    // range of Subfind IDs found in the tree is indexed, which keeps the
+    // index small for single trees.
+    snapnum_type nsnaps = 0;
+    for (int64_t rownum = 0; rownum < nrows; ++rownum)
+      nsnaps = std::max(nsnaps, static_cast<snapnum_type>(c.SnapNum[rownum]+1));
+    auto& offsets = snapshot_offsets_buffer_;
+    auto& first_ids = snapshot_first_ids_buffer_;
+    auto& rows = snapshot_rows_buffer_;
+    std::vector<index_type> last_ids(nsnaps, -1);
+    first_ids.assign(nsnaps, std::numeric_limits<index_type>::max());
+    for (int64_t rownum = 0; rownum < nrows; ++rownum) {
+      auto snapnum = c.SnapNum[rownum];
+      first_ids[snapnum] = std::min(first_ids[snapnum], c.SubfindID[rownum]);
+      last_ids[snapnum] = std::max(last_ids[snapnum], c.SubfindID[rownum]);
+    }
+    offsets.assign(nsnaps+1, 0);
+    for (snapnum_type snapnum = 0; snapnum < nsnaps; ++snapnum) {
+      if (last_ids[snapnum] == -1)
+        first_ids[snapnum] = 0;
+      offsets[snapnum+1] = offsets[snapnum] +
+          (last_ids[snapnum] + 1 - first_ids[snapnum]);
+    }
+    rows.assign(offsets.back(), -1);
+    for (int64_t rownum = 0; rownum < nrows; ++rownum) {
+      auto snapnum = c.SnapNum[rownum];
+      rows[offsets[snapnum] + c.SubfindID[rownum] - first_ids[snapnum]] = rownum;
+    }
+    snapshot_offsets_ = ColumnView<uint64_t>(offsets.data(), offsets.size());
+    snapshot_first_ids_ = ColumnView<index_type>(first_ids.data(), first_ids.size());
+    snapshot_rows_ = ColumnView<int64_t>(rows.data(), rows.size());
+
+    // Dense list of rows, sorted by snapshot and Subfind ID (i.e.,
+    // skipping the gaps in snapshot_rows_), for iterating over snapshots.
+    auto& sub_offsets = subhalo_offsets_buffer_;
+    auto& sub_rows = subhalo_rows_buffer_;
+    sub_offsets.assign(nsnaps+1, 0);
+    sub_rows.clear();
+    sub_rows.reserve(nrows);
+    for (snapnum_type snapnum = 0; snapnum < nsnaps; ++snapnum) {
+      for (uint64_t k = offsets[snapnum]; k < offsets[snapnum+1]; ++k) {
+        if (rows[k] != -1)
+          sub_rows.push_back(rows[k]);
+      }
+      sub_offsets[snapnum+1] = sub_rows.size();
+    }
+    subhalo_offsets_ = ColumnView<uint64_t>(sub_offsets.data(), sub_offsets.size());
+    subhalo_rows_ = ColumnView<int64_t>(sub_rows.data(), sub_rows.size());
+
+    int64_t nbad = 0;
+#pragma omp parallel for reduction(+:nbad)
+    for (int64_t rownum = 0; rownum < nrows; ++rownum) {
+      bool good =
+          check_link(rownum, c.LastProgenitorID[rownum]) &&
+          check_link(rownum, c.MainLeafProgenitorID[rownum]) &&
+          check_link(rownum, c.RootDescendantID[rownum]) &&
+          check_link(rownum, c.FirstProgenitorID[rownum]) &&
+          check_link(rownum, c.NextProgenitorID[rownum]) &&
+          check_link(rownum, c.DescendantID[rownum]) &&
+          check_link(rownum, c.FirstSubhaloInFOFGroupID[rownum]) &&
+          check_link(rownum, c.NextSubhaloInFOFGroupID[rownum]) &&
+          check_main_branch(rownum);
+      if (!good)
+        ++nbad;
+    }
+    if (nbad > 0) {
+      std::cerr << "ERROR: " << nbad << " subhalos have links that do not " <<
+          "point within their own tree, or main branches that are not " <<
+          "stored in consecutive rows.\n";
+      assert(false);
+    }
+
+    // The top of the main-branch segment containing each subhalo, i.e.,
+    // the first subhalo along its descendants that is not a first
+    // progenitor. Descendants are always found in earlier rows.
+    auto& tops = branch_tops_buffer_;
+    tops.resize(nrows);
+    for (int64_t rownum = 0; rownum < nrows; ++rownum) {
+      auto desc_row = linked_row(rownum, c.DescendantID[rownum]);
+      assert(desc_row < rownum);
+      if ((desc_row != -1) &&
+          (c.FirstProgenitorID[desc_row] == c.SubhaloID[rownum]))
+        tops[rownum] = tops[desc_row];
+      else
+        tops[rownum] = rownum;
+    }
+    branch_tops_ = ColumnView<int64_t>(tops.data(), tops.size());
+
+    // Jump pointers along the descendants of each subhalo, following the
+    // "skew-binary" scheme of Myers (1983): the jump of a subhalo skips
+    // twice the distance skipped by the jump of its descendant, if that
+    // one skips the same distance as the next jump, and otherwise points
+    // to its descendant.
+    auto& jumps = descendant_jumps_buffer_;
+    jumps.resize(nrows);
+    std::vector<int32_t> depths(nrows);
+    for (int64_t rownum = 0; rownum < nrows; ++rownum) {
+      auto desc_row = linked_row(rownum, c.DescendantID[rownum]);
+      if (desc_row == -1) {
+        jumps[rownum] = rownum;
+        depths[rownum] = 0;
+        continue;
+      }
+      depths[rownum] = depths[desc_row] + 1;
+      auto jump = jumps[desc_row];
+      if (depths[desc_row] - depths[jump] == depths[jump] - depths[jumps[jump]])
+        jumps[rownum] = jumps[jump];
+      else
+        jumps[rownum] = desc_row;
+    }
+    descendant_jumps_ = ColumnView<int64_t>(jumps.data(), jumps.size());
   }
 
   //////////////////////////////
   // PRIVATE MEMBER VARIABLES //
   //////////////////////////////
 
+  /** "Minimal" subhalo data, in columns. */
+  Columns columns_;
+
+  /** Values of every field that was loaded, by name. */
+  std::map<std::string, RawColumn> fields_;
+
+  /** Storage for the fields, when they are read from HDF5 files. */
+  std::map<std::string, std::vector<char>> buffers_;
+
+  /** Storage for everything, when loading a compiled tree. */
+  MappedColumnFile mapped_file_;
+
   /** Auxiliary structure. For a given @a snapnum and @a subfind_id,
-   * returns a pointer to the corresponding internal_subhalo.
+   * snapshot_rows_[snapshot_offsets_[snapnum] + subfind_id -
+   * snapshot_first_ids_[snapnum]] is the row of the corresponding subhalo
+   * in @a columns_, or -1 if the subhalo is not in the tree (see
+   * snapshot_row()).
    */
-  std::vector<std::vector<internal_subhalo*>> subhalos_;
+  ColumnView<uint64_t> snapshot_offsets_;
+  ColumnView<index_type> snapshot_first_ids_;
+  ColumnView<int64_t> snapshot_rows_;
+
+  /** Storage for the auxiliary structure, when built from the columns. */
+  std::vector<uint64_t> snapshot_offsets_buffer_;
+  std::vector<index_type> snapshot_first_ids_buffer_;
+  std::vector<int64_t> snapshot_rows_buffer_;
+
+  /** Rows of the subhalos from snapshot @a snapnum, sorted by Subfind ID,
+   * are subhalo_rows_[subhalo_offsets_[snapnum]] to
+   * subhalo_rows_[subhalo_offsets_[snapnum+1]-1] (see SnapshotIterator).
+   */
+  ColumnView<uint64_t> subhalo_offsets_;
+  ColumnView<int64_t> subhalo_rows_;
+
+  /** Storage for the dense list of rows, when built from the columns. */
+  std::vector<uint64_t> subhalo_offsets_buffer_;
+  std::vector<int64_t> subhalo_rows_buffer_;
+
+  /** Row of the top of the main-branch segment containing each row,
+   * i.e., the first subhalo along its descendants that is not the first
+   * progenitor of its own descendant (see descendant_row()).
+   */
+  ColumnView<int64_t> branch_tops_;
+
+  /** Storage for branch_tops_, when built from the columns. */
+  std::vector<int64_t> branch_tops_buffer_;
+
+  /** Row of a descendant of each row (or the row itself, if it has no
+   * descendant), such that any descendant can be reached in O(log n)
+   * jumps (see common_descendant_row()).
+   */
+  ColumnView<int64_t> descendant_jumps_;
+
+  /** Storage for descendant_jumps_, when built from the columns. */
+  std::vector<int64_t> descendant_jumps_buffer_;
+
+  /** Whether only some rows of the merger tree files were loaded. */
+  bool partial_;
 };
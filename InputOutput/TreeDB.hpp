@@ -0,0 +1,398 @@
+#pragma once
+/** @file TreeDB.hpp
+ * @brief Define a class for querying SubLink merger trees in "database
+ *        mode," i.e., reading only the rows and fields that are needed.
+ *
+ * This is the C++ counterpart of the TreeDB class from readtreeHDF5.py.
+ * Since subhalo IDs are assigned in a depth-first fashion, main branches
+ * and subtrees are found in adjacent rows of the merger tree files, which
+ * are located through the offsets files and read with hyperslabs.
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <map>
+#include <utility>  // pair
+#include <tuple>  // tie
+#include <algorithm>  // sort, unique, reverse, max
+#include <cstring>  // memcpy
+#include <cassert>
+
+#include "GeneralHDF5.hpp"
+#include "ColumnFile.hpp"  // ColumnView
+#include "TreeOffsets.hpp"
+#include "../Util/TreeTypes.hpp"
+
+/** @class TreeDB
+ * @brief Answer queries about individual subhalos (main branch, all
+ *        progenitors, etc.) by reading only the corresponding rows:
+ *
+ *     TreeDB tree_db(treedir, "tree_extended");
+ *     auto branch = tree_db.get_main_branch(135, 0, {"SubhaloMassType"});
+ *     auto mass_type = branch.column<FloatArray<6>>("SubhaloMassType");
+ *     for (uint64_t i = 0; i < branch.size(); ++i)
+ *       std::cout << mass_type[i][4] << "\n";
+ *
+ * Many subhalos can be queried at once with query(), which sorts the
+ * requested rows by file and row number, reads nearby rows together
+ * and reads the resulting spans of rows in parallel (see RawRowReader).
+ *
+ * @note Not thread-safe (but query() itself runs in parallel).
+ */
+class TreeDB {
+public:
+  /** @brief Type of the queries (see the corresponding functions). */
+  enum Query {MAIN_BRANCH, ALL_PROGENITORS, DIRECT_PROGENITORS, FUTURE_BRANCH};
+
+  /** @brief A (snapnum, subfind_id) pair. */
+  typedef std::pair<snapnum_type, index_type> subhalo_type;
+
+  /** @class TreeDB::Rows
+   * @brief Result of a query: a set of rows from the merger tree files,
+   *        with the values of each field stored contiguously.
+   */
+  class Rows {
+  public:
+    /** Construct an empty set of rows. */
+    Rows() : nrows_(0), columns_() {
+    }
+
+    /** Return the number of rows. Zero if the subhalo was not found. */
+    uint64_t size() const {
+      return nrows_;
+    }
+
+    /** Return true if @a field was read. */
+    bool has_field(const std::string& field) const {
+      return columns_.count(field) > 0;
+    }
+
+    /** @brief Return the values of @a field.
+     * @tparam T Type of each value, e.g., real_type or FloatArray<6>.
+     * @note The values belong to this object.
+     */
+    template <typename T>
+    ColumnView<T> column(const std::string& field) const {
+      auto it = columns_.find(field);
+      if (it == columns_.end()) {
+        std::cerr << "Error: " << field << " not included in query." <<
+            std::endl;
+        exit(1);
+      }
+      if (it->second.row_size != sizeof(T)) {
+        std::cerr << "ERROR: mismatched datatype sizes (" <<
+            it->second.row_size << " vs " << sizeof(T) <<
+            ") when accessing " << field << ".\n";
+        assert(false);
+      }
+      return ColumnView<T>(
+          reinterpret_cast<const T*>(it->second.bytes.data()), nrows_);
+    }
+
+  private:
+    friend class TreeDB;
+    /** Values of one field. */
+    struct RawColumn {
+      std::size_t row_size;
+      std::vector<char> bytes;
+    };
+    /** Number of rows. */
+    uint64_t nrows_;
+    /** Values of each field, by name. */
+    std::map<std::string, RawColumn> columns_;
+
+    /** Return a copy of the rows at positions @a indices. */
+    Rows subset(const std::vector<uint64_t>& indices) const {
+      Rows retval;
+      retval.nrows_ = indices.size();
+      for (auto it = columns_.begin(); it != columns_.end(); ++it) {
+        auto row_size = it->second.row_size;
+        RawColumn& column = retval.columns_[it->first];
+        column.row_size = row_size;
+        column.bytes.resize(indices.size() * row_size);
+        for (std::size_t i = 0; i < indices.size(); ++i) {
+          std::memcpy(&column.bytes[i*row_size],
+              &it->second.bytes[indices[i]*row_size], row_size);
+        }
+      }
+      return retval;
+    }
+  };
+
+  /** @brief Constructor.
+   * @param[in] treedir Directory containing the merger tree files and
+   *            the "offsets" directory.
+   * @param[in] name Suffix of the merger tree filenames, e.g., "tree_extended".
+   */
+  TreeDB(const std::string& treedir, const std::string& name)
+      : treefilebase_(treedir + "/" + name), offsets_(treedir),
+        tree_files_() {
+  }
+
+  /** @brief Return the main branch of a subhalo, i.e., all subhalos with
+   *         IDs between SubhaloID and MainLeafProgenitorID, starting with
+   *         the given subhalo.
+   */
+  Rows get_main_branch(const snapnum_type snapnum, const index_type subfind_id,
+      const std::vector<std::string>& fields) {
+    return query(MAIN_BRANCH, {subhalo_type(snapnum, subfind_id)}, fields)[0];
+  }
+
+  /** @brief Return the subtree rooted at a subhalo, i.e., all subhalos
+   *         with IDs between SubhaloID and LastProgenitorID, starting
+   *         with the given subhalo.
+   */
+  Rows get_all_progenitors(const snapnum_type snapnum,
+      const index_type subfind_id, const std::vector<std::string>& fields) {
+    return query(ALL_PROGENITORS, {subhalo_type(snapnum, subfind_id)},
+        fields)[0];
+  }
+
+  /** @brief Return the subhalos whose descendant is the given subhalo. */
+  Rows get_direct_progenitors(const snapnum_type snapnum,
+      const index_type subfind_id, const std::vector<std::string>& fields) {
+    return query(DIRECT_PROGENITORS, {subhalo_type(snapnum, subfind_id)},
+        fields)[0];
+  }
+
+  /** @brief Return the descendants of a subhalo, from its root descendant
+   *         down to the given subhalo.
+   */
+  Rows get_future_branch(const snapnum_type snapnum,
+      const index_type subfind_id, const std::vector<std::string>& fields) {
+    return query(FUTURE_BRANCH, {subhalo_type(snapnum, subfind_id)},
+        fields)[0];
+  }
+
+  /** @brief Answer the same query for many subhalos at once.
+   * @param[in] q Type of query.
+   * @param[in] subhalos The (snapnum, subfind_id) pairs of the subhalos.
+   * @param[in] fields Names of the fields to read. SubhaloID and
+   *            DescendantID are always included.
+   * @return The answer for each subhalo, in the same order as @a subhalos.
+   */
+  std::vector<Rows> query(const Query q,
+      const std::vector<subhalo_type>& subhalos,
+      const std::vector<std::string>& fields) {
+    const int64_t nqueries = subhalos.size();
+    std::vector<std::string> names = {"SubhaloID", "DescendantID"};
+    for (auto it = fields.begin(); it != fields.end(); ++it) {
+      if (std::find(names.begin(), names.end(), *it) == names.end())
+        names.push_back(*it);
+    }
+
+    // Locate subhalos, reading the offsets of each snapshot only once.
+    std::vector<TreeOffsets::Location> locs(nqueries);
+    std::map<snapnum_type, std::vector<int64_t>> queries_by_snap;
+    for (int64_t i = 0; i < nqueries; ++i)
+      queries_by_snap[subhalos[i].first].push_back(i);
+    for (auto it = queries_by_snap.begin(); it != queries_by_snap.end(); ++it) {
+      std::vector<index_type> subfind_ids;
+      for (auto i : it->second)
+        subfind_ids.push_back(subhalos[i].second);
+      auto snap_locs = offsets_.locate(it->first, subfind_ids);
+      for (std::size_t k = 0; k < it->second.size(); ++k)
+        locs[it->second[k]] = snap_locs[k];
+    }
+
+    // Find the rows of each query.
+    std::vector<Range> ranges;
+    if (q == FUTURE_BRANCH)
+      future_branch_ranges(locs, ranges);
+    for (int64_t i = 0; (q != FUTURE_BRANCH) && (i < nqueries); ++i) {
+      const auto& loc = locs[i];
+      if (!loc.is_valid())
+        continue;
+      auto last_id = (q == MAIN_BRANCH) ? loc.main_leaf_progenitor_id :
+          loc.last_progenitor_id;
+      Range range = {loc.filenum, loc.row,
+          loc.row + (last_id - loc.subhalo_id) + 1, i};
+      ranges.push_back(range);
+    }
+
+    // Read nearby rows together.
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<Span> spans;
+    for (std::size_t k = 0; k < ranges.size(); ++k) {
+      if (spans.empty() ||
+          (ranges[k].filenum != ranges[k-1].filenum) ||
+          (ranges[k].row_start > spans.back().row_end + max_gap_)) {
+        Span span = {k, k+1, ranges[k].row_end};
+        spans.push_back(span);
+      }
+      else {
+        spans.back().last = k+1;
+        spans.back().row_end = std::max(spans.back().row_end,
+            ranges[k].row_end);
+      }
+    }
+
+    // Open the datasets of each file only once, before reading in parallel.
+    std::map<int, std::vector<RawRowReader>> readers;
+    for (std::size_t s = 0; s < spans.size(); ++s) {
+      const int filenum = ranges[spans[s].first].filenum;
+      auto& file_readers = readers[filenum];
+      if (file_readers.empty()) {
+        for (auto it = names.begin(); it != names.end(); ++it)
+          file_readers.emplace_back(tree_file(filenum), *it);
+      }
+      const uint64_t row_end = spans[s].row_end;
+      for (std::size_t f = 0; f < names.size(); ++f) {
+        if (row_end > file_readers[f].num_rows()) {
+          std::cerr << "ERROR: rows " << ranges[spans[s].first].row_start <<
+              "-" << row_end << " out of range in " << names[f] << ".\n";
+          assert(false);
+        }
+      }
+    }
+
+    std::vector<Rows> retval(nqueries);
+    const int64_t nspans = spans.size();
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t s = 0; s < nspans; ++s) {
+      const Range& first = ranges[spans[s].first];
+      const uint64_t row_start = first.row_start;
+      const uint64_t row_end = spans[s].row_end;
+
+      const auto& file_readers = readers.at(first.filenum);
+      std::map<std::string, Rows::RawColumn> span_columns;
+      for (std::size_t f = 0; f < names.size(); ++f) {
+        auto& column = span_columns[names[f]];
+        column.row_size = file_readers[f].row_size();
+        column.bytes.resize((row_end - row_start) * column.row_size);
+        file_readers[f].read(row_start, row_end - row_start,
+            column.bytes.data());
+      }
+
+      // Copy the rows of each query from the span.
+      for (std::size_t k = spans[s].first; k < spans[s].last; ++k) {
+        const Range& range = ranges[k];
+        Rows rows;
+        rows.nrows_ = range.row_end - range.row_start;
+        for (auto it = span_columns.begin(); it != span_columns.end(); ++it) {
+          auto row_size = it->second.row_size;
+          auto& column = rows.columns_[it->first];
+          column.row_size = row_size;
+          auto begin = it->second.bytes.begin() +
+              (range.row_start - row_start) * row_size;
+          column.bytes.assign(begin, begin + rows.nrows_ * row_size);
+        }
+        retval[range.query] = select(q, rows);
+      }
+    }
+    return retval;
+  }
+
+private:
+  /** Rows [row_start, row_end) of a merger tree file, for a query. */
+  struct Range {
+    int filenum;
+    uint64_t row_start;
+    uint64_t row_end;
+    int64_t query;
+
+    /** Order by file and row number. */
+    bool operator<(const Range& x) const {
+      return std::tie(filenum, row_start, row_end, query) <
+          std::tie(x.filenum, x.row_start, x.row_end, x.query);
+    }
+  };
+
+  /** Ranges of rows separated by fewer than this many rows are read
+   * together.
+   */
+  static constexpr uint64_t max_gap_ = 1024;
+
+  /** Ranges [first, last) of a query (in sorted order) that are read
+   * together, and one past the last row of any of them.
+   */
+  struct Span {
+    std::size_t first;
+    std::size_t last;
+    uint64_t row_end;
+  };
+
+  /** @brief Find the rows between the root descendant and each subhalo,
+   *         reading RootDescendantID once per file.
+   */
+  void future_branch_ranges(const std::vector<TreeOffsets::Location>& locs,
+      std::vector<Range>& ranges) {
+    std::map<int, std::vector<hsize_t>> rows_by_file;
+    for (auto it = locs.begin(); it != locs.end(); ++it) {
+      if (it->is_valid())
+        rows_by_file[it->filenum].push_back(it->row);
+    }
+    for (auto it = rows_by_file.begin(); it != rows_by_file.end(); ++it) {
+      auto& rows = it->second;
+      std::sort(rows.begin(), rows.end());
+      rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+      auto root_descendant_ids = read_dataset_elements<sub_id_type>(
+          tree_file(it->first), "RootDescendantID", rows);
+      for (int64_t i = 0; i < static_cast<int64_t>(locs.size()); ++i) {
+        const auto& loc = locs[i];
+        if ((!loc.is_valid()) || (loc.filenum != it->first))
+          continue;
+        auto k = std::lower_bound(rows.begin(), rows.end(), loc.row) -
+            rows.begin();
+        Range range = {loc.filenum,
+            loc.row - (loc.subhalo_id - root_descendant_ids[k]),
+            loc.row + 1, i};
+        ranges.push_back(range);
+      }
+    }
+  }
+
+  /** @brief Keep the rows that answer query @a q, given the rows that
+   *         contain them (the given subhalo is the first row, except for
+   *         FUTURE_BRANCH, where it is the last one).
+   */
+  static Rows select(const Query q, const Rows& rows) {
+    auto subhalo_id = rows.column<sub_id_type>("SubhaloID");
+    auto descendant_id = rows.column<sub_id_type>("DescendantID");
+    std::vector<uint64_t> indices;
+    if (q == DIRECT_PROGENITORS) {
+      for (uint64_t i = 1; i < rows.size(); ++i) {
+        if (descendant_id[i] == subhalo_id[0])
+          indices.push_back(i);
+      }
+      return rows.subset(indices);
+    }
+    if (q == FUTURE_BRANCH) {
+      // Follow descendants up to the root descendant (first row), using
+      // the fact that rows are adjacent.
+      uint64_t cur = rows.size() - 1;
+      indices.push_back(cur);
+      while (descendant_id[cur] >= subhalo_id[0]) {
+        cur = descendant_id[cur] - subhalo_id[0];
+        assert(cur < rows.size());
+        indices.push_back(cur);
+      }
+      std::reverse(indices.begin(), indices.end());
+      return rows.subset(indices);
+    }
+    return rows;
+  }
+
+  /** @brief Return merger tree file number @a filenum, opening it
+   *         if necessary.
+   */
+  const H5::H5File& tree_file(const int filenum) {
+    auto it = tree_files_.find(filenum);
+    if (it != tree_files_.end())
+      return it->second;
+    std::stringstream tmp_stream;
+    tmp_stream << treefilebase_ << "." << filenum << ".hdf5";
+    return tree_files_[filenum] = H5::H5File(tmp_stream.str(), H5F_ACC_RDONLY);
+  }
+
+  /** Path of the merger tree files, excluding ".N.hdf5". */
+  std::string treefilebase_;
+  /** Locates subhalos in the merger tree files. */
+  TreeOffsets offsets_;
+  /** Merger tree files, opened on demand. */
+  std::map<int, H5::H5File> tree_files_;
+};
@@ -0,0 +1,145 @@
+#pragma once
+/** @file TreeOffsets.hpp
+ * @brief Locate subhalos in the merger tree files through the offsets
+ *        files (offsets/offsets_NNN.hdf5, see Python/compute_offsets.py).
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <map>
+#include <algorithm>  // sort, unique, upper_bound, lower_bound
+
+#include "GeneralHDF5.hpp"
+#include "../Util/TreeTypes.hpp"
+
+/** @class TreeOffsets
+ * @brief Find the merger tree file and row of subhalos given by their
+ *        snapshot number and Subfind ID. Offsets files are opened on
+ *        demand and kept open.
+ *
+ * @note Not thread-safe.
+ */
+class TreeOffsets {
+public:
+  /** @brief Position of a subhalo in the merger tree files, along with
+   *         the IDs that delimit its main branch and its subtree.
+   */
+  struct Location {
+    // Merger tree file number, or -1 if the subhalo is not in the trees.
+    int filenum;
+    // Row within the merger tree file.
+    uint64_t row;
+    sub_id_type subhalo_id;
+    sub_id_type last_progenitor_id;
+    sub_id_type main_leaf_progenitor_id;
+
+    /** Return true if the subhalo was found in the merger trees. */
+    bool is_valid() const {
+      return filenum >= 0;
+    }
+  };
+
+  /** @brief Constructor.
+   * @param[in] treedir Directory containing the "offsets" directory.
+   */
+  explicit TreeOffsets(const std::string& treedir)
+      : treedir_(treedir), file_offsets_(), offset_files_() {
+  }
+
+  /** @brief Locate the subhalo given by @a snapnum and @a subfind_id. */
+  Location locate(const snapnum_type snapnum, const index_type subfind_id) {
+    return locate(snapnum, std::vector<index_type>(1, subfind_id))[0];
+  }
+
+  /** @brief Locate several subhalos from snapshot @a snapnum, reading
+   *         each field of the offsets file only once.
+   */
+  std::vector<Location> locate(const snapnum_type snapnum,
+      const std::vector<index_type>& subfind_ids) {
+    const H5::H5File& file = offset_file(snapnum);
+    const int64_t nsubs =
+        file.openDataSet("RowNum").getSpace().getSimpleExtentNpoints();
+
+    // Read each Subfind ID only once, in increasing order.
+    std::vector<hsize_t> elements;
+    for (auto it = subfind_ids.begin(); it != subfind_ids.end(); ++it) {
+      if ((*it >= 0) && (*it < nsubs))
+        elements.push_back(*it);
+    }
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()),
+        elements.end());
+    auto rownum = read_dataset_elements<int64_t>(file, "RowNum", elements);
+    auto subhalo_id = read_dataset_elements<sub_id_type>(
+        file, "SubhaloID", elements);
+    auto last_progenitor_id = read_dataset_elements<sub_id_type>(
+        file, "LastProgenitorID", elements);
+    auto main_leaf_progenitor_id = read_dataset_elements<sub_id_type>(
+        file, "MainLeafProgenitorID", elements);
+
+    std::vector<Location> retval(subfind_ids.size());
+    for (std::size_t i = 0; i < subfind_ids.size(); ++i) {
+      Location& loc = retval[i];
+      loc.filenum = -1;
+      auto it = std::lower_bound(elements.begin(), elements.end(),
+          static_cast<hsize_t>(subfind_ids[i]));
+      if ((subfind_ids[i] < 0) || (it == elements.end()) ||
+          (*it != static_cast<hsize_t>(subfind_ids[i])))
+        continue;
+      auto k = it - elements.begin();
+      if (rownum[k] == -1)
+        continue;
+
+      // "Local" row number (i.e., in the given tree file)
+      auto file_it = std::upper_bound(file_offsets_.begin(),
+          file_offsets_.end(), rownum[k]);
+      loc.filenum = (file_it - file_offsets_.begin()) - 1;
+      loc.row = rownum[k] - file_offsets_[loc.filenum];
+      loc.subhalo_id = subhalo_id[k];
+      loc.last_progenitor_id = last_progenitor_id[k];
+      loc.main_leaf_progenitor_id = main_leaf_progenitor_id[k];
+    }
+    return retval;
+  }
+
+private:
+  /** @brief Return the offsets file for snapshot @a snapnum, opening it
+   *         if necessary.
+   */
+  const H5::H5File& offset_file(const snapnum_type snapnum) {
+    auto it = offset_files_.find(snapnum);
+    if (it != offset_files_.end())
+      return it->second;
+    std::stringstream tmp_stream;
+    tmp_stream << treedir_ << "/offsets/offsets_" <<
+        std::setfill('0') << std::setw(3) << snapnum << ".hdf5";
+    std::string file_name = tmp_stream.str();
+    if (!std::ifstream(file_name).good()) {
+      std::cerr << "Error: offsets file " << file_name << " not found." <<
+          std::endl;
+      exit(1);
+    }
+    H5::H5File& file = offset_files_[snapnum] = H5::H5File(file_name,
+        H5F_ACC_RDONLY);
+    // The same file offsets are stored in every offsets file.
+    if (file_offsets_.empty()) {
+      H5::DataSet dataset = file.openDataSet("FileOffsets");
+      auto nfiles = dataset.getSpace().getSimpleExtentNpoints();
+      file_offsets_ = read_dataset_rows<int64_t>(file, "FileOffsets", 0, nfiles);
+    }
+    return file;
+  }
+
+  /** Directory containing the "offsets" directory. */
+  std::string treedir_;
+  /** Global row number of the first row of each merger tree file. */
+  std::vector<int64_t> file_offsets_;
+  /** Offsets files, opened on demand. */
+  std::map<snapnum_type, H5::H5File> offset_files_;
+};
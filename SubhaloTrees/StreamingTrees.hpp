@@ -0,0 +1,757 @@
+#pragma once
+/** @file StreamingTrees.hpp
+ * @brief Define a class for constructing SubLink merger trees without
+ *        loading the full subhalo catalog into memory.
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>    // setw
+#include <cassert>
+#include <cstdio>     // remove
+#include <map>
+#include <utility>    // pair
+#include <memory>     // unique_ptr
+#include <algorithm>  // max, min
+#ifdef USE_OPENMP
+#include <omp.h>      // omp_get_max_threads
+#endif
+
+#include "TreesClasses.hpp"
+
+/** @class StreamingTrees
+ * @brief A class for constructing merger trees "out of core."
+ *
+ * The trees are the same as those produced by AllTrees (only the order
+ * of the subtrees within each tree may differ, which is arbitrary anyway),
+ * but subhalos are processed one snapshot at a time, in four passes:
+ *
+ * 1) Forward in time: link subhalos to their descendants, sort progenitors
+ * and FoF group members by mass history, and count the subhalos in each
+ * subtree and main branch. The links of each snapshot are written to a
+ * compact temporary file.
+ *
+ * 2) Backward in time: each subhalo belongs to the subtree of its root
+ * descendant. Subtrees connected through FoF groups are joined into trees
+ * with a union-find structure over the root descendants.
+ *
+ * 3) Backward in time: assign depth-first IDs. A subhalo's ID follows from
+ * that of its descendant and the sizes of the subtrees of its more massive
+ * "siblings." Rows are appended to temporary "bucket" files, each covering
+ * a range of rows of an output file as long as the largest snapshot.
+ *
+ * 4) For each output file: put the rows of each bucket in order and write
+ * them, one bucket after the other.
+ *
+ * Peak memory is given by a few snapshots, a few bytes per root descendant
+ * and one bucket per output file being written, rather than by the full
+ * catalog.
+ */
+class StreamingTrees {
+public:
+  /** @brief Format of the subhalo data (same as AllTrees). */
+  typedef AllTrees::DataFormat DataFormat;
+
+  /** Constructor. Does all the work.
+   *
+   * @param[in] nfiles Number of output files, or zero to choose it
+   *            automatically (see ::partition_trees()).
+   * @param[in] max_file_size Target size of the output files in bytes,
+   *            or zero for no target (see ::partition_trees()).
+   * @param[in] deflate_level Compression level of the output files
+   *            (zero for no compression).
+   * @param[in] max_memory Memory in bytes for the buckets of the output
+   *            files that are written at the same time, or zero to write
+   *            one file per thread.
+   *
+   * @note Temporary files are written next to the output files.
+   */
+  StreamingTrees(const std::string& input_path, const std::string& output_path,
+      const snapnum_type snapnum_first, const snapnum_type snapnum_last,
+      const std::string& skipsnaps_filename, const uint16_t nfiles = 0,
+      const uint64_t max_file_size = 0, const int deflate_level = 0,
+      const uint64_t max_memory = 0)
+      : valid_snapnums_(), nsubs_(snapnum_last+1, 0), root_ids_(),
+        file_tree_offsets_(), file_nsubs_(), bucket_rows_(0),
+        output_path_(output_path) {
+
+    valid_snapnums_ = get_valid_snapnums(skipsnaps_filename,
+        snapnum_first, snapnum_last);
+
+    link_subhalos(input_path);
+    find_trees(nfiles, max_file_size);
+    assign_ids();
+    write_to_files(deflate_level, max_memory);
+  }
+
+private:
+  ///////////////////
+  // PRIVATE TYPES //
+  ///////////////////
+
+  /** @brief Entry in the (ordered) list of progenitors of a subhalo. */
+  struct ProgLink {
+    index_type index;
+    snapnum_type snap;
+    // Number of subhalos in the subtree of this progenitor.
+    uint32_t subtree_size;
+  };
+
+  /** @brief Compact, per-subhalo part of a link table. */
+  struct LinkRecord {
+    sub_len_type num_particles;
+    real_type mass;
+    real_type mass_history;
+    index_type desc_index;
+    snapnum_type desc_snap;
+    index_type first_sub_in_fof;
+    index_type next_sub_in_fof;
+    uint32_t subtree_size;
+    uint32_t main_branch_length;
+    uint32_t nprogs;
+  };
+
+  /** @brief Links of all subhalos from one snapshot. The progenitors of
+   * subhalo @a i are progs[prog_offsets[i] .. prog_offsets[i+1]). */
+  struct LinkTable {
+    std::vector<LinkRecord> records;
+    std::vector<ProgLink> progs;
+    std::vector<uint64_t> prog_offsets;
+  };
+
+  /** @brief A snapshot being linked during the forward pass. Progenitors
+   * are kept along with their (double precision) mass history. */
+  struct ForwardSnapshot {
+    std::vector<LinkRecord> records;
+    std::vector<index_type> group_index;
+    std::vector<uint8_t> skip_snapshot;
+    std::vector<double> mass_history;
+    std::vector<std::vector<std::pair<double, ProgLink>>> progs;
+  };
+
+  /** @brief IDs assigned to the subhalos from one snapshot (-1 if unset). */
+  struct IdTable {
+    std::vector<sub_id_type> id;
+    std::vector<sub_id_type> next_progenitor_id;
+    std::vector<sub_id_type> root_descendant_id;
+  };
+
+  //////////////////////////////
+  // PRIVATE MEMBER FUNCTIONS //
+  //////////////////////////////
+
+  /** @brief Name of the temporary file with the links of a snapshot. */
+  std::string link_table_filename(const snapnum_type snapnum) const {
+    std::stringstream tmp_stream;
+    tmp_stream << output_path_ << ".links_" <<
+        std::setfill('0') << std::setw(3) << snapnum << ".tmp";
+    return tmp_stream.str();
+  }
+
+  /** @brief Name of the temporary file with the rows of an output file
+   *         that belong to a given bucket. */
+  std::string rows_filename(const int64_t filenum, const uint64_t bucket) const {
+    std::stringstream tmp_stream;
+    tmp_stream << output_path_ << "." << filenum << ".rows_" << bucket << ".tmp";
+    return tmp_stream.str();
+  }
+
+  /** @brief Number of buckets of an output file. */
+  uint64_t num_buckets(const int64_t filenum) const {
+    return (file_nsubs_[filenum] + bucket_rows_ - 1) / bucket_rows_;
+  }
+
+  /** @brief Read a descendant file. Subhalos are not linked yet. */
+  ForwardSnapshot read_snapshot(const std::string& input_path,
+      const snapnum_type snapnum) const {
+    ForwardSnapshot cur_snap;
+
+    // Create filename.
+    std::stringstream tmp_stream;
+    tmp_stream << input_path << "_" <<
+        std::setfill('0') << std::setw(3) << snapnum << ".hdf5";
+    std::string desc_filename = tmp_stream.str();
+
+    // Only proceed if current descendant file is non-empty.
+    H5::H5File tmp_file(desc_filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (!H5Lexists(tmp_file.getId(), "/DescendantIndex", H5P_DEFAULT)) {
+      tmp_file.close();
+      return cur_snap;
+    }
+    tmp_file.close();
+
+    // Read info from descendants file
+    auto sub_len = read_dataset<sub_len_type>(desc_filename, "SubhaloLen");
+    auto sub_mass = read_dataset<real_type>(desc_filename, "SubhaloMass");
+    auto desc_index = read_dataset<index_type>(desc_filename, "DescendantIndex");
+    cur_snap.group_index = read_dataset<index_type>(desc_filename, "SubhaloGrNr");
+    cur_snap.skip_snapshot = read_dataset<uint8_t>(desc_filename, "SkipSnapshot");
+
+    uint32_t nsubs = sub_len.size();
+    cur_snap.records.resize(nsubs);
+    for (uint32_t i = 0; i < nsubs; ++i)
+      cur_snap.records[i] = LinkRecord{sub_len[i], sub_mass[i], 0,
+          desc_index[i], -1, -1, -1, 0, 0, 0};
+    cur_snap.mass_history.resize(nsubs, 0);
+    cur_snap.progs.resize(nsubs);
+    return cur_snap;
+  }
+
+  /** @brief Write the links of a snapshot to a temporary file. */
+  void write_link_table(const snapnum_type snapnum,
+      const ForwardSnapshot& cur_snap) const {
+    std::string filename = link_table_filename(snapnum);
+    std::ofstream outfile(filename.data(), std::ios::binary);
+    if (!outfile.is_open()) {
+      std::cerr << "Cannot open file: " << filename << "\n";
+      exit(1);
+    }
+    uint64_t nsubs = cur_snap.records.size();
+    uint64_t nprogs_total = 0;
+    for (auto it = cur_snap.progs.begin(); it != cur_snap.progs.end(); ++it)
+      nprogs_total += it->size();
+
+    outfile.write(reinterpret_cast<const char*>(&nsubs), sizeof(nsubs));
+    outfile.write(reinterpret_cast<const char*>(&nprogs_total),
+        sizeof(nprogs_total));
+    outfile.write(reinterpret_cast<const char*>(cur_snap.records.data()),
+        nsubs*sizeof(LinkRecord));
+    for (auto it1 = cur_snap.progs.begin(); it1 != cur_snap.progs.end(); ++it1)
+      for (auto it2 = it1->begin(); it2 != it1->end(); ++it2)
+        outfile.write(reinterpret_cast<const char*>(&it2->second),
+            sizeof(ProgLink));
+    outfile.close();
+  }
+
+  /** @brief Read the links of a snapshot from its temporary file. */
+  LinkTable read_link_table(const snapnum_type snapnum) const {
+    std::string filename = link_table_filename(snapnum);
+    std::ifstream infile(filename.data(), std::ios::binary);
+    if (!infile.is_open()) {
+      std::cerr << "Cannot open file: " << filename << "\n";
+      exit(1);
+    }
+    uint64_t nsubs, nprogs_total;
+    infile.read(reinterpret_cast<char*>(&nsubs), sizeof(nsubs));
+    infile.read(reinterpret_cast<char*>(&nprogs_total), sizeof(nprogs_total));
+
+    LinkTable table;
+    table.records.resize(nsubs);
+    table.progs.resize(nprogs_total);
+    infile.read(reinterpret_cast<char*>(table.records.data()),
+        nsubs*sizeof(LinkRecord));
+    infile.read(reinterpret_cast<char*>(table.progs.data()),
+        nprogs_total*sizeof(ProgLink));
+    assert(infile.good());
+    infile.close();
+
+    table.prog_offsets.resize(nsubs+1, 0);
+    for (uint64_t i = 0; i < nsubs; ++i)
+      table.prog_offsets[i+1] = table.prog_offsets[i] + table.records[i].nprogs;
+    assert(table.prog_offsets.back() == nprogs_total);
+    return table;
+  }
+
+  /** @brief First pass (forward in time). Create progenitor/descendant
+   *         and FoF group links, and write them to temporary files.
+   *
+   * When a snapshot is reached, all of its progenitors (from the previous
+   * one or two snapshots) have already been linked, so its mass histories,
+   * FoF ordering and subtree sizes are final. Only the current snapshot,
+   * the two before it and the two after it are kept in memory.
+   */
+  void link_subhalos(const std::string& input_path) {
+    std::cout << "Creating links between subhalos...\n";
+    WallClock wall_clock;
+
+    const int64_t nvalid = valid_snapnums_.size();
+    std::map<snapnum_type, ForwardSnapshot> window;
+    for (int64_t k = 0; k < nvalid; ++k) {
+      auto cur_snapnum = valid_snapnums_[k];
+      if (window.count(cur_snapnum) == 0)
+        window[cur_snapnum] = read_snapshot(input_path, cur_snapnum);
+      auto& cur_snap = window[cur_snapnum];
+      auto& records = cur_snap.records;
+      uint32_t nsubs = records.size();
+      nsubs_[cur_snapnum] = nsubs;
+
+      // MassHistory is the mass history of the first progenitor plus Mass.
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles == 0)
+          continue;
+        auto& cur_progs = cur_snap.progs[i];
+        double mass_history = cur_progs.empty() ? 0 : cur_progs.front().first;
+        cur_snap.mass_history[i] = mass_history + records[i].mass;
+        records[i].mass_history = cur_snap.mass_history[i];
+      }
+
+      // Establish links between subhalos in the same FoF group, which are
+      // also ordered by their mass history.
+      std::vector<index_type> main_sub_in_fof_group;
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles == 0)
+          continue;
+        uint32_t group_index = cur_snap.group_index[i];
+        if (group_index+1 > main_sub_in_fof_group.size())
+          main_sub_in_fof_group.resize(group_index+1, -1);
+
+        auto& cur_main_sub = main_sub_in_fof_group[group_index];
+        if (cur_main_sub == -1) {
+          cur_main_sub = i;
+          continue;
+        }
+        const auto& mass_history = cur_snap.mass_history;
+        if (mass_history[i] > mass_history[cur_main_sub]) {
+          records[i].next_sub_in_fof = cur_main_sub;
+          cur_main_sub = i;
+        }
+        else {
+          auto prev_sub = cur_main_sub;
+          auto next_sub = records[cur_main_sub].next_sub_in_fof;
+          while ((next_sub != -1) && !(mass_history[i] > mass_history[next_sub])) {
+            prev_sub = next_sub;
+            next_sub = records[next_sub].next_sub_in_fof;
+          }
+          records[prev_sub].next_sub_in_fof = i;
+          records[i].next_sub_in_fof = next_sub;
+        }
+      }
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles > 0)
+          records[i].first_sub_in_fof =
+              main_sub_in_fof_group[cur_snap.group_index[i]];
+      }
+
+      // Count subhalos in each subtree and main branch. The progenitors
+      // belong to earlier snapshots, which are already final.
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles == 0)
+          continue;
+        auto& cur_progs = cur_snap.progs[i];
+        records[i].subtree_size = 1;
+        records[i].main_branch_length = 1;
+        records[i].nprogs = cur_progs.size();
+        for (auto it = cur_progs.begin(); it != cur_progs.end(); ++it) {
+          auto& prog_link = it->second;
+          const auto& prog = window.at(prog_link.snap).records[prog_link.index];
+          prog_link.subtree_size = prog.subtree_size;
+          records[i].subtree_size += prog.subtree_size;
+          if (it == cur_progs.begin())
+            records[i].main_branch_length += prog.main_branch_length;
+        }
+      }
+
+      // Link to descendants, which are found one or two snapshots later.
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        auto& cur_prog = records[i];
+        if ((cur_prog.num_particles == 0) || (cur_prog.desc_index == -1))
+          continue;
+        if (k+1 == nvalid) {
+          // Descendants beyond the last snapshot are ignored.
+          cur_prog.desc_index = -1;
+          continue;
+        }
+        snapnum_type desc_snapnum;
+        if (cur_snap.skip_snapshot[i] == 0) {
+          desc_snapnum = valid_snapnums_[k+1];
+        }
+        else {
+          assert(cur_snap.skip_snapshot[i] == 1);
+          assert(k+2 < nvalid);
+          desc_snapnum = valid_snapnums_[k+2];
+        }
+        if (window.count(desc_snapnum) == 0)
+          window[desc_snapnum] = read_snapshot(input_path, desc_snapnum);
+        auto& desc_snap = window[desc_snapnum];
+        assert(static_cast<std::size_t>(cur_prog.desc_index) <
+            desc_snap.records.size());
+        assert(desc_snap.records[cur_prog.desc_index].num_particles > 0);
+        cur_prog.desc_snap = desc_snapnum;
+
+        // The progenitors of a subhalo are ordered by their mass history.
+        // Put cur_prog in its proper "place."
+        auto& desc_progs = desc_snap.progs[cur_prog.desc_index];
+        auto pos = desc_progs.begin();
+        while ((pos != desc_progs.end()) &&
+            !(cur_snap.mass_history[i] > pos->first))
+          ++pos;
+        desc_progs.insert(pos, std::make_pair(cur_snap.mass_history[i],
+            ProgLink{static_cast<index_type>(i), cur_snapnum, 0}));
+      }
+
+      write_link_table(cur_snapnum, cur_snap);
+
+      // The next snapshot only needs its potential progenitors.
+      if (k >= 2)
+        window.erase(valid_snapnums_[k-2]);
+    }
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+  }
+
+  /** @brief Find the representative element of a union-find set. */
+  static uint64_t find_set(std::vector<uint64_t>& parent, uint64_t x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+    }
+    return x;
+  }
+
+  /** @brief Second pass (backward in time). Group subtrees into trees,
+   *         distribute the trees among files, and assign an ID to
+   *         every root descendant.
+   */
+  void find_trees(const uint16_t nfiles, const uint64_t max_file_size) {
+    std::cout << "Constructing trees...\n";
+    WallClock wall_clock;
+
+    // Root descendants are numbered in order of appearance (backward in
+    // time, then by Subfind ID). Subhalos are labeled by their root.
+    std::vector<uint64_t> parent;
+    std::vector<uint32_t> root_nsubs;
+    std::map<snapnum_type, std::vector<uint64_t>> labels;
+    const int64_t nvalid = valid_snapnums_.size();
+    for (int64_t k = nvalid-1; k >= 0; --k) {
+      auto cur_snapnum = valid_snapnums_[k];
+      auto table = read_link_table(cur_snapnum);
+      auto& records = table.records;
+      uint32_t nsubs = records.size();
+      auto& cur_labels = labels[cur_snapnum];
+      cur_labels.resize(nsubs, UINT64_MAX);
+
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles == 0)
+          continue;
+        if (records[i].desc_index == -1) {
+          cur_labels[i] = parent.size();
+          parent.push_back(parent.size());
+          root_nsubs.push_back(records[i].subtree_size);
+        }
+        else {
+          cur_labels[i] = labels.at(records[i].desc_snap)[records[i].desc_index];
+          assert(cur_labels[i] != UINT64_MAX);
+        }
+      }
+      // Subhalos from the same FoF group belong to the same tree.
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles == 0)
+          continue;
+        auto root1 = find_set(parent, cur_labels[i]);
+        auto root2 = find_set(parent, cur_labels[records[i].first_sub_in_fof]);
+        if (root1 != root2)
+          parent[std::max(root1, root2)] = std::min(root1, root2);
+      }
+      if (k+2 < nvalid)
+        labels.erase(valid_snapnums_[k+2]);
+    }
+    labels.clear();
+    const uint64_t nroots = parent.size();
+
+    // Number trees by their first root descendant.
+    std::vector<uint64_t> root_tree(nroots);
+    std::vector<uint64_t> tree_nsubs;
+    for (uint64_t r = 0; r < nroots; ++r) {
+      auto root = find_set(parent, r);
+      if (root == r) {
+        root_tree[r] = tree_nsubs.size();
+        tree_nsubs.push_back(0);
+      }
+      else {
+        assert(root < r);
+        root_tree[r] = root_tree[root];
+      }
+      tree_nsubs[root_tree[r]] += root_nsubs[r];
+    }
+    std::vector<uint64_t>().swap(parent);
+    const uint64_t ntrees = tree_nsubs.size();
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+
+    // Sort trees by decreasing size and decide which go into each file.
+    std::cout << "Distributing " << ntrees << " trees among files...\n";
+    wall_clock.start();
+    std::vector<uint64_t> tree_order(ntrees);
+    for (uint64_t t = 0; t < ntrees; ++t)
+      tree_order[t] = t;
+    std::stable_sort(tree_order.begin(), tree_order.end(),
+        [&](const uint64_t t1, const uint64_t t2) {
+            return tree_nsubs[t1] > tree_nsubs[t2];
+    });
+    std::vector<uint64_t> sorted_nsubs(ntrees);
+    for (uint64_t t = 0; t < ntrees; ++t)
+      sorted_nsubs[t] = tree_nsubs[tree_order[t]];
+    auto tree_indices = partition_trees(sorted_nsubs, nfiles, max_file_size,
+        sizeof(DataFormat));
+    const int64_t nfiles_out = tree_indices.size();
+
+    // Assign tree IDs, and row offsets of the trees within each file.
+    std::vector<tree_id_type> tree_ids(ntrees, -1);
+    file_tree_offsets_.resize(nfiles_out);
+    file_nsubs_.resize(nfiles_out, 0);
+    for (int64_t filenum = 0; filenum < nfiles_out; ++filenum) {
+      auto& cur_indices = tree_indices[filenum];
+      for (uint64_t tree_count = 0; tree_count < cur_indices.size(); ++tree_count) {
+        auto t = tree_order[cur_indices[tree_count]];
+        tree_ids[t] = filenum*pow_10_16 + tree_count*pow_10_8;
+        file_tree_offsets_[filenum].push_back(file_nsubs_[filenum]);
+        file_nsubs_[filenum] += tree_nsubs[t];
+      }
+    }
+
+    // The subtrees of each tree are laid out one after the other.
+    std::vector<uint64_t> tree_fill(ntrees, 0);
+    root_ids_.resize(nroots);
+    for (uint64_t r = 0; r < nroots; ++r) {
+      auto t = root_tree[r];
+      root_ids_[r] = tree_ids[t] + tree_fill[t];
+      tree_fill[t] += root_nsubs[r];
+    }
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+  }
+
+  /** @brief Third pass (backward in time). Assign depth-first IDs and
+   *         write the rows of each output file to temporary bucket files.
+   *
+   * The first progenitor of a subhalo comes right after it, and every
+   * other progenitor comes after the subtree of the previous one.
+   *
+   * The rows of each snapshot are grouped by bucket in memory and then
+   * appended to the bucket files, so that only one of them is open at
+   * a time.
+   */
+  void assign_ids() {
+    std::cout << "Assigning unique IDs...\n";
+    WallClock wall_clock;
+
+    // Buckets are as long as the largest snapshot (in whole batches), so
+    // there are at most as many buckets as snapshots plus output files.
+    const uint64_t rows_per_batch = rows_per_chunk * chunks_per_batch;
+    const uint64_t max_nsubs = *std::max_element(nsubs_.begin(), nsubs_.end());
+    bucket_rows_ = std::max<uint64_t>(1,
+        (max_nsubs + rows_per_batch - 1) / rows_per_batch) * rows_per_batch;
+
+    // Create empty bucket files.
+    const int64_t nfiles_out = file_nsubs_.size();
+    for (int64_t filenum = 0; filenum < nfiles_out; ++filenum) {
+      for (uint64_t bucket = 0; bucket < num_buckets(filenum); ++bucket) {
+        std::string filename = rows_filename(filenum, bucket);
+        std::ofstream outfile(filename.data(), std::ios::binary);
+        if (!outfile.is_open()) {
+          std::cerr << "Cannot open file: " << filename << "\n";
+          exit(1);
+        }
+      }
+    }
+
+    std::map<snapnum_type, IdTable> ids;
+    auto get_ids = [&](const snapnum_type snapnum) -> IdTable& {
+      auto it = ids.find(snapnum);
+      if (it != ids.end())
+        return it->second;
+      auto& cur_ids = ids[snapnum];
+      cur_ids.id.resize(nsubs_[snapnum], -1);
+      cur_ids.next_progenitor_id.resize(nsubs_[snapnum], -1);
+      cur_ids.root_descendant_id.resize(nsubs_[snapnum], -1);
+      return cur_ids;
+    };
+
+    uint64_t root_count = 0;
+    const int64_t nvalid = valid_snapnums_.size();
+    for (int64_t k = nvalid-1; k >= 0; --k) {
+      auto cur_snapnum = valid_snapnums_[k];
+      auto table = read_link_table(cur_snapnum);
+      std::remove(link_table_filename(cur_snapnum).data());
+      auto& records = table.records;
+      uint32_t nsubs = records.size();
+      auto& cur_ids = get_ids(cur_snapnum);
+
+      // Root descendants are visited in the same order as in find_trees().
+      // Other subhalos got their IDs from their descendants.
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles == 0)
+          continue;
+        if (records[i].desc_index == -1) {
+          cur_ids.id[i] = root_ids_[root_count];
+          cur_ids.root_descendant_id[i] = cur_ids.id[i];
+          ++root_count;
+        }
+        assert(cur_ids.id[i] != -1);
+      }
+
+      // Pass IDs on to progenitors.
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        if (records[i].num_particles == 0)
+          continue;
+        sub_id_type next_id = cur_ids.id[i] + 1;
+        const ProgLink* prev_prog = nullptr;
+        for (auto j = table.prog_offsets[i]; j < table.prog_offsets[i+1]; ++j) {
+          const auto& prog = table.progs[j];
+          auto& prog_ids = get_ids(prog.snap);
+          prog_ids.id[prog.index] = next_id;
+          prog_ids.root_descendant_id[prog.index] = cur_ids.root_descendant_id[i];
+          if (prev_prog != nullptr)
+            get_ids(prev_prog->snap).next_progenitor_id[prev_prog->index] = next_id;
+          prev_prog = &prog;
+          next_id += prog.subtree_size;
+        }
+        assert(next_id == cur_ids.id[i] + records[i].subtree_size);
+      }
+
+      // Write rows, grouped by (file, bucket).
+      std::map<std::pair<int64_t, uint64_t>, std::vector<char>> bucket_data;
+      for (uint32_t i = 0; i < nsubs; ++i) {
+        const auto& rec = records[i];
+        if (rec.num_particles == 0)
+          continue;
+        sub_id_type id = cur_ids.id[i];
+        sub_id_type desc_id = (rec.desc_index == -1) ? -1 :
+            ids.at(rec.desc_snap).id[rec.desc_index];
+        DataFormat row(id, pow_10_12*cur_snapnum + i,
+            id + rec.subtree_size - 1, id + rec.main_branch_length - 1,
+            cur_ids.root_descendant_id[i], id - id % pow_10_8, cur_snapnum,
+            (rec.nprogs > 0) ? id + 1 : -1, cur_ids.next_progenitor_id[i],
+            desc_id, cur_ids.id[rec.first_sub_in_fof],
+            (rec.next_sub_in_fof == -1) ? -1 : cur_ids.id[rec.next_sub_in_fof],
+            rec.num_particles, rec.mass, rec.mass_history, i);
+
+        int64_t filenum = id / pow_10_16;
+        uint64_t tree_count = (id % pow_10_16) / pow_10_8;
+        uint64_t rownum = file_tree_offsets_[filenum][tree_count] + id % pow_10_8;
+        auto& data = bucket_data[std::make_pair(filenum, rownum / bucket_rows_)];
+        const char* rownum_bytes = reinterpret_cast<const char*>(&rownum);
+        const char* row_bytes = reinterpret_cast<const char*>(&row);
+        data.insert(data.end(), rownum_bytes, rownum_bytes + sizeof(rownum));
+        data.insert(data.end(), row_bytes, row_bytes + sizeof(DataFormat));
+      }
+      for (auto it = bucket_data.begin(); it != bucket_data.end(); ++it) {
+        std::string filename = rows_filename(it->first.first, it->first.second);
+        std::ofstream outfile(filename.data(), std::ios::binary | std::ios::app);
+        if (!outfile.is_open()) {
+          std::cerr << "Cannot open file: " << filename << "\n";
+          exit(1);
+        }
+        outfile.write(it->second.data(), it->second.size());
+      }
+
+      // The next snapshot only needs its potential descendants.
+      if (k+2 < nvalid)
+        ids.erase(valid_snapnums_[k+2]);
+    }
+    assert(root_count == root_ids_.size());
+    std::vector<sub_id_type>().swap(root_ids_);
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+  }
+
+  /** @brief Fourth pass. Put the rows of each file in order and write
+   *         them, one bucket at a time.
+   *
+   * Rows are put in place outside of H5Lock, so that one thread reads
+   * and sorts a bucket while another one writes.
+   *
+   * @param[in] deflate_level Compression level (zero for no compression).
+   * @param[in] max_memory Memory in bytes for the buckets of the files
+   *            that are written at the same time (zero for no limit).
+   */
+  void write_to_files(const int deflate_level, const uint64_t max_memory) const {
+    const int64_t nfiles_out = file_nsubs_.size();
+    const uint64_t rows_per_batch = rows_per_chunk * chunks_per_batch;
+
+    // Number of files in flight.
+    int nthreads = 1;
+#ifdef USE_OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    const uint64_t bucket_size = bucket_rows_ * sizeof(DataFormat);
+    if (max_memory > 0)
+      nthreads = std::max<uint64_t>(1,
+          std::min<uint64_t>(nthreads, max_memory / bucket_size));
+    std::cout << "Writing to " << nfiles_out << " files (" << nthreads <<
+        " at a time, " << bucket_size / (1024*1024) << " MB each)...\n";
+    WallClock wall_clock;
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (int64_t filenum = 0; filenum < nfiles_out; ++filenum) {
+      const uint64_t nsubs = file_nsubs_[filenum];
+
+      // Create filename
+      std::stringstream tmp_stream;
+      tmp_stream << output_path_ << "." << filenum << ".hdf5";
+
+      // HDF5 objects are created and destroyed while holding an H5Lock.
+      std::unique_ptr<H5::H5File> writefile;
+      std::unique_ptr<DatasetWriter<DataFormat>> writer;
+      {
+        H5Lock lock;
+        writefile.reset(new H5::H5File(tmp_stream.str(), H5F_ACC_TRUNC));
+        writer.reset(new DatasetWriter<DataFormat>(*writefile, "Tree",
+            AllTrees::H5DataFormat(), nsubs, rows_per_chunk, deflate_level));
+      }
+
+      std::vector<char> rows(std::min(nsubs, bucket_rows_) * sizeof(DataFormat));
+      for (uint64_t bucket = 0; bucket < num_buckets(filenum); ++bucket) {
+        // Read rows from temporary file and put them in place.
+        const uint64_t first_row = bucket * bucket_rows_;
+        const uint64_t nrows = std::min(bucket_rows_, nsubs - first_row);
+        std::string filename = rows_filename(filenum, bucket);
+        std::ifstream infile(filename.data(), std::ios::binary);
+        if (!infile.is_open()) {
+          std::cerr << "Cannot open file: " << filename << "\n";
+          exit(1);
+        }
+        uint64_t rownum, nrows_read = 0;
+        while (infile.read(reinterpret_cast<char*>(&rownum), sizeof(rownum))) {
+          assert((rownum >= first_row) && (rownum < first_row + nrows));
+          infile.read(&rows[(rownum - first_row)*sizeof(DataFormat)],
+              sizeof(DataFormat));
+          ++nrows_read;
+        }
+        assert(nrows_read == nrows);
+        infile.close();
+        std::remove(filename.data());
+
+        // Write in batches, so that other files get their turn.
+        const DataFormat* data = reinterpret_cast<const DataFormat*>(rows.data());
+        for (uint64_t pos = 0; pos < nrows; pos += rows_per_batch) {
+          H5Lock lock;
+          writer->write(data + pos, std::min(rows_per_batch, nrows - pos));
+        }
+      }
+
+      {
+        H5Lock lock;
+        assert(writer->complete());
+        writer.reset();
+        writefile->close();
+        writefile.reset();
+      }
+    }
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
+  }
+
+  //////////////////////////////
+  // PRIVATE MEMBER VARIABLES //
+  //////////////////////////////
+
+  /** Snapshots to be processed, in increasing order. */
+  std::vector<snapnum_type> valid_snapnums_;
+
+  /** Number of subhalos (including empty ones) in each snapshot. */
+  std::vector<uint32_t> nsubs_;
+
+  /** ID of each root descendant, in order of appearance. */
+  std::vector<sub_id_type> root_ids_;
+
+  /** For each output file, the row at which each of its trees begins. */
+  std::vector<std::vector<uint64_t>> file_tree_offsets_;
+
+  /** Number of subhalos in each output file. */
+  std::vector<uint64_t> file_nsubs_;
+
+  /** Number of rows of an output file per temporary bucket file. */
+  uint64_t bucket_rows_;
+
+  /** Path of the output files, excluding ".N.hdf5". */
+  std::string output_path_;
+};
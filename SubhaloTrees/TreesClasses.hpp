@@ -12,6 +12,11 @@
 #include <fstream>
 #include <cassert>
 #include <algorithm>  // sort
+#include <queue>      // priority_queue
+#include <functional> // greater
+#include <cstdint>    // INT64_MAX
+#include <memory>     // unique_ptr
+#include <future>     // async
 
 #include "../InputOutput/GeneralHDF5.hpp"
 #include "../Util/SnapshotUtil.hpp"
@@ -22,6 +27,90 @@ static constexpr int64_t pow_10_8  = 100000000;
 static constexpr int64_t pow_10_12 = 1000000000000;
 static constexpr int64_t pow_10_16 = 10000000000000000;
 
+// Layout of the output tree files: rows per HDF5 chunk, and chunks per
+// batch of rows kept in memory (per file) while writing.
+static constexpr uint64_t rows_per_chunk = 8192;
+static constexpr uint64_t chunks_per_batch = 32;
+
+/** @brief Distribute trees among output files.
+ *
+ * Trees are taken in order of decreasing size and each one goes into the
+ * output file with the fewest subhalos so far (greedy "worst-fit
+ * decreasing" bin packing), which results in files of similar size.
+ *
+ * @param[in] tree_nsubs Number of subhalos in each tree.
+ * @param[in] nfiles Number of output files. If zero, it is determined by
+ *            @a max_file_size or, if that is also zero, by the size of
+ *            the largest tree (as many files as copies of the largest
+ *            tree that fit into the full catalog).
+ * @param[in] max_file_size Target size of each file in bytes (zero for
+ *            no target). A new file is opened whenever a tree does not
+ *            fit into any of the existing ones. Trees larger than the
+ *            target size are written to their own file.
+ * @param[in] row_size Size in bytes of one subhalo in the output files.
+ * @return For each file, the indices of the trees that go into it,
+ *         in increasing order.
+ *
+ * @pre @a tree_nsubs is sorted in decreasing order and has no zeros.
+ */
+std::vector<std::vector<uint64_t>> partition_trees(
+    const std::vector<uint64_t>& tree_nsubs, const uint16_t nfiles,
+    const uint64_t max_file_size, const std::size_t row_size) {
+  const uint64_t ntrees = tree_nsubs.size();
+  assert(ntrees > 0);
+  uint64_t nsubs_total = 0;
+  for (auto it = tree_nsubs.begin(); it != tree_nsubs.end(); ++it)
+    nsubs_total += *it;
+
+  // Maximum number of subhalos per file, if any.
+  uint64_t max_nsubs_per_file = 0;
+  if (max_file_size > 0)
+    max_nsubs_per_file = std::max<uint64_t>(1, max_file_size / row_size);
+
+  // Initial number of files.
+  uint64_t nfiles_init = nfiles;
+  if (nfiles_init == 0) {
+    uint64_t nsubs_per_file = max_nsubs_per_file;
+    if (nsubs_per_file == 0)
+      nsubs_per_file = tree_nsubs.front();
+    nfiles_init = (nsubs_total + nsubs_per_file - 1) / nsubs_per_file;
+  }
+  nfiles_init = std::max<uint64_t>(1, std::min(nfiles_init, ntrees));
+
+  // Keep files in a min-heap ordered by (number of subhalos, filenum).
+  typedef std::pair<uint64_t, uint64_t> file_load;
+  std::priority_queue<file_load, std::vector<file_load>,
+      std::greater<file_load>> heap;
+  for (uint64_t filenum = 0; filenum < nfiles_init; ++filenum)
+    heap.emplace(0, filenum);
+  std::vector<std::vector<uint64_t>> trees_in_file(nfiles_init);
+
+  for (uint64_t tree_index = 0; tree_index < ntrees; ++tree_index) {
+    uint64_t cur_nsubs = tree_nsubs[tree_index];
+    auto least_loaded = heap.top();
+    // Open a new file if the tree does not fit into the emptiest one.
+    if ((max_nsubs_per_file > 0) && (least_loaded.first > 0) &&
+        (least_loaded.first + cur_nsubs > max_nsubs_per_file)) {
+      least_loaded = file_load(0, trees_in_file.size());
+      trees_in_file.emplace_back();
+    }
+    else {
+      heap.pop();
+    }
+    trees_in_file[least_loaded.second].push_back(tree_index);
+    heap.emplace(least_loaded.first + cur_nsubs, least_loaded.second);
+  }
+
+  // Sanity checks. IDs have the form filenum*10^16 + tree*10^8 + row.
+  assert(trees_in_file.size() <= static_cast<uint64_t>(INT64_MAX / pow_10_16));
+  for (auto file_it = trees_in_file.begin(); file_it != trees_in_file.end();
+      ++file_it)
+    assert(file_it->size() < static_cast<uint64_t>(pow_10_16 / pow_10_8));
+  assert(static_cast<int64_t>(tree_nsubs.front()) < pow_10_8);
+
+  return trees_in_file;
+}
+
 /** @class AllTrees
  * @brief A class for constructing merger trees.
  */
@@ -82,6 +171,34 @@ public:
           MassHistory(sub->mass_history),
           SubfindID(sub->index) {
     }
+
+    /** @brief Construct a DataFormat object from its individual fields,
+     *         given in the same order as they are declared.
+     */
+    DataFormat(sub_id_type SubhaloID_, sub_id_type SubhaloIDRaw_,
+        sub_id_type LastProgenitorID_, sub_id_type MainLeafProgenitorID_,
+        sub_id_type RootDescendantID_, tree_id_type TreeID_, int64_t SnapNum_,
+        sub_id_type FirstProgenitorID_, sub_id_type NextProgenitorID_,
+        sub_id_type DescendantID_, sub_id_type FirstSubhaloInFOFGroupID_,
+        sub_id_type NextSubhaloInFOFGroupID_, sub_len_type NumParticles_,
+        real_type Mass_, real_type MassHistory_, index_type SubfindID_)
+        : SubhaloID(SubhaloID_),
+          SubhaloIDRaw(SubhaloIDRaw_),
+          LastProgenitorID(LastProgenitorID_),
+          MainLeafProgenitorID(MainLeafProgenitorID_),
+          RootDescendantID(RootDescendantID_),
+          TreeID(TreeID_),
+          SnapNum(SnapNum_),
+          FirstProgenitorID(FirstProgenitorID_),
+          NextProgenitorID(NextProgenitorID_),
+          DescendantID(DescendantID_),
+          FirstSubhaloInFOFGroupID(FirstSubhaloInFOFGroupID_),
+          NextSubhaloInFOFGroupID(NextSubhaloInFOFGroupID_),
+          NumParticles(NumParticles_),
+          Mass(Mass_),
+          MassHistory(MassHistory_),
+          SubfindID(SubfindID_) {
+    }
   };
 
   /** @brief Format of the subhalo data, HDF5 version. */
@@ -111,10 +228,19 @@ public:
   // CONSTRUCTOR AND DESTRUCTOR //
   ////////////////////////////////
 
-  /** Constructor. Does all the work. */
+  /** Constructor. Does all the work.
+   *
+   * @param[in] nfiles Number of output files, or zero to choose it
+   *            automatically (see ::partition_trees()).
+   * @param[in] max_file_size Target size of the output files in bytes,
+   *            or zero for no target (see ::partition_trees()).
+   * @param[in] deflate_level Compression level of the output files
+   *            (zero for no compression).
+   */
   AllTrees(const std::string& input_path, const std::string& output_path,
       const snapnum_type snapnum_first, const snapnum_type snapnum_last,
-      const std::string& skipsnaps_filename)
+      const std::string& skipsnaps_filename, const uint16_t nfiles = 0,
+      const uint64_t max_file_size = 0, const int deflate_level = 0)
       : subhalos_(), trees_() {
 
     // Create subhalo objects.
@@ -125,7 +251,7 @@ public:
     second_pass();
 
     // Assign IDs and write to files.
-    write_to_files(output_path);
+    write_to_files(output_path, nfiles, max_file_size, deflate_level);
   }
 
   /** Destructor. */
@@ -618,8 +744,80 @@ private:
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
   }
 
-  /** @brief Assign unique IDs and write to files. */
-  void write_to_files(const std::string& writepath) {
+  /** @brief Write the given trees to a single file.
+   *
+   * Rows are converted to DataFormat in batches of bounded size. Each batch
+   * is written to a chunked dataset by a helper thread while the next one
+   * is being filled, so that building rows and writing them overlap.
+   *
+   * @param[in] writefilename Path of the output file.
+   * @param[in] cur_trees Trees that go into this file, in order.
+   * @param[in] nsubs Total number of subhalos in @a cur_trees.
+   * @param[in] deflate_level Compression level (zero for no compression).
+   */
+  void write_tree_file(const std::string& writefilename,
+      const std::vector<internal_tree*>& cur_trees, const uint64_t nsubs,
+      const int deflate_level) const {
+    // HDF5 objects are created and destroyed while holding an H5Lock.
+    std::unique_ptr<H5::H5File> writefile;
+    std::unique_ptr<DatasetWriter<DataFormat>> writer;
+    {
+      H5Lock lock;
+      writefile.reset(new H5::H5File(writefilename, H5F_ACC_TRUNC));
+      writer.reset(new DatasetWriter<DataFormat>(*writefile, "Tree",
+          H5DataFormat(), nsubs, rows_per_chunk, deflate_level));
+    }
+
+    // Batch being filled, and batch being written.
+    const uint64_t rows_per_batch = rows_per_chunk * chunks_per_batch;
+    std::vector<DataFormat> batch;
+    std::vector<DataFormat> pending;
+    batch.reserve(std::min(nsubs, rows_per_batch));
+    std::future<void> in_flight;
+    auto write_pending = [&]() {
+      H5Lock lock;
+      writer->write(pending);
+    };
+
+    for (auto tree_it = cur_trees.begin(); tree_it != cur_trees.end();
+        ++tree_it) {
+      auto cur_tree = *tree_it;
+      for (auto sub_it = cur_tree->subhalos.begin();
+          sub_it != cur_tree->subhalos.end(); ++sub_it) {
+        auto cur_sub = *sub_it;
+        assert(cur_sub != nullptr);
+        batch.emplace_back(cur_sub);
+        if (batch.size() == rows_per_batch) {
+          if (in_flight.valid())
+            in_flight.get();
+          batch.swap(pending);
+          batch.clear();
+          in_flight = std::async(std::launch::async, write_pending);
+        }
+      }
+    }
+    if (in_flight.valid())
+      in_flight.get();
+    batch.swap(pending);
+    write_pending();
+
+    {
+      H5Lock lock;
+      assert(writer->complete());
+      writer.reset();
+      writefile->close();
+      writefile.reset();
+    }
+  }
+
+  /** @brief Assign unique IDs and write to files.
+   * @param[in] writepath Path of the output files, excluding ".N.hdf5".
+   * @param[in] nfiles Number of output files (see ::partition_trees()).
+   * @param[in] max_file_size Target file size in bytes (see ::partition_trees()).
+   * @param[in] deflate_level Compression level (zero for no compression).
+   */
+  void write_to_files(const std::string& writepath, const uint16_t nfiles,
+      const uint64_t max_file_size, const int deflate_level) {
     // Sort trees by decreasing size.
     std::cout << "Sorting trees by size...\n";
     WallClock wall_clock;
@@ -637,89 +835,56 @@ private:
     }
     uint64_t ntrees = trees_.size();
 
-    // Size of first tree determines approximate file size.
-    // We make sure that no tree file is larger than the first one.
-    // (alternatively, set max_nsubs_per_file to desired value, or 
-    // increase 1 to e.g. 5 or 10 to proportionally lower the number 
-    // of output file chunks written)
-    uint64_t max_nsubs_per_file = trees_.front()->subhalos.size() * 1;
-
-    // Assign tree and subhalo IDs and determine which are the first
-    // and last trees that go into each file.
-    std::cout << "Assigning unique IDs...\n";
+    // Decide which trees go into each file.
+    std::cout << "Distributing trees among files...\n";
     wall_clock.start();
-    std::vector<uint64_t> last_tree_in_file;
-    std::vector<uint64_t> nsubs_per_file;
-    int16_t filenum = 0;
-    uint64_t tree_count = 0;
-    uint64_t nsubs_in_cur_file = 0;
-    for (uint64_t tree_index = 0; tree_index < ntrees; ++tree_index) {
-      auto cur_tree = trees_[tree_index];
-      // Assign IDs
-      cur_tree->id = filenum*pow_10_16 + tree_count*pow_10_8;
-      uint64_t subhalo_count = 0;
-      for (auto sub_it = cur_tree->subhalos.begin();
-          sub_it != cur_tree->subhalos.end(); ++sub_it) {
-        auto cur_sub = *sub_it;
-        assert(cur_sub != nullptr);
-        cur_sub->id = cur_tree->id + subhalo_count;
-        ++subhalo_count;
-      }
-      ++tree_count;
-      // Check if this is the last tree that goes into the current file.
-      nsubs_in_cur_file += cur_tree->subhalos.size();
-      if (nsubs_in_cur_file + cur_tree->subhalos.size() >= max_nsubs_per_file || 
-          (filenum == 0 && tree_index == ntrees-1) ) {
-        last_tree_in_file.push_back(tree_index);
-        nsubs_per_file.push_back(nsubs_in_cur_file);
-        nsubs_in_cur_file = 0;
-        tree_count = 0;
-        ++filenum;
-      }
-    }
-    // Put remaining trees, if any, into one last file.
-    if (last_tree_in_file.back() != ntrees-1) {
-      last_tree_in_file.push_back(ntrees-1);
-      nsubs_per_file.push_back(nsubs_in_cur_file);
-    }
-    // Determine the first tree that goes into each file.
-    std::vector<uint64_t> first_tree_in_file = {0};
-    uint16_t nfiles = last_tree_in_file.size();
-    for (filenum = 0; filenum < nfiles-1; ++filenum) {
-      first_tree_in_file.push_back(last_tree_in_file[filenum]+1);
-    }
+    std::vector<uint64_t> tree_nsubs(ntrees);
+    for (uint64_t tree_index = 0; tree_index < ntrees; ++tree_index)
+      tree_nsubs[tree_index] = trees_[tree_index]->subhalos.size();
+    auto tree_indices = partition_trees(tree_nsubs, nfiles, max_file_size,
+        sizeof(DataFormat));
+    const int64_t nfiles_out = tree_indices.size();
+    std::vector<std::vector<internal_tree*>> trees_in_file(nfiles_out);
+    for (int64_t filenum = 0; filenum < nfiles_out; ++filenum)
+      for (auto it = tree_indices[filenum].begin();
+          it != tree_indices[filenum].end(); ++it)
+        trees_in_file[filenum].push_back(trees_[*it]);
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
-    // Write to files.
-    std::cout << "Writing " << ntrees << " trees to " << nfiles << " files...\n";
+    // Assign tree and subhalo IDs.
+    std::cout << "Assigning unique IDs...\n";
     wall_clock.start();
-    for (filenum = 0; filenum < nfiles; ++filenum) {
-
-      // Create filename
-      std::stringstream tmp_stream;
-      tmp_stream << writepath << "." << filenum << ".hdf5";
-      std::string writefilename = tmp_stream.str();
-
-      // Create array with tree data.
-      std::vector<DataFormat> treedata;
-      treedata.reserve(nsubs_per_file[filenum]);
-      for (uint64_t tree_index = first_tree_in_file[filenum];
-           tree_index <= last_tree_in_file[filenum]; ++tree_index) {
-        assert(tree_index < trees_.size());
-        auto& cur_tree = trees_[tree_index];
+    std::vector<uint64_t> nsubs_per_file(nfiles_out, 0);
+    for (int64_t filenum = 0; filenum < nfiles_out; ++filenum) {
+      auto& cur_trees = trees_in_file[filenum];
+      for (uint64_t tree_count = 0; tree_count < cur_trees.size(); ++tree_count) {
+        auto cur_tree = cur_trees[tree_count];
+        cur_tree->id = filenum*pow_10_16 + tree_count*pow_10_8;
+        uint64_t subhalo_count = 0;
         for (auto sub_it = cur_tree->subhalos.begin();
             sub_it != cur_tree->subhalos.end(); ++sub_it) {
           auto cur_sub = *sub_it;
           assert(cur_sub != nullptr);
-          treedata.emplace_back(cur_sub);
+          cur_sub->id = cur_tree->id + subhalo_count;
+          ++subhalo_count;
         }
+        nsubs_per_file[filenum] += subhalo_count;
       }
-      assert(treedata.size() == nsubs_per_file[filenum]);
+    }
+    std::cout << "Time: " << wall_clock.seconds() << " s.\n";
 
-      // Write to file.
-      H5::H5File writefile(writefilename, H5F_ACC_TRUNC);
-      add_array(writefile, treedata, "Tree", H5DataFormat());
-      writefile.close();
+    // Write to files in parallel. IDs are final at this point, so
+    // each file can be created independently of the others.
+    std::cout << "Writing " << ntrees << " trees to " << nfiles_out <<
+        " files...\n";
+    wall_clock.start();
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t filenum = 0; filenum < nfiles_out; ++filenum) {
+      // Create filename
+      std::stringstream tmp_stream;
+      tmp_stream << writepath << "." << filenum << ".hdf5";
+      write_tree_file(tmp_stream.str(), trees_in_file[filenum],
+          nsubs_per_file[filenum], deflate_level);
     }
 
     std::cout << "Time: " << wall_clock.seconds() << " s.\n";
@@ -9,9 +9,10 @@
 int main(int argc, char** argv)
 {
   // Check input arguments
-  if (argc != 6) {
+  if ((argc < 6) || (argc > 9)) {
     std::cerr << "Usage: ./BuildTrees input_path output_path snapnum_first " <<
-        "snapnum_last skipsnaps_filename\n";
+        "snapnum_last skipsnaps_filename " <<
+        "[nfiles [max_file_size_MB [deflate_level]]]\n";
     exit(1);
   }
 
@@ -21,6 +22,11 @@ int main(int argc, char** argv)
   snapnum_type snapnum_first = atoi(argv[3]);
   snapnum_type snapnum_last = atoi(argv[4]);
   std::string skipsnaps_filename(argv[5]);
+  // Optional: number of output files and target file size (0 = automatic).
+  uint16_t nfiles = (argc > 6) ? atoi(argv[6]) : 0;
+  uint64_t max_file_size = (argc > 7) ? atoll(argv[7]) * 1024 * 1024 : 0;
+  // Optional: compression level of the output files (0 = uncompressed).
+  int deflate_level = (argc > 8) ? atoi(argv[8]) : 0;
 
   // Measure CPU and wall clock (real) time
   CPUClock cpu_clock;
@@ -28,7 +34,7 @@ int main(int argc, char** argv)
 
   // Construct trees and write to files.
   auto all_trees = AllTrees(input_path, output_path, snapnum_first,
-      snapnum_last, skipsnaps_filename);
+      snapnum_last, skipsnaps_filename, nfiles, max_file_size, deflate_level);
   (void) all_trees;  // silence compiler warning
 
   // Print CPU and wall clock time
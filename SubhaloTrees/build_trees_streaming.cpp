@@ -0,0 +1,51 @@
+/** @file build_trees_streaming.cpp
+ * @brief Construct merger trees using descendant files, processing one
+ *        snapshot at a time (for catalogs that do not fit into memory).
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include "StreamingTrees.hpp"
+
+int main(int argc, char** argv)
+{
+  // Check input arguments
+  if ((argc < 6) || (argc > 10)) {
+    std::cerr << "Usage: ./BuildTreesStreaming input_path output_path snapnum_first " <<
+        "snapnum_last skipsnaps_filename " <<
+        "[nfiles [max_file_size_MB [deflate_level [max_memory_MB]]]]\n";
+    exit(1);
+  }
+
+  // Read input
+  std::string input_path(argv[1]);
+  std::string output_path(argv[2]);
+  snapnum_type snapnum_first = atoi(argv[3]);
+  snapnum_type snapnum_last = atoi(argv[4]);
+  std::string skipsnaps_filename(argv[5]);
+  // Optional: number of output files and target file size (0 = automatic).
+  uint16_t nfiles = (argc > 6) ? atoi(argv[6]) : 0;
+  uint64_t max_file_size = (argc > 7) ? atoll(argv[7]) * 1024 * 1024 : 0;
+  // Optional: compression level of the output files (0 = uncompressed).
+  int deflate_level = (argc > 8) ? atoi(argv[8]) : 0;
+  // Optional: memory for the files being written at once (0 = no limit).
+  uint64_t max_memory = (argc > 9) ? atoll(argv[9]) * 1024 * 1024 : 0;
+
+  // Measure CPU and wall clock (real) time
+  CPUClock cpu_clock;
+  WallClock wall_clock;
+
+  // Construct trees and write to files.
+  auto all_trees = StreamingTrees(input_path, output_path, snapnum_first,
+      snapnum_last, skipsnaps_filename, nfiles, max_file_size, deflate_level,
+      max_memory);
+  (void) all_trees;  // silence compiler warning
+
+  // Print CPU and wall clock time
+  std::cout << "Finished.\n";
+  std::cout << "CPU time: "  << cpu_clock.seconds() << " s.\n";
+  std::cout << "Wall clock time: "  << wall_clock.seconds() << " s.\n";
+  std::cout << "\n";
+
+  return 0;
+}
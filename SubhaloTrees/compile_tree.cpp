@@ -0,0 +1,43 @@
+/** @file compile_tree.cpp
+ * @brief Load merger trees from HDF5 files and save them to a single
+ *        binary file, which is memory-mapped by Tree(file_name) and
+ *        therefore loads almost instantly.
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include "../InputOutput/ReadTreeHDF5.hpp"
+
+int main(int argc, char** argv)
+{
+  // Check input arguments
+  if (argc < 4) {
+    std::cerr << "Usage: ./CompileTree treedir name output_filename " <<
+        "[field1 [field2 ...]]\n";
+    exit(1);
+  }
+
+  // Read input
+  std::string treedir(argv[1]);
+  std::string name(argv[2]);  // e.g. "tree_extended"
+  std::string output_filename(argv[3]);
+  // Optional: extra fields to include, e.g. SubhaloMassType.
+  std::vector<std::string> fields(argv + 4, argv + argc);
+
+  // Measure CPU and wall clock (real) time
+  CPUClock cpu_clock;
+  WallClock wall_clock;
+
+  // Load the trees from all files and save them.
+  int filenum = -1;
+  Tree tree(treedir, name, filenum, fields);
+  tree.save(output_filename);
+
+  // Print CPU and wall clock time
+  std::cout << "Finished.\n";
+  std::cout << "CPU time: "  << cpu_clock.seconds() << " s.\n";
+  std::cout << "Wall clock time: "  << wall_clock.seconds() << " s.\n";
+  std::cout << "\n";
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+/** @file publish_tree.cpp
+ * @brief Load merger trees from HDF5 files and publish them in POSIX
+ *        shared memory, so that several analysis processes running on
+ *        the same node can attach to a single copy with Tree::attach().
+ *
+ * The shared memory object persists after this program exits, until it
+ * is removed with "./PublishTree --remove shm_name" (or the node is
+ * rebooted).
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include "../InputOutput/ReadTreeHDF5.hpp"
+
+int main(int argc, char** argv)
+{
+  // Remove a previously published tree.
+  if ((argc == 3) && (std::string(argv[1]) == "--remove")) {
+    MappedColumnFile::remove_shared_memory(argv[2]);
+    std::cout << "Removed " << argv[2] << ".\n";
+    return 0;
+  }
+
+  // Check input arguments
+  if (argc < 4) {
+    std::cerr << "Usage: ./PublishTree treedir name shm_name " <<
+        "[field1 [field2 ...]]\n" <<
+        "       ./PublishTree --remove shm_name\n";
+    exit(1);
+  }
+
+  // Read input
+  std::string treedir(argv[1]);
+  std::string name(argv[2]);  // e.g. "tree_extended"
+  std::string shm_name(argv[3]);  // e.g. "/tree_L75n1820"
+  // Optional: extra fields to include, e.g. SubhaloMassType.
+  std::vector<std::string> fields(argv + 4, argv + argc);
+
+  // Measure CPU and wall clock (real) time
+  CPUClock cpu_clock;
+  WallClock wall_clock;
+
+  // Load the trees from all files and publish them.
+  int filenum = -1;
+  Tree tree(treedir, name, filenum, fields);
+  tree.publish(shm_name);
+
+  // Print CPU and wall clock time
+  std::cout << "Finished.\n";
+  std::cout << "CPU time: "  << cpu_clock.seconds() << " s.\n";
+  std::cout << "Wall clock time: "  << wall_clock.seconds() << " s.\n";
+  std::cout << "\n";
+
+  return 0;
+}
@@ -0,0 +1,212 @@
+#pragma once
+/** @file Prefetcher.hpp
+ * @brief Define a class for loading a known sequence of items (e.g.,
+ *        snapshots) ahead of time, on a background thread.
+ *
+ * @author Vicente Rodriguez-Gomez (v.rodriguez@irya.unam.mx)
+ */
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include <future>     // async
+#include <algorithm>  // find
+#include <cassert>
+
+#include "GeneralUtil.hpp"  // WallClock
+
+/** @class Prefetcher
+ * @brief Load the items of a known sequence one step ahead, so that
+ *        loading item n+1 (on a background thread) overlaps with
+ *        processing item n:
+ *
+ *     Prefetcher<snapnum_type, Data> prefetcher(snapnums, load_data,
+ *         memory_size, max_memory);
+ *     for (std::size_t i = 0; i < snapnums.size(); ++i) {
+ *       auto data = prefetcher.next();
+ *       ...
+ *     }
+ *
+ * Items whose key appears again later in the sequence are kept in memory
+ * and reused instead of being loaded again.
+ *
+ * @tparam Key Type of the keys that identify the items.
+ * @tparam Value Type of the items.
+ *
+ * @note next() must be called from a single thread.
+ */
+template <typename Key, typename Value>
+class Prefetcher {
+public:
+  /** @brief Type of the items returned by next(). */
+  typedef std::shared_ptr<const Value> value_ptr;
+
+  /** @brief Constructor.
+   * @param[in] keys Keys of the items, in the order they will be used.
+   * @param[in] load Function that loads the item with a given key. It is
+   *            called from a background thread.
+   * @param[in] memory_size Function that returns the (approximate) memory
+   *            used by an item, in bytes.
+   * @param[in] max_memory The next item is only prefetched if the items
+   *            still in use (by the caller or kept for reuse), plus the
+   *            next one (estimated as the size of the last item that was
+   *            loaded), take up to this many bytes. If zero, items are
+   *            always loaded when needed.
+   */
+  Prefetcher(const std::vector<Key>& keys,
+      const std::function<Value(const Key&)>& load,
+      const std::function<uint64_t(const Value&)>& memory_size,
+      const uint64_t max_memory)
+      : keys_(keys), load_(load), memory_size_(memory_size),
+        max_memory_(max_memory), pos_(0), kept_(), returned_(), pending_(),
+        pending_key_(), started_(), last_size_(0), load_seconds_(0), wait_seconds_(0) {
+  }
+
+  /** @brief Destructor. Waits for the item being prefetched, if any. */
+  ~Prefetcher() {
+    if (pending_.valid())
+      pending_.wait();
+  }
+
+  /** @brief Return whether there are items left in the sequence. */
+  bool has_next() const {
+    return pos_ < keys_.size();
+  }
+
+  /** @brief Return the next item in the sequence, waiting for it if it is
+   *         still being loaded, and start prefetching the item after it.
+   */
+  value_ptr next() {
+    assert(has_next());
+    const Key& key = keys_[pos_];
+
+    // Get the item: kept from before, prefetched, or loaded right now.
+    value_ptr value;
+    WallClock wall_clock;
+    auto it = kept_.find(key);
+    if (it != kept_.end()) {
+      value = it->second;
+      load_seconds_ = 0;
+    }
+    else {
+      bool prefetched = pending_.valid() && (pending_key_ == key);
+      if (!prefetched)
+        start_loading(key);
+      auto loaded = prefetched ? pending_.get() : load_timed(key);
+      value = loaded.first;
+      load_seconds_ = loaded.second;
+      last_size_ = memory_size_(*value);
+    }
+    wait_seconds_ = wall_clock.seconds();
+    ++pos_;
+
+    // Keep the items that will be used again, and only those.
+    kept_[key] = value;
+    for (auto it = kept_.begin(); it != kept_.end(); ) {
+      if (std::find(keys_.begin() + pos_, keys_.end(), it->first) == keys_.end())
+        it = kept_.erase(it);
+      else
+        ++it;
+    }
+
+    // Prefetch the next item that is not kept, unless it is already being
+    // prefetched, if it fits in memory together with the items that are
+    // still in use.
+    returned_[key] = value;
+    for (std::size_t i = pos_; i < keys_.size(); ++i) {
+      if (kept_.count(keys_[i]))
+        continue;
+      if (pending_.valid() && (pending_key_ == keys_[i]))
+        break;
+      if ((max_memory_ > 0) && (memory_in_use() + last_size_ <= max_memory_)) {
+        start_loading(keys_[i]);
+        pending_key_ = keys_[i];
+        pending_ = std::async(std::launch::async, &Prefetcher::load_timed,
+            this, pending_key_);
+      }
+      break;
+    }
+    return value;
+  }
+
+  /** @brief Return the time spent loading the last item returned by
+   *         next(), in seconds (zero if it was kept from before).
+   */
+  double load_seconds() const {
+    return load_seconds_;
+  }
+
+  /** @brief Return the time that the last call to next() spent waiting
+   *         for its item, in seconds. The difference with load_seconds()
+   *         is the loading time that overlapped with other work.
+   */
+  double wait_seconds() const {
+    return wait_seconds_;
+  }
+
+private:
+  /** @brief Return the memory used by the items that were returned by
+   *         next() and are still in use (by the caller or kept here).
+   */
+  uint64_t memory_in_use() {
+    uint64_t memory = 0;
+    for (auto it = returned_.begin(); it != returned_.end(); ) {
+      auto value = it->second.lock();
+      if (value == nullptr) {
+        it = returned_.erase(it);
+        continue;
+      }
+      memory += memory_size_(*value);
+      ++it;
+    }
+    return memory;
+  }
+
+  /** @brief Record that the item with the given key is about to be
+   *         loaded. Kept and prefetched items are reused, so each item
+   *         must be loaded only once.
+   */
+  void start_loading(const Key& key) {
+    bool is_new = started_.insert(key).second;
+    if (!is_new) {
+      std::cerr << "ERROR: item loaded more than once by Prefetcher.\n";
+      assert(false);
+    }
+  }
+
+  /** @brief Load the item with the given key, and measure the time. */
+  std::pair<value_ptr, double> load_timed(const Key key) const {
+    WallClock wall_clock;
+    value_ptr value(new Value(load_(key)));
+    return std::make_pair(value, wall_clock.seconds());
+  }
+
+  /** Keys of the items, in order of use. */
+  std::vector<Key> keys_;
+  /** Function that loads an item. */
+  std::function<Value(const Key&)> load_;
+  /** Function that returns the memory used by an item. */
+  std::function<uint64_t(const Value&)> memory_size_;
+  /** Memory limit for prefetching, in bytes. */
+  uint64_t max_memory_;
+  /** Position of the next item in keys_. */
+  std::size_t pos_;
+  /** Items that will be used again. */
+  std::map<Key, value_ptr> kept_;
+  /** Items returned by next(), which may still be in use. */
+  std::map<Key, std::weak_ptr<const Value>> returned_;
+  /** Item being prefetched, with its loading time. */
+  std::future<std::pair<value_ptr, double>> pending_;
+  /** Key of the item being prefetched. */
+  Key pending_key_;
+  /** Keys of the items that were loaded or are being loaded. */
+  std::set<Key> started_;
+  /** Memory used by the last item that was loaded. */
+  uint64_t last_size_;
+  /** Loading and waiting times of the last item returned by next(). */
+  double load_seconds_;
+  double wait_seconds_;
+};
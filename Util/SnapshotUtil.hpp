@@ -11,7 +11,9 @@
 #include <cassert>
 #include <cmath>
 #include <algorithm>  // std::find
+#include <utility>  // std::pair
 
+#include "../InputOutput/ReadArepoHDF5.hpp"
 #include "../InputOutput/ReadSubfindHDF5.hpp"
 #include "TreeTypes.hpp"
 
@@ -30,20 +32,17 @@ static constexpr real_type H0_Gyr = H0 * (1e9*365.25*86400);  // in Gyr^-1
  * In this context, the subhalo offset is the index of the
  * first particle of a given type that belongs to each subhalo.
  */
-std::vector<uint64_t> calculate_subhalo_offsets(const std::string& basedir,
-    const snapnum_type snapnum, const int parttype) {
+std::vector<uint64_t> calculate_subhalo_offsets(
+    subfind::CatalogReader& catalog, const int parttype) {
 
   // Load some FoF group and subhalo info
-  auto group_nsubs = subfind::read_block<uint32_t>(basedir, snapnum, "Group",
-      "GroupNsubs", -1);
-  auto ngroups = subfind::get_scalar_attribute<uint32_t>(basedir, snapnum,
-      "Ngroups_Total");
-  auto nsubs = subfind::get_scalar_attribute<uint32_t>(basedir, snapnum,
-      "Nsubgroups_Total");
-  auto group_len = subfind::read_block<uint32_t>(basedir, snapnum, "Group",
-      "GroupLenType", parttype);
-  auto sub_len = subfind::read_block<uint32_t>(basedir, snapnum, "Subhalo",
-      "SubhaloLenType", parttype);
+  std::vector<uint32_t> group_nsubs, group_len, sub_len;
+  catalog.add("Group", "GroupNsubs", &group_nsubs, -1);
+  catalog.add("Group", "GroupLenType", &group_len, parttype);
+  catalog.add("Subhalo", "SubhaloLenType", &sub_len, parttype);
+  catalog.read();
+  uint32_t ngroups = catalog.num_groups();
+  uint32_t nsubs = catalog.num_subhalos();
   std::vector<uint64_t> group_offset(ngroups, 0);
   std::vector<uint64_t> sub_offset(nsubs, 0);
 
@@ -68,6 +67,67 @@ std::vector<uint64_t> calculate_subhalo_offsets(const std::string& basedir,
   return sub_offset;
 }
 
+/** @brief Function to calculate subhalo offsets (see above), opening
+ *         the Subfind catalog from snapshot @a snapnum.
+ */
+std::vector<uint64_t> calculate_subhalo_offsets(const std::string& basedir,
+    const snapnum_type snapnum, const int parttype) {
+  subfind::CatalogReader catalog(basedir, snapnum);
+  return calculate_subhalo_offsets(catalog, parttype);
+}
+
+/** @brief Read a block of particle data for the subhalos in @a sub_indices
+ *         only, given the subhalo offsets and lengths (see above).
+ *
+ * @return One vector per element of @a sub_indices, with the particles
+ *         of that subhalo.
+ */
+template <typename T>
+std::vector<std::vector<T>> read_subhalo_particles(
+    const arepo::SnapshotReader& snapshot, const std::string& block_name,
+    const int parttype, const std::vector<uint32_t>& sub_indices,
+    const std::vector<uint64_t>& sub_offset,
+    const std::vector<uint32_t>& sub_len) {
+
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (auto sub_index : sub_indices)
+    ranges.emplace_back(sub_offset[sub_index], sub_len[sub_index]);
+  auto data = snapshot.read_rows<T>(block_name, parttype, ranges);
+
+  // Split by subhalo.
+  std::vector<std::vector<T>> retval;
+  retval.reserve(sub_indices.size());
+  auto it = data.begin();
+  for (auto& range : ranges) {
+    retval.emplace_back(it, it + range.second);
+    it += range.second;
+  }
+  return retval;
+}
+
+/** @brief Read a block of particle data for the subhalos in @a sub_indices
+ *         only, instead of the full snapshot:
+ *
+ *     arepo::SnapshotReader snapshot(basedir, snapnum);
+ *     subfind::CatalogReader catalog(basedir, snapnum);
+ *     auto pos = read_subhalo_particles<Point>(snapshot, catalog,
+ *         "Coordinates", 4, {0, 17, 42});
+ *
+ * @return One vector per element of @a sub_indices, with the particles
+ *         of that subhalo.
+ */
+template <typename T>
+std::vector<std::vector<T>> read_subhalo_particles(
+    const arepo::SnapshotReader& snapshot, subfind::CatalogReader& catalog,
+    const std::string& block_name, const int parttype,
+    const std::vector<uint32_t>& sub_indices) {
+  auto sub_offset = calculate_subhalo_offsets(catalog, parttype);
+  auto sub_len = catalog.read_block<uint32_t>("Subhalo", "SubhaloLenType",
+      parttype);
+  return read_subhalo_particles<T>(snapshot, block_name, parttype,
+      sub_indices, sub_offset, sub_len);
+}
+
 /** Create list of valid snapshots. */
 std::vector<snapnum_type> get_valid_snapnums(
     const std::string& skipsnaps_filename,
@@ -8,6 +8,8 @@
 
 #include <iostream>
 #include <vector>
+#include <cmath>  // sqrt, copysign
+#include <utility>  // pair
 
 #include "../InputOutput/ReadTreeHDF5.hpp"
 #include "TreeTypes.hpp"
@@ -42,9 +44,7 @@ real_type periodic_dist(const FloatArray<3>& pos1, const FloatArray<3>& pos2,
  */
 Subhalo back_in_time(Subhalo sub, snapnum_type snapnum) {
   assert(sub.is_valid());
-  while ((sub.snapnum() > snapnum) && (sub.is_valid()))
-    sub = sub.first_progenitor();
-  return sub;
+  return sub.main_progenitor_at(snapnum);
 }
 
 /** @brief Get the descendant of @a sub at a given snapshot.
@@ -57,22 +57,17 @@ Subhalo back_in_time(Subhalo sub, snapnum_type snapnum) {
  */
 Subhalo forward_in_time(Subhalo sub, snapnum_type snapnum) {
   assert(sub.is_valid());
-  while ((sub.snapnum() < snapnum) && (sub.is_valid()))
-    sub = sub.descendant();
-  return sub;
+  return sub.descendant_at(snapnum);
 }
 
-#ifdef EXTRA_POINTERS
 /** @brief Return true if @a prog lies along the main branch of @a desc.
  * @pre @a sub1 and @a sub2 are valid subhalos.
  * @note @a sub1 and @a sub2 need not be time-ordered.
  */
 bool along_main_branch(Subhalo sub1, Subhalo sub2) {
-  return sub1.data().MainLeafProgenitorID == sub2.data().MainLeafProgenitorID;
+  return sub1.shares_main_branch(sub2);
 }
-#endif
 
-#ifdef EXTRA_POINTERS
 /** @brief Check if @a possible_desc is a descendant of @a possible_prog.
  * @pre @a desc and @a prog are valid subhalos.
  *
@@ -80,25 +75,24 @@ bool along_main_branch(Subhalo sub1, Subhalo sub2) {
  *       Maybe this function should be called "belongs_to_subtree".
  */
 bool is_descendant(Subhalo desc, Subhalo prog) {
-  return (prog.data().SubhaloID >= desc.data().SubhaloID) &&
-         (prog.data().SubhaloID <= desc.data().LastProgenitorID);
+  return desc.has_progenitor(prog);
 }
-#endif
 
-#ifdef EXTRA_POINTERS
 /** @brief Check if @a primary and @a secondary eventually merge.
  * @pre @a primary != @a secondary.
  */
 bool eventually_merge(Subhalo primary, Subhalo secondary) {
   assert(primary != secondary);
-  return primary.data().RootDescendantID == secondary.data().RootDescendantID;
+  return primary.first_common_descendant(secondary).is_valid();
 }
-#endif
 
-#ifdef EXTRA_POINTERS
 /** @brief Return the subhalo immediately after the merger of @a primary
  * and @a secondary. Return an invalid subhalo if they do not merge.
  *
+ * This is the descendant of @a secondary where it joins the main branch
+ * of the root descendant (see get_first_common_descendant() for the
+ * subhalo where the two actually merge).
+ *
  * @pre @a primary != @a secondary.
  */
 Subhalo get_merger_remnant(Subhalo primary, Subhalo secondary) {
@@ -107,17 +101,137 @@ Subhalo get_merger_remnant(Subhalo primary, Subhalo secondary) {
   assert(primary != secondary);
 
   // If objects do not merge, return an invalid subhalo.
-  if (primary.root_descendant() != secondary.root_descendant())
+  auto root_desc = primary.root_descendant();
+  if (!root_desc.is_valid() || !root_desc.has_progenitor(secondary))
     return Subhalo();
 
-  // Iterate along "forward" branch of secondary until it joins
+  // Follow the "forward" branch of secondary until it joins
   // the main branch of the root descendant.
-  auto root_desc = primary.root_descendant();
-  while (secondary.main_leaf_progenitor() != root_desc.main_leaf_progenitor())
-    secondary = secondary.descendant();
+  secondary = secondary.descendant_along_main_branch(root_desc);
+  assert(along_main_branch(secondary, root_desc));
   return secondary;
 }
-#endif
+
+/** @brief Return the first common descendant of @a primary and
+ * @a secondary, or an invalid subhalo if they do not merge.
+ *
+ * Unlike get_merger_remnant(), this is where the two actually merge,
+ * e.g., when two satellites merge with each other before joining the
+ * main branch of their root descendant.
+ *
+ * @pre @a primary != @a secondary.
+ */
+Subhalo get_first_common_descendant(Subhalo primary, Subhalo secondary) {
+  assert(primary != secondary);
+  return primary.first_common_descendant(secondary);
+}
+
+/** @brief Move @a primary and @a secondary back in time together, and
+ *         call @a f(primary, secondary) at every snapshot where both
+ *         have a progenitor along their main branches, starting from the
+ *         snapshot of @a secondary (or earlier), until @a f returns true
+ *         or one of the branches is truncated.
+ * @tparam F Function object taking two Subhalos and returning bool.
+ *
+ * @pre @a primary and @a secondary are valid subhalos.
+ */
+template <typename F>
+void walk_synced_pairs(Subhalo primary, Subhalo secondary, F&& f) {
+  assert(primary.is_valid() && secondary.is_valid());
+  while (secondary.is_valid()) {
+    // If primary branch is truncated, stop.
+    auto cur_snapnum = secondary.snapnum();
+    primary = back_in_time(primary, cur_snapnum);
+    if (!primary.is_valid())
+      return;
+
+    // Only call f if primary is found at this snapshot (it may have
+    // skipped it); otherwise "increment" secondary and try again.
+    if ((primary.snapnum() == cur_snapnum) && f(primary, secondary))
+      return;
+    secondary = secondary.first_progenitor();
+  }
+}
+
+/** @brief Get the progenitors of @a primary and @a secondary at the
+ *         latest snapshot (not later than that of @a secondary) when
+ *         @a pred(primary, secondary) is true.
+ * @tparam Predicate Function object taking two Subhalos and returning
+ *         bool, e.g., DifferentFoFGroups or OutsideR200.
+ * @return A pair with the main branch progenitors, or a pair with
+ *         invalid subhalos if one or both branches are truncated before
+ *         the condition is met.
+ *
+ * @pre @a primary and @a secondary are valid subhalos.
+ * @post new(@a primary).snapnum() == new(@a secondary).snapnum()
+ */
+template <typename Predicate>
+std::pair<Subhalo, Subhalo> sync_back_until(Subhalo primary,
+    Subhalo secondary, const Predicate& pred) {
+  auto retval = std::make_pair(Subhalo(), Subhalo());
+  walk_synced_pairs(primary, secondary,
+      [&](const Subhalo& sub1, const Subhalo& sub2) {
+        if (!pred(sub1, sub2))
+          return false;
+        retval = std::make_pair(sub1, sub2);
+        return true;
+      });
+  return retval;
+}
+
+/** @brief Same as sync_back_until() for many (primary, secondary) pairs,
+ *         which are processed in parallel.
+ */
+template <typename Predicate>
+std::vector<std::pair<Subhalo, Subhalo>> sync_back_until(
+    const std::vector<std::pair<Subhalo, Subhalo>>& pairs,
+    const Predicate& pred) {
+  const int64_t npairs = pairs.size();
+  std::vector<std::pair<Subhalo, Subhalo>> retval(npairs);
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int64_t i = 0; i < npairs; ++i)
+    retval[i] = sync_back_until(pairs[i].first, pairs[i].second, pred);
+  return retval;
+}
+
+/** @brief Predicate for sync_back_until(): true if @a primary and
+ *         @a secondary belong to different FoF groups (i.e., before infall).
+ */
+struct DifferentFoFGroups {
+  bool operator()(const Subhalo& primary, const Subhalo& secondary) const {
+    return primary.first_subhalo_in_fof_group() !=
+        secondary.first_subhalo_in_fof_group();
+  }
+};
+
+/** @brief Predicate for sync_back_until(): true if @a secondary is outside
+ *         the virial radius (more exactly, R200Crit) of the parent FoF
+ *         group of @a primary.
+ * @pre The tree includes the GroupPos, SubhaloPos and Group_R_Crit200 fields.
+ */
+class OutsideR200 {
+public:
+  /** @brief Constructor.
+   * @param[in] tree The merger tree.
+   * @param[in] box_size Size of the cosmological box in ckpc/h.
+   */
+  OutsideR200(const Tree& tree, const real_type box_size)
+      : group_pos_(tree.column<FloatArray<3>>("GroupPos")),
+        sub_pos_(tree.column<FloatArray<3>>("SubhaloPos")),
+        group_r200_(tree.column<real_type>("Group_R_Crit200")),
+        box_size_(box_size) {
+  }
+  bool operator()(const Subhalo& primary, const Subhalo& secondary) const {
+    return periodic_dist(group_pos_[primary], sub_pos_[secondary], box_size_) >
+        group_r200_[primary];
+  }
+
+private:
+  Tree::Column<FloatArray<3>> group_pos_;
+  Tree::Column<FloatArray<3>> sub_pos_;
+  Tree::Column<real_type> group_r200_;
+  real_type box_size_;
+};
 
 /** @brief Get the progenitors of @a primary and @a secondary at
  *         the moment of infall or earlier.
@@ -135,43 +249,22 @@ Subhalo get_merger_remnant(Subhalo primary, Subhalo secondary) {
 std::pair<Subhalo, Subhalo> get_infall_pair(Subhalo primary,
     Subhalo secondary) {
   assert(primary.is_valid() && secondary.is_valid());
+  return sync_back_until(primary, secondary, DifferentFoFGroups());
+}
 
-  while (true) {
-    // If secondary branch is truncated, return invalid Subhalos.
-    if (!secondary.is_valid())
-      return std::make_pair(Subhalo(), Subhalo());
-
-    // If primary branch is truncated, return invalid Subhalos.
-    auto cur_snapnum = secondary.snapnum();
-    primary = back_in_time(primary, cur_snapnum);
-    if (!primary.is_valid())
-      return std::make_pair(Subhalo(), Subhalo());
-
-    // If primary skipped this snapshot, or is for some other reason found
-    // at an earlier snapshot, "increment" secondary and try again.
-    if (primary.snapnum() != cur_snapnum) {
-      secondary = secondary.first_progenitor();
-      continue;
-    }
-    // If we got here, both primary and secondary are valid Subhalos at
-    // the same snapshot. If they do not belong to the same FoF group,
-    // we have reached infall.
-    if (  primary.first_subhalo_in_fof_group() !=
-        secondary.first_subhalo_in_fof_group())
-      return std::make_pair(primary, secondary);
-
-    // Increment secondary
-    secondary = secondary.first_progenitor();
-  }
-  assert(false);
+/** @brief Same as get_infall_pair() for many (primary, secondary) pairs,
+ *         which are processed in parallel.
+ */
+std::vector<std::pair<Subhalo, Subhalo>> get_infall_pair(
+    const std::vector<std::pair<Subhalo, Subhalo>>& pairs) {
+  return sync_back_until(pairs, DifferentFoFGroups());
 }
 
-#ifdef INFALL_CATALOG
 /** @brief Get the progenitors of @a primary and @a secondary at
  *         the moment of virial crossing.
  * @param[in] primary The primary subhalo.
  * @param[in] secondary The secondary subhalo.
- * @param[in] box_size Size of the cosmological box in ckpc/h.
+ * @param[in] outside_r200 The predicate, built once for the tree.
  * @param[in] last_crossing If true, get info about the last (latest)
  *     virial crossing; otherwise get the first (earliest) one.
  * @return A pair with the main branch progenitors of @a primary
@@ -185,62 +278,75 @@ std::pair<Subhalo, Subhalo> get_infall_pair(Subhalo primary,
  * @post new(@a primary).snapnum() == new(@a secondary).snapnum()
  */
 std::pair<Subhalo, Subhalo> get_pair_virial_crossing(Subhalo primary,
-    Subhalo secondary, real_type box_size, bool last_crossing = true) {
+    Subhalo secondary, const OutsideR200& outside_r200,
+    bool last_crossing = true) {
   assert(primary.is_valid() && secondary.is_valid());
 
   // By default return invalid Subhalos.
   auto sub_pair = std::make_pair(Subhalo(), Subhalo());
 
   // If subhalo is initially outside of R200Crit, there's nothing to do.
-  if (periodic_dist(primary.data().GroupPos, secondary.data().SubhaloPos, box_size) > primary.data().Group_R_Crit200) {
+  if (outside_r200(primary, secondary))
     return sub_pair;  // invalid Subhalos
-  }
-
-  // Keep track of subhalo separation with respect to R200Crit.
-  bool inside_r200 = true;
 
-  while (true) {
-    // If secondary branch ends, break.
-    if (!secondary.is_valid())
-      break;
+  // If we're only interested in the last (latest) crossing, stop as soon
+  // as secondary is found outside of R200Crit.
+  if (last_crossing)
+    return sync_back_until(primary, secondary, outside_r200);
 
-    // If primary branch ends, break.
-    auto cur_snapnum = secondary.snapnum();
-    primary = back_in_time(primary, cur_snapnum);
-    if (!primary.is_valid())
-      break;
+  // Otherwise, keep track of subhalo separation with respect to R200Crit,
+  // and overwrite info every time secondary was previously inside.
+  bool inside_r200 = true;
+  walk_synced_pairs(primary, secondary,
+      [&](const Subhalo& sub1, const Subhalo& sub2) {
+        if (outside_r200(sub1, sub2)) {
+          if (inside_r200)
+            sub_pair = std::make_pair(sub1, sub2);
+          inside_r200 = false;
+        }
+        else {
+          inside_r200 = true;
+        }
+        return false;
+      });
+  return sub_pair;
+}
 
-    // If primary skipped this snapshot, or is for some other reason found
-    // at an earlier snapshot, "increment" secondary and try again.
-    if (primary.snapnum() != cur_snapnum) {
-      secondary = secondary.first_progenitor();
-      continue;
-    }
+/** @brief Same as get_pair_virial_crossing(), building the predicate
+ *         for a single pair.
+ * @param[in] box_size Size of the cosmological box in ckpc/h.
+ * @pre The tree includes the GroupPos, SubhaloPos and Group_R_Crit200 fields.
+ */
+std::pair<Subhalo, Subhalo> get_pair_virial_crossing(Subhalo primary,
+    Subhalo secondary, real_type box_size, bool last_crossing = true) {
+  assert(primary.is_valid() && secondary.is_valid());
+  return get_pair_virial_crossing(primary, secondary,
+      OutsideR200(primary.tree(), box_size), last_crossing);
+}
 
-    // If we got here, both primary and secondary are valid Subhalos at
-    // the same snapshot. Check if secondary is outside of R200Crit.
-    if (periodic_dist(primary.data().GroupPos, secondary.data().SubhaloPos, box_size) > primary.data().Group_R_Crit200) {
-      // If we're only interested in the last (latest) crossing, we're finished.
-      if (last_crossing) {
-        sub_pair = std::make_pair(primary, secondary);
-        break;
-      }
-      // Otherwise, check if subhalo was previously inside R200Crit.
-      if (inside_r200) {
-        // Overwrite info about earliest virial crossing
-        sub_pair = std::make_pair(primary, secondary);
-        inside_r200 = false;
-      }
-    }
-    else {
-      inside_r200 = true;
-    }
-    // Increment secondary
-    secondary = secondary.first_progenitor();
+/** @brief Same as get_pair_virial_crossing() for many (primary, secondary)
+ *         pairs, which are processed in parallel.
+ * @pre All pairs belong to the same Tree.
+ */
+std::vector<std::pair<Subhalo, Subhalo>> get_pair_virial_crossing(
+    const std::vector<std::pair<Subhalo, Subhalo>>& pairs,
+    real_type box_size, bool last_crossing = true) {
+  const int64_t npairs = pairs.size();
+  std::vector<std::pair<Subhalo, Subhalo>> retval(npairs);
+  if (npairs == 0)
+    return retval;
+
+  // Resolve the fields only once.
+  const Tree& tree = pairs.front().first.tree();
+  const OutsideR200 outside_r200(tree, box_size);
+#pragma omp parallel for schedule(dynamic, 256)
+  for (int64_t i = 0; i < npairs; ++i) {
+    assert(&pairs[i].first.tree() == &tree);
+    retval[i] = get_pair_virial_crossing(pairs[i].first, pairs[i].second,
+        outside_r200, last_crossing);
   }
-  return sub_pair;
+  return retval;
 }
-#endif
 
 /** @brief Get the progenitors of @a primary and @a secondary at
  *         the same snapshot as @a secondary or earlier.
@@ -255,38 +361,13 @@ std::pair<Subhalo, Subhalo> get_pair_virial_crossing(Subhalo primary,
  * @pre @a primary and @a secondary are valid subhalos.
  * @pre @a secondary.snapnum() <= @a primary.snapnum()
  * @post new(@a primary).snapnum() == new(@a secondary).snapnum()
- *
- * @note Implementation of this function is very similar to get_infall_pair().
- *       Both functions could rely on a more general function in which the two
- *       subhalos are "moved" back to a moment when a certain condition
- *       becomes true.
  */
 std::pair<Subhalo, Subhalo> synchronize_subhalos(Subhalo primary,
     Subhalo secondary) {
   assert(primary.is_valid() && secondary.is_valid());
   assert(secondary.snapnum() <= primary.snapnum());
-
-  while (true) {
-    // If secondary branch is truncated, return invalid Subhalos.
-    if (!secondary.is_valid())
-      return std::make_pair(Subhalo(), Subhalo());
-
-    // If primary branch is truncated, return invalid Subhalos.
-    auto cur_snapnum = secondary.snapnum();
-    primary = back_in_time(primary, cur_snapnum);
-    if (!primary.is_valid())
-      return std::make_pair(Subhalo(), Subhalo());
-
-    // If primary skipped this snapshot, "increment" secondary and try again.
-    if (primary.snapnum() != cur_snapnum) {
-      secondary = secondary.first_progenitor();
-      continue;
-    }
-    // If we got here, both primary and secondary are valid Subhalos at
-    // the same snapshot.
-    return std::make_pair(primary, secondary);
-  }
-  assert(false);
+  return sync_back_until(primary, secondary,
+      [](const Subhalo&, const Subhalo&) { return true; });
 }
 
 /** @brief Return true if @a secondary has already "infalled" into
@@ -305,15 +386,17 @@ bool after_infall(Subhalo primary, Subhalo secondary) {
       secondary.first_subhalo_in_fof_group());
 }
 
-#ifdef EXTRA_POINTERS
 /** @brief Calculate the stellar mass ratio of the merger
  *         between @a primary and @a secondary.
  * @pre @a primary and @a secondary are valid subhalos.
  * @pre @a secondary is not along the main branch of @a primary
+ * @pre The tree includes the SubhaloMassType field.
  *
  * @note @a primary and @a secondary need not merge eventually.
  */
 real_type get_merger_mass_ratio(Subhalo primary, Subhalo secondary) {
+  auto mass_type = primary.tree().column<FloatArray<6>>("SubhaloMassType");
+
   // Check preconditions
   //assert(primary.is_valid() && secondary.is_valid());
   //assert(!along_main_branch(primary, secondary));
@@ -361,9 +444,9 @@ real_type get_merger_mass_ratio(Subhalo primary, Subhalo secondary) {
     }
     // If we got here, then both primary and secondary are valid Subhalos at
     // the same snapshot. Now we look at their stellar masses.
-    if (secondary.data().SubhaloMassType[4] > mstar_stmax_2) {
-      mstar_stmax_1 = primary.data().SubhaloMassType[4];
-      mstar_stmax_2 = secondary.data().SubhaloMassType[4];
+    if (mass_type[secondary][4] > mstar_stmax_2) {
+      mstar_stmax_1 = mass_type[primary][4];
+      mstar_stmax_2 = mass_type[secondary][4];
     }
     // "Increment" secondary
     secondary = secondary.descendant();
@@ -377,7 +460,6 @@ real_type get_merger_mass_ratio(Subhalo primary, Subhalo secondary) {
   // Return mass ratio
   return std::min(mstar_stmax_2/mstar_stmax_1, mstar_stmax_1/mstar_stmax_2);
 }
-#endif
 
 /** Return the progenitor along the main branch which has the largest
  * mass (depending on merger tree type).
@@ -395,22 +477,50 @@ Subhalo at_tmax(Subhalo sub) {
 /** Return the progenitor along the main branch which has the largest
  * stellar mass.
  * @pre @a sub is valid.
+ * @pre The tree includes the SubhaloMassType field.
  */
 Subhalo at_stmax(Subhalo sub) {
+  auto mass_type = sub.tree().column<FloatArray<6>>("SubhaloMassType");
   auto sub_stmax = sub;
   sub = sub.first_progenitor();
-#ifdef COUNT_MERGERS
   for ( ; sub.is_valid(); sub = sub.first_progenitor())
-    if (sub.data().SubhaloMassType[4] > sub_stmax.data().SubhaloMassType[4])
+    if (mass_type[sub][4] > mass_type[sub_stmax][4])
       sub_stmax = sub;
-#else
-  std::cerr << "Error: SubhaloMassType not included in trees." << std::endl;
-  exit(1);
-#endif
 
   return sub_stmax;
 }
 
+/** @brief Return, for every subhalo in @a tree, the progenitor along its
+ *         main branch with the largest mass, so that at_tmax() takes
+ *         constant time.
+ */
+Tree::BranchMax compute_tmax(const Tree& tree) {
+  auto mass = tree.column<real_type>("Mass");
+  return tree.main_branch_max(
+      [&mass](const Subhalo& sub) { return mass[sub]; });
+}
+
+/** @brief Return, for every subhalo in @a tree, the progenitor along its
+ *         main branch with the largest stellar mass, so that at_stmax()
+ *         and get_stmax_pair() take constant time.
+ * @pre The tree includes the SubhaloMassType field.
+ */
+Tree::BranchMax compute_stmax(const Tree& tree) {
+  auto mass_type = tree.column<FloatArray<6>>("SubhaloMassType");
+  return tree.main_branch_max(
+      [&mass_type](const Subhalo& sub) { return mass_type[sub][4]; });
+}
+
+/** Same as at_tmax(sub), using the result of compute_tmax(). */
+Subhalo at_tmax(Subhalo sub, const Tree::BranchMax& tmax) {
+  return tmax.argmax(sub);
+}
+
+/** Same as at_stmax(sub), using the result of compute_stmax(). */
+Subhalo at_stmax(Subhalo sub, const Tree::BranchMax& stmax) {
+  return stmax.argmax(sub);
+}
+
 /** @brief Get the progenitors of @a primary and @a secondary at
  *         the moment when @a secondary reached its maximum stellar mass.
  * @param[in] primary The primary subhalo.
@@ -440,3 +550,18 @@ std::pair<Subhalo, Subhalo> get_stmax_pair(Subhalo primary,
     return std::make_pair(Subhalo(), Subhalo());
   return std::make_pair(prog_stmax_1, prog_stmax_2);
 }
+
+/** Same as get_stmax_pair(primary, secondary), using the result of
+ * compute_stmax().
+ */
+std::pair<Subhalo, Subhalo> get_stmax_pair(Subhalo primary,
+    Subhalo secondary, const Tree::BranchMax& stmax) {
+  assert(primary.is_valid() && secondary.is_valid());
+
+  auto prog_stmax_2 = at_stmax(secondary, stmax);
+  auto prog_stmax_1 = back_in_time(primary, prog_stmax_2.snapnum());
+
+  if (!prog_stmax_1.is_valid())
+    return std::make_pair(Subhalo(), Subhalo());
+  return std::make_pair(prog_stmax_1, prog_stmax_2);
+}